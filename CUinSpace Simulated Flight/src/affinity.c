@@ -0,0 +1,256 @@
+/***************************************************************
+ * affinity.c
+ * Contains the topology-aware thread placement planner.
+ * Systems that share a resource are clustered together so the resource's cache line stays
+ * within one cache domain, each cluster is pinned to the CPUs sharing one cache, and the
+ * manager gets a CPU of its own. The cache level is the largest one that still gives every
+ * cluster a domain of its own, so on a single socket the clusters are split by L2 or core
+ * complex rather than all landing on the one L3.
+ ***************************************************************/
+
+#define _GNU_SOURCE
+#include "defs.h"
+#include <assert.h>
+#include <sched.h>
+
+#define AFFINITY_MAX_CACHES 10  // Cache indexes probed per CPU in sysfs
+#define AFFINITY_MAX_LEVEL  4   // Highest cache level considered, level 0 stands for each CPU on its own
+
+static int affinity_find(int *parent, int i);
+static int affinity_cache_domain(int cpu, int level);
+static void affinity_print_cpus(const cpu_set_t *set, int n_cpus);
+
+/**
+ * Plans and applies the placement of the manager and system threads, then reports it.
+ *
+ * Clusters are the connected components of the recipe graph (systems joined by the resources they
+ * consume or produce). Only the CPUs this process may run on are used, which under a cpuset or
+ * taskset need not start at 0. The manager is pinned to the lowest of them and every cluster to the
+ * CPUs of one cache domain, choosing the least loaded domain for the largest clusters first.
+ * A thread that could not be pinned is reported as such, not with its planned CPUs.
+ *
+ * @param[in] manager        Pointer to the loaded `Manager`.
+ * @param[in] manager_thread Thread running `manager_thread()`.
+ * @param[in] system_threads Threads running `system_thread()`, in the order of the system array.
+ */
+void affinity_pin_threads(const Manager *manager, pthread_t manager_thread, const pthread_t *system_threads) {
+    int n_systems = manager->system_array.size;
+    int n_resources = manager->resources.size;
+    int n_clusters = 0;
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) {
+        perror("sched_getaffinity");
+        return;
+    }
+    if (CPU_COUNT(&allowed) < 2) {
+        printf("Affinity: only %d CPU allowed, leaving threads unpinned.\n", CPU_COUNT(&allowed));
+        return;
+    }
+
+    // CPU ids may have gaps, the arrays are indexed by id up to the highest allowed one
+    int n_cpus = 0, manager_cpu = -1;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (manager_cpu < 0) manager_cpu = cpu;
+        n_cpus = cpu + 1;
+    }
+
+    // Union every system's input and output so systems sharing a resource share a cluster
+    int *parent = malloc((n_resources + n_systems) * sizeof(int));
+    int *cluster_size = calloc(n_resources + n_systems, sizeof(int));
+    int *cluster_domain = malloc((n_resources + n_systems) * sizeof(int));
+    int *system_cluster = malloc(n_systems * sizeof(int));
+    assert(parent != NULL && cluster_size != NULL && cluster_domain != NULL && system_cluster != NULL);
+
+    for (int i = 0; i < n_resources + n_systems; i++) {
+        parent[i] = i;
+        cluster_domain[i] = -1;
+    }
+    for (int i = 0; i < n_systems; i++) {
+        const Recipe *recipe = manager->system_array.systems[i]->recipe;
+        if (recipe->input && recipe->output) {
+            parent[affinity_find(parent, recipe->input->id)] = affinity_find(parent, recipe->output->id);
+        }
+    }
+    for (int i = 0; i < n_systems; i++) {
+        const Recipe *recipe = manager->system_array.systems[i]->recipe;
+        const Resource *any = recipe->input ? recipe->input : recipe->output;
+        // A system touching no resource forms a cluster of its own, numbered after the resources
+        system_cluster[i] = any ? affinity_find(parent, any->id) : n_resources + i;
+        if (cluster_size[system_cluster[i]]++ == 0) n_clusters++;
+    }
+
+    // Domains of the allowed CPUs other than the manager's at every cache level, a level that some
+    // of them lack counts as none
+    int *domains = malloc((AFFINITY_MAX_LEVEL + 1) * n_cpus * sizeof(int));
+    int *domain_load = calloc(n_cpus, sizeof(int));
+    int *domain_usable = calloc(n_cpus, sizeof(int));
+    int n_domains[AFFINITY_MAX_LEVEL + 1];
+    assert(domains != NULL && domain_load != NULL && domain_usable != NULL);
+    for (int level = 0; level <= AFFINITY_MAX_LEVEL; level++) {
+        int *domain_of = &domains[level * n_cpus];
+        memset(domain_usable, 0, n_cpus * sizeof(int));
+        n_domains[level] = 0;
+        for (int cpu = 0; cpu < n_cpus; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed)) continue;
+            domain_of[cpu] = level == 0 ? cpu : affinity_cache_domain(cpu, level);
+            if (domain_of[cpu] < 0) {
+                n_domains[level] = -1;
+                break;
+            }
+            if (cpu != manager_cpu && !domain_usable[domain_of[cpu]]) {
+                domain_usable[domain_of[cpu]] = 1;
+                n_domains[level]++;
+            }
+        }
+    }
+
+    // The largest cache that splits the CPUs into a domain per cluster, else the largest one there is,
+    // which the clusters then share
+    int highest = 0, cache_level = -1;
+    for (int level = AFFINITY_MAX_LEVEL; level >= 0; level--) {
+        if (n_domains[level] <= 0) continue;
+        if (highest == 0) highest = level;
+        if (cache_level < 0 && n_domains[level] >= n_clusters) cache_level = level;
+    }
+    if (cache_level < 0) cache_level = highest;
+
+    int *domain_of = &domains[cache_level * n_cpus];
+    memset(domain_usable, 0, n_cpus * sizeof(int));
+    for (int cpu = 0; cpu < n_cpus; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && cpu != manager_cpu) domain_usable[domain_of[cpu]] = 1;
+    }
+
+    // Largest clusters first, each onto the least loaded domain
+    for (;;) {
+        int largest = -1, best = -1;
+        for (int c = 0; c < n_resources + n_systems; c++) {
+            if (cluster_size[c] > 0 && cluster_domain[c] < 0 && (largest < 0 || cluster_size[c] > cluster_size[largest])) {
+                largest = c;
+            }
+        }
+        if (largest < 0) break;
+
+        for (int d = 0; d < n_cpus; d++) {
+            if (domain_usable[d] && (best < 0 || domain_load[d] < domain_load[best])) best = d;
+        }
+        cluster_domain[largest] = best;
+        domain_load[best] += cluster_size[largest];
+    }
+
+    // Pin the manager, then every system to all CPUs of its cluster's domain
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(manager_cpu, &set);
+    int result = pthread_setaffinity_np(manager_thread, sizeof(cpu_set_t), &set);
+    if (result != 0) {
+        printf("Affinity: manager could not be pinned to CPU %d: %s\n", manager_cpu, strerror(result));
+    } else {
+        printf("Affinity: manager -> CPU %d\n", manager_cpu);
+    }
+    if (cache_level == 0) {
+        printf("Affinity: %d cluster(s) on %d single CPU domain(s), no cache shared by several CPUs splits them finely enough\n",
+            n_clusters, n_domains[0]);
+    } else if (n_domains[cache_level] < n_clusters) {
+        printf("Affinity: %d cluster(s) sharing %d L%d cache domain(s), no level gives each cluster its own\n",
+            n_clusters, n_domains[cache_level], cache_level);
+    } else if (cache_level < highest) {
+        printf("Affinity: %d cluster(s) on %d L%d cache domain(s), the L%d cache only forms %d\n",
+            n_clusters, n_domains[cache_level], cache_level, highest, n_domains[highest]);
+    } else {
+        printf("Affinity: %d cluster(s) on %d L%d cache domain(s), the largest cache\n",
+            n_clusters, n_domains[cache_level], cache_level);
+    }
+
+    for (int c = 0; c < n_resources + n_systems; c++) {
+        if (cluster_size[c] == 0) continue;
+
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < n_cpus; cpu++) {
+            if (CPU_ISSET(cpu, &allowed) && cpu != manager_cpu && domain_of[cpu] == cluster_domain[c]) CPU_SET(cpu, &set);
+        }
+
+        printf("Affinity: cluster %d ->", c);
+        affinity_print_cpus(&set, n_cpus);
+        printf(":");
+        for (int i = 0; i < n_systems; i++) {
+            if (system_cluster[i] != c) continue;
+            result = pthread_setaffinity_np(system_threads[i], sizeof(cpu_set_t), &set);
+            if (result != 0) {
+                printf(" [%s not pinned: %s]", manager->system_array.systems[i]->info.name, strerror(result));
+            } else {
+                printf(" [%s]", manager->system_array.systems[i]->info.name);
+            }
+        }
+        printf("\n");
+    }
+
+    free(parent);
+    free(cluster_size);
+    free(cluster_domain);
+    free(system_cluster);
+    free(domains);
+    free(domain_load);
+    free(domain_usable);
+}
+
+/**
+ * Local helper that finds the root of a union-find set, compressing the path as it goes.
+ *
+ * @param[in,out] parent Union-find parent array.
+ * @param[in]     i      Element to look up.
+ * @return The root of the set containing `i`.
+ */
+static int affinity_find(int *parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/**
+ * Local helper that finds which cache domain of a level a CPU belongs to.
+ *
+ * Reads the CPU's caches from sysfs. The domain is named by the lowest numbered CPU sharing the
+ * cache of that level, so CPUs sharing it get the same domain.
+ *
+ * @param[in] cpu   CPU number.
+ * @param[in] level Cache level.
+ * @return The domain of the CPU, -1 if sysfs shows no cache of that level for it.
+ */
+static int affinity_cache_domain(int cpu, int level) {
+    char path[128];
+
+    for (int index = 0; index < AFFINITY_MAX_CACHES; index++) {
+        int cache_level, first, domain = -1;
+        FILE *file;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+        if ((file = fopen(path, "r")) == NULL) break;
+        if (fscanf(file, "%d", &cache_level) != 1) cache_level = 0;
+        fclose(file);
+        if (cache_level != level) continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+        if ((file = fopen(path, "r")) == NULL) continue;
+        if (fscanf(file, "%d", &first) == 1) domain = first;
+        fclose(file);
+        if (domain >= 0) return domain;
+    }
+    return -1;
+}
+
+/**
+ * Local helper that prints a CPU set as a list of CPU numbers.
+ *
+ * @param[in] set    The CPU set to print.
+ * @param[in] n_cpus One past the highest CPU id that may be in the set.
+ */
+static void affinity_print_cpus(const cpu_set_t *set, int n_cpus) {
+    printf(" CPUs");
+    for (int cpu = 0; cpu < n_cpus; cpu++) {
+        if (CPU_ISSET(cpu, set)) printf(" %d", cpu);
+    }
+}
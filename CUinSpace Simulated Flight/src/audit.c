@@ -0,0 +1,269 @@
+/***************************************************************
+ * audit.c
+ * Contains the transfer audit log, who moved how much of what and when.
+ * Every thread that transfers appends (time, system, resource, delta) to a ring of its own,
+ * allocated when the thread attaches, so the transfer path only ever writes to the thread's own
+ * cache lines: no shared counter, no lock, no sequence number like the event recorder's. A
+ * background flusher drains the rings, merges them by time and appends them to `AUDIT_PATH`.
+ *
+ * A record is stamped before it is published, so the flusher cannot just write what it sees. It
+ * takes the time first, then waits out any append in progress in each ring: every record stamped
+ * before that time is then visible, and only those are written. The rest wait for the next flush.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#include <sched.h>
+
+// One transfer
+typedef struct AuditRecord {
+    uint64_t time_ns;   // Monotonic time of the transfer, taken under the resource's mutex
+    int32_t system;     // System the transfer was for, -1 if the thread runs none
+    int32_t resource;
+    int32_t delta;      // Amount moved, negative when taken from storage
+    int32_t unused;
+} AuditRecord;
+
+// Records of one thread, written by that thread and read by the flusher only
+typedef struct AuditRing {
+    uint64_t head;          // Records ever appended, written by the thread
+    int appending;          // Set while the thread stamps and fills a record
+    int system;             // System of the thread, see `audit_attach()`
+    uint64_t tail_seen;     // Last `tail` the thread read, so it only reads `tail` again when the ring looks full
+    uint64_t stalls;        // Appends that had to wait for the flusher
+    uint64_t tail __attribute__((aligned(64)));  // Records ever written to the file, written by the flusher
+    struct AuditRing *next; // Next ring in the list of all rings
+    AuditRecord records[AUDIT_RING_RECORDS];
+} AuditRing;
+
+static int audit_active = 0;                   // Whether transfers are being audited
+static int audit_stopping = 0;                 // Set when the flusher should drain every ring and exit
+static uint64_t audit_start_ns = 0;            // Time the audit started, records are written relative to it
+static AuditRing *audit_rings = NULL;          // Rings of every thread that transferred
+static pthread_mutex_t audit_lock = PTHREAD_MUTEX_INITIALIZER;  // Protects the list of rings, not the rings
+static pthread_t audit_flusher;
+static FILE *audit_file = NULL;
+static uint64_t audit_written = 0;             // Records written so far, by the flusher only
+static __thread AuditRing *audit_local = NULL;
+
+static AuditRing *audit_ring(void);
+static uint64_t audit_now_ns(void);
+static void *audit_flush_thread(void *arg);
+static void audit_flush(const Manager *manager, uint64_t until_ns);
+
+/**
+ * Starts auditing transfers and the thread that writes them to `path`, truncating it.
+ *
+ * @param[in] manager Pointer to the `Manager` being run, its names are written with the records.
+ * @param[in] path    Path of the audit file.
+ * @return 0 on success, 1 if the file or the flusher could not be created.
+ */
+int audit_start(Manager *manager, const char *path) {
+    audit_file = fopen(path, "w");
+    if (audit_file == NULL) {
+        perror("open audit log");
+        return 1;
+    }
+    fprintf(audit_file, "time_us,system,resource,delta\n");
+
+    audit_start_ns = audit_now_ns();
+    audit_stopping = 0;
+    audit_written = 0;
+    __atomic_store_n(&audit_active, 1, __ATOMIC_RELEASE);
+
+    if (pthread_create(&audit_flusher, NULL, audit_flush_thread, manager) != 0) {
+        printf("Failed to create audit flusher thread\n");
+        __atomic_store_n(&audit_active, 0, __ATOMIC_RELEASE);
+        fclose(audit_file);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Stops auditing, writes whatever the rings still hold and frees them.
+ *
+ * Must be called once every thread that transferred has finished.
+ */
+void audit_finish(void) {
+    uint64_t stalls = 0;
+    int rings = 0;
+
+    if (!__atomic_load_n(&audit_active, __ATOMIC_ACQUIRE)) return;
+    __atomic_store_n(&audit_stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(audit_flusher, NULL);
+    __atomic_store_n(&audit_active, 0, __ATOMIC_RELEASE);
+
+    while (audit_rings != NULL) {
+        AuditRing *ring = audit_rings;
+        stalls += ring->stalls;
+        rings++;
+        audit_rings = ring->next;
+        free(ring);
+    }
+    fclose(audit_file);
+    audit_file = NULL;
+    printf("Audit: %llu transfer(s) from %d thread(s) written to %s, %llu append(s) waited for the flusher\n",
+        (unsigned long long)audit_written, rings, AUDIT_PATH, (unsigned long long)stalls);
+}
+
+/**
+ * Tells the audit which system the calling thread transfers for, and allocates the thread's ring
+ * so its first transfer does not have to.
+ *
+ * @param[in] system Id of the system, -1 for none.
+ */
+void audit_attach(int system) {
+    if (__atomic_load_n(&audit_active, __ATOMIC_ACQUIRE)) {
+        audit_ring()->system = system;
+    }
+}
+
+/**
+ * Appends a transfer to the calling thread's ring. Must be called while holding the resource's mutex.
+ *
+ * Waits for the flusher only if the ring is full.
+ *
+ * @param[in] resource The resource transferred from or into.
+ * @param[in] delta    Amount moved into storage, negative if it was taken out.
+ */
+void audit_transfer(const Resource *resource, int delta) {
+    if (!AUDIT_LOG || !__atomic_load_n(&audit_active, __ATOMIC_RELAXED)) return;
+    AuditRing *ring = audit_ring();
+
+    // Wait for room first, the flusher waits for appends in progress and would wait for this one
+    if (ring->head - ring->tail_seen == AUDIT_RING_RECORDS) {
+        ring->tail_seen = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (ring->head - ring->tail_seen == AUDIT_RING_RECORDS) {
+            ring->stalls++;
+            while (ring->head - ring->tail_seen == AUDIT_RING_RECORDS) {
+                sched_yield();
+                ring->tail_seen = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            }
+        }
+    }
+
+    __atomic_store_n(&ring->appending, 1, __ATOMIC_SEQ_CST);
+    AuditRecord *record = &ring->records[ring->head % AUDIT_RING_RECORDS];
+    record->time_ns = audit_now_ns();
+    record->system = ring->system;
+    record->resource = resource->id;
+    record->delta = delta;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->appending, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Local helper that finds the calling thread's ring, creating and registering it on first use.
+ *
+ * @return The thread's `AuditRing`.
+ */
+static AuditRing *audit_ring(void) {
+    if (audit_local == NULL) {
+        audit_local = aligned_alloc(64, sizeof(AuditRing));
+        assert(audit_local != NULL);
+        memset(audit_local, 0, sizeof(AuditRing));
+        audit_local->system = -1;
+
+        pthread_mutex_lock(&audit_lock);
+        audit_local->next = audit_rings;
+        __atomic_store_n(&audit_rings, audit_local, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&audit_lock);
+    }
+    return audit_local;
+}
+
+/**
+ * Local helper that reads the monotonic clock.
+ */
+static uint64_t audit_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Local helper run by the flusher thread, flushes every `PARAM_AUDIT_FLUSH` milliseconds until stopped.
+ *
+ * @param[in] arg Pointer to the `Manager` being run.
+ */
+static void *audit_flush_thread(void *arg) {
+    const Manager *manager = (const Manager *)arg;
+
+    while (!__atomic_load_n(&audit_stopping, __ATOMIC_ACQUIRE)) {
+        usleep(PARAM_AUDIT_FLUSH * 1000);
+        audit_flush(manager, audit_now_ns());
+    }
+
+    // Every thread that transferred has finished, whatever is left can be written
+    audit_flush(manager, UINT64_MAX);
+    return NULL;
+}
+
+/**
+ * Local helper that writes every record stamped before `until_ns`, merged across the rings by time.
+ *
+ * @param[in] manager  Pointer to the `Manager` being run.
+ * @param[in] until_ns Records stamped at or after this are left for the next flush.
+ */
+static void audit_flush(const Manager *manager, uint64_t until_ns) {
+    // Rings are only ever added at the front, the ones behind the first stay put
+    AuditRing *front = __atomic_load_n(&audit_rings, __ATOMIC_ACQUIRE);
+    int n = 0;
+    for (AuditRing *ring = front; ring != NULL; ring = ring->next) {
+        n++;
+    }
+    AuditRing **rings = malloc((n > 0 ? n : 1) * sizeof(AuditRing *));
+    uint64_t *next = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+    uint64_t *end = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+    assert(rings != NULL && next != NULL && end != NULL);
+
+    n = 0;
+    for (AuditRing *ring = front; ring != NULL; ring = ring->next) {
+        rings[n] = ring;
+
+        // An append in progress may hold a stamp from before `until_ns`, wait for it to be published
+        while (__atomic_load_n(&ring->appending, __ATOMIC_SEQ_CST)) {
+            sched_yield();
+        }
+        next[n] = ring->tail;
+        end[n] = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        // A ring is in time order, it is cut at the first record that is too recent
+        uint64_t cut = next[n];
+        while (cut < end[n] && ring->records[cut % AUDIT_RING_RECORDS].time_ns < until_ns) cut++;
+        end[n++] = cut;
+    }
+
+    epoch_enter();
+    for (;;) {
+        int first = -1;
+        for (int r = 0; r < n; r++) {
+            if (next[r] < end[r] && (first < 0 ||
+                rings[r]->records[next[r] % AUDIT_RING_RECORDS].time_ns < rings[first]->records[next[first] % AUDIT_RING_RECORDS].time_ns)) {
+                first = r;
+            }
+        }
+        if (first < 0) break;
+
+        const AuditRecord *record = &rings[first]->records[next[first]++ % AUDIT_RING_RECORDS];
+        const System *system = record->system >= 0 && record->system < system_array_size(&manager->system_array) ?
+            system_array_get(&manager->system_array, record->system) : NULL;
+        const Resource *resource = record->resource >= 0 && record->resource < storage_size(&manager->resources) ?
+            storage_get(&manager->resources, record->resource) : NULL;
+
+        fprintf(audit_file, "%.3f,%s,%s,%d\n", (record->time_ns - audit_start_ns) / 1000.0,
+            system != NULL ? system->info.name : "-", resource != NULL ? resource->info.name : "-", record->delta);
+        audit_written++;
+    }
+    epoch_exit();
+    fflush(audit_file);
+
+    // The records were copied out, the threads may reuse their slots
+    for (int r = 0; r < n; r++) {
+        __atomic_store_n(&rings[r]->tail, next[r], __ATOMIC_RELEASE);
+    }
+    free(rings);
+    free(next);
+    free(end);
+}
@@ -0,0 +1,276 @@
+/***************************************************************
+ * cache.c
+ * Contains the on-disk cache of discrete-event results.
+ * A run is keyed by a 128-bit hash of its canonical scenario: every resource and system in id order,
+ * each recipe, the seed and the parameters the engines depend on. The key maps to the run's outcome
+ * in an open-addressing table in `CACHE_PATH`, mapped into memory and shared by every worker thread
+ * and every process using the same file, so a configuration is only ever run once.
+ *
+ * Slots are claimed with a compare-and-swap and published once filled, readers never lock. A run
+ * that ended before its horizon is stored under the scenario alone and answers any horizon beyond
+ * its end; a run cut off at its horizon is stored under the scenario and the horizon, and only answers that.
+ ***************************************************************/
+
+#include "defs.h"
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC   0x5345524346554353ULL  // "SCUFCRES" on disk marks a cache file
+#define CACHE_VERSION 1                      // Bump when the engines change what a scenario leads to
+
+#define CACHE_EMPTY   0  // Slot never used
+#define CACHE_WRITING 1  // Slot claimed, its entry is being filled
+#define CACHE_READY   2  // Slot holds a complete entry
+
+// Start of the cache file, checked before the file is trusted
+typedef struct CacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t entry_size;    // sizeof(CacheEntry), catches a `DesResult` that changed shape
+    uint64_t slots;
+} CacheHeader;
+
+// A stored outcome
+typedef struct CacheEntry {
+    uint32_t state;         // CACHE_EMPTY, ...
+    uint32_t unused;
+    uint64_t key[2];
+    DesResult result;
+} CacheEntry;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static CacheHeader *cache_header = NULL;  // The mapped file, NULL until opened or if it could not be
+static CacheEntry *cache_entries = NULL;
+static size_t cache_size = 0;
+static int cache_tried = 0;               // Whether opening was attempted, a failure is not retried
+static long cache_hits = 0, cache_misses = 0;
+
+static int  cache_open(void);
+static void cache_key(const Manager *manager, uint64_t seed, long horizon_ms, uint64_t *key);
+static void cache_mix(uint64_t *key, uint64_t value);
+static int  cache_lookup(const uint64_t *key, DesResult *result);
+static void cache_store(const uint64_t *key, const DesResult *result);
+
+/**
+ * Runs the loaded simulation like `des_run_until()`, answering from the result cache when the same
+ * scenario was run before by any thread or process.
+ *
+ * Without `RESULT_CACHE`, or if the cache file cannot be opened, the simulation is simply run.
+ * An answer from the cache took no time: its `wall_s` is 0.
+ *
+ * @param[in]  manager    Pointer to the loaded `Manager`, only read.
+ * @param[in]  engine     `DES_ENGINE_SEQUENTIAL`, `DES_ENGINE_CONSERVATIVE` or `DES_ENGINE_OPTIMISTIC`.
+ * @param[in]  partitions Number of worker threads of the parallel engines, ignored by the sequential one.
+ * @param[in]  horizon_ms Simulated milliseconds after which nothing happens anymore.
+ * @param[in]  seed       Seed of the processing time jitter, 0 to run without any.
+ * @param[out] result     Pointer to the `DesResult` to fill.
+ */
+void cache_run_until(Manager *manager, int engine, int partitions, long horizon_ms, uint64_t seed, DesResult *result) {
+    uint64_t complete[2], truncated[2];
+
+    if (!RESULT_CACHE || !cache_open()) {
+        des_run_until(manager, engine, partitions, horizon_ms, seed, result);
+        return;
+    }
+
+    // Every engine reaches the same outcome, so the engine is not part of the key
+    cache_key(manager, seed, -1, complete);
+    cache_key(manager, seed, horizon_ms, truncated);
+
+    if ((cache_lookup(complete, result) && result->duration_ms < horizon_ms) || cache_lookup(truncated, result)) {
+        result->wall_s = 0;
+        __atomic_fetch_add(&cache_hits, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    des_run_until(manager, engine, partitions, horizon_ms, seed, result);
+    __atomic_fetch_add(&cache_misses, 1, __ATOMIC_RELAXED);
+    cache_store(result->cause == DES_CAUSE_HORIZON ? truncated : complete, result);
+}
+
+/**
+ * Reports how many runs the cache answered and how many it had to run since the program started.
+ *
+ * @param[out] hits   Set to the number of runs answered from the cache.
+ * @param[out] misses Set to the number of runs simulated and stored.
+ */
+void cache_stats(long *hits, long *misses) {
+    *hits = __atomic_load_n(&cache_hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n(&cache_misses, __ATOMIC_RELAXED);
+}
+
+/**
+ * Unmaps the cache file. Only safe once no thread runs through the cache anymore, a later run opens it again.
+ */
+void cache_close(void) {
+    pthread_mutex_lock(&cache_mutex);
+    if (cache_header != NULL) {
+        munmap(cache_header, cache_size);
+    }
+    cache_header = NULL;
+    cache_entries = NULL;
+    cache_tried = 0;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+/**
+ * Local helper that maps the cache file, creating it if needed.
+ *
+ * @return 1 if the cache can be used, 0 otherwise.
+ */
+static int cache_open(void) {
+    pthread_mutex_lock(&cache_mutex);
+    if (cache_tried) {
+        int mapped = cache_header != NULL;
+        pthread_mutex_unlock(&cache_mutex);
+        return mapped;
+    }
+    cache_tried = 1;
+
+    size_t size = sizeof(CacheHeader) + CACHE_SLOTS * sizeof(CacheEntry);
+    int fd = open(CACHE_PATH, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("open result cache");
+        pthread_mutex_unlock(&cache_mutex);
+        return 0;
+    }
+
+    // Another process may be creating the same file, only one of them formats it
+    flock(fd, LOCK_EX);
+    struct stat status;
+    int resize = fstat(fd, &status) != 0 || (size_t)status.st_size != size;
+    if (resize && ftruncate(fd, size) != 0) {
+        perror("ftruncate result cache");
+        flock(fd, LOCK_UN);
+        close(fd);
+        pthread_mutex_unlock(&cache_mutex);
+        return 0;
+    }
+
+    void *address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+        perror("mmap result cache");
+        flock(fd, LOCK_UN);
+        close(fd);
+        pthread_mutex_unlock(&cache_mutex);
+        return 0;
+    }
+    CacheHeader *header = (CacheHeader *)address;
+
+    // A file from another build or another version of the engines is started over
+    if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION ||
+        header->entry_size != sizeof(CacheEntry) || header->slots != CACHE_SLOTS) {
+        memset(address, 0, size);
+        header->version = CACHE_VERSION;
+        header->entry_size = sizeof(CacheEntry);
+        header->slots = CACHE_SLOTS;
+        __atomic_store_n(&header->magic, CACHE_MAGIC, __ATOMIC_RELEASE);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    cache_header = header;
+    cache_entries = (CacheEntry *)(header + 1);
+    cache_size = size;
+    pthread_mutex_unlock(&cache_mutex);
+    return 1;
+}
+
+/**
+ * Local helper that hashes the canonical form of a scenario.
+ *
+ * @param[in]  manager    Pointer to the loaded `Manager`.
+ * @param[in]  seed       Seed of the run.
+ * @param[in]  horizon_ms Horizon of the run, -1 for a run that ends on its own.
+ * @param[out] key        The 128-bit key.
+ */
+static void cache_key(const Manager *manager, uint64_t seed, long horizon_ms, uint64_t *key) {
+    key[0] = 1469598103934665603ULL;  // FNV-1a offset basis
+    key[1] = 0x6A09E667F3BCC908ULL;
+
+    cache_mix(key, seed);
+    cache_mix(key, (uint64_t)horizon_ms);
+    cache_mix(key, PARAM_MANAGER_WAIT);
+    cache_mix(key, PARAM_SYSTEM_WAIT);
+    cache_mix(key, PARAM_DES_JITTER);
+
+    cache_mix(key, manager->resources.size);
+    for (int r = 0; r < manager->resources.size; r++) {
+        const Resource *resource = manager->resources.resources[r];
+        for (const char *c = resource->info.name; *c; c++) cache_mix(key, (unsigned char)*c);
+        cache_mix(key, 0);
+        cache_mix(key, resource->amount);
+        cache_mix(key, resource->max_capacity);
+    }
+
+    cache_mix(key, manager->system_array.size);
+    for (int i = 0; i < manager->system_array.size; i++) {
+        const System *system = manager->system_array.systems[i];
+        const Recipe *recipe = system->recipe;
+        for (const char *c = system->info.name; *c; c++) cache_mix(key, (unsigned char)*c);
+        cache_mix(key, 0);
+        cache_mix(key, recipe->input ? (uint64_t)recipe->input->id : UINT64_MAX);
+        cache_mix(key, recipe->output ? (uint64_t)recipe->output->id : UINT64_MAX);
+        cache_mix(key, recipe->input_amount);
+        cache_mix(key, recipe->output_amount);
+        cache_mix(key, recipe->processing_time);
+        cache_mix(key, recipe->low_threshold);
+        cache_mix(key, recipe->high_threshold);
+        cache_mix(key, system_get_mode(system));
+    }
+}
+
+/**
+ * Local helper that folds a value into both halves of a key, with two unrelated hashes.
+ */
+static void cache_mix(uint64_t *key, uint64_t value) {
+    key[0] = (key[0] ^ value) * 1099511628211ULL;  // FNV-1a
+    key[1] = (key[1] ^ value) * 0x9E3779B97F4A7C15ULL;
+    key[1] ^= key[1] >> 29;
+}
+
+/**
+ * Local helper that looks a key up in the cache.
+ *
+ * @param[in]  key    The key to look up.
+ * @param[out] result Filled with the stored outcome if the key is found.
+ * @return 1 if the key is found, 0 otherwise.
+ */
+static int cache_lookup(const uint64_t *key, DesResult *result) {
+    for (uint64_t probe = 0; probe < CACHE_SLOTS; probe++) {
+        CacheEntry *entry = &cache_entries[(key[0] + probe) % CACHE_SLOTS];
+        uint32_t state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+
+        if (state == CACHE_EMPTY) return 0;
+        if (state == CACHE_READY && entry->key[0] == key[0] && entry->key[1] == key[1]) {
+            *result = entry->result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Local helper that stores an outcome, unless the cache is full. A key stored twice by racing
+ * writers takes two slots, both with the same outcome.
+ *
+ * @param[in] key    The key to store under.
+ * @param[in] result The outcome.
+ */
+static void cache_store(const uint64_t *key, const DesResult *result) {
+    for (uint64_t probe = 0; probe < CACHE_SLOTS; probe++) {
+        CacheEntry *entry = &cache_entries[(key[0] + probe) % CACHE_SLOTS];
+        uint32_t state = CACHE_EMPTY;
+
+        if (__atomic_compare_exchange_n(&entry->state, &state, CACHE_WRITING, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            entry->key[0] = key[0];
+            entry->key[1] = key[1];
+            entry->result = *result;
+            __atomic_store_n(&entry->state, CACHE_READY, __ATOMIC_RELEASE);
+            return;
+        }
+        if (state == CACHE_READY && entry->key[0] == key[0] && entry->key[1] == key[1]) return;
+    }
+}
@@ -0,0 +1,427 @@
+/***************************************************************
+ * columns.c
+ * Contains the columnar results file.
+ * A file starts with its schema, the name and type of every column, followed by blocks of up to
+ * `COLUMN_BLOCK_ROWS` rows that are only ever appended. A block stores each column on its own,
+ * after the smallest and largest value of every column, so a reader can skip a block whose range
+ * cannot match without decoding it, and only decodes the columns it asks for.
+ *
+ * Integer columns are stored as zigzag varints of the difference to the previous value. Double
+ * columns store the XOR with the previous value's bits, without its leading and trailing zero bytes.
+ *
+ * Writer threads buffer their rows in a `ColumnBuffer` of their own and append a whole block with a
+ * single write, so blocks of concurrent writers, and of processes sharing the file, never interleave.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#define COLUMN_MAGIC       "CUFCOL1"   // Starts every results file, with its terminating zero
+#define COLUMN_BLOCK_MAGIC 0x4B434C42  // "BLCK" starts every block
+
+static int  column_read_schema(int fd, ColumnSpec *columns, int *n_columns);
+static int  column_write_all(int fd, const uint8_t *bytes, size_t size);
+static size_t column_encode(const ColumnValue *values, int n_rows, int type, uint8_t *out);
+static int  column_decode(const uint8_t *in, size_t size, int n_rows, int type, ColumnValue *values);
+static size_t column_put_varint(uint8_t *out, uint64_t value);
+static int  column_get_varint(const uint8_t *in, size_t size, size_t *at, uint64_t *value);
+
+/**
+ * Opens a results file for appending, creating it with the given schema if it is new or empty.
+ *
+ * @param[out] file      Pointer to the `ColumnFile` to open.
+ * @param[in]  path      Path of the results file.
+ * @param[in]  columns   The schema, at most `COLUMN_MAX` columns.
+ * @param[in]  n_columns Number of columns.
+ * @return 0 on success, 1 if the file cannot be opened or was written with another schema.
+ */
+int column_open(ColumnFile *file, const char *path, const ColumnSpec *columns, int n_columns) {
+    assert(n_columns > 0 && n_columns <= COLUMN_MAX);
+    memset(file, 0, sizeof(ColumnFile));
+    file->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (file->fd < 0) {
+        perror("open results file");
+        return 1;
+    }
+
+    // Another process may be creating the same file, only one of them writes the schema
+    flock(file->fd, LOCK_EX);
+    if (lseek(file->fd, 0, SEEK_END) == 0) {
+        uint8_t header[sizeof(COLUMN_MAGIC) + 4 + COLUMN_MAX * (COLUMN_NAME_MAX + 1)];
+        size_t size = 0;
+        uint32_t count = n_columns;
+
+        memcpy(header, COLUMN_MAGIC, sizeof(COLUMN_MAGIC));
+        size += sizeof(COLUMN_MAGIC);
+        memcpy(header + size, &count, 4);
+        size += 4;
+        for (int c = 0; c < n_columns; c++) {
+            header[size++] = (uint8_t)columns[c].type;
+            memcpy(header + size, columns[c].name, COLUMN_NAME_MAX);
+            size += COLUMN_NAME_MAX;
+        }
+        if (column_write_all(file->fd, header, size) != 0) {
+            perror("write results file");
+            flock(file->fd, LOCK_UN);
+            close(file->fd);
+            return 1;
+        }
+    } else {
+        ColumnSpec existing[COLUMN_MAX];
+        int n_existing;
+        lseek(file->fd, 0, SEEK_SET);
+        int same = column_read_schema(file->fd, existing, &n_existing) == 0 && n_existing == n_columns;
+        for (int c = 0; same && c < n_columns; c++) {
+            same = existing[c].type == columns[c].type && strncmp(existing[c].name, columns[c].name, COLUMN_NAME_MAX) == 0;
+        }
+        if (!same) {
+            printf("%s is not a results file with the same columns, not writing to it\n", path);
+            flock(file->fd, LOCK_UN);
+            close(file->fd);
+            return 1;
+        }
+    }
+    flock(file->fd, LOCK_UN);
+
+    file->n_columns = n_columns;
+    memcpy(file->columns, columns, n_columns * sizeof(ColumnSpec));
+    pthread_mutex_init(&file->mutex, NULL);
+    return 0;
+}
+
+/**
+ * Closes a results file, every buffer writing to it must have been flushed.
+ *
+ * @param[in,out] file Pointer to the open `ColumnFile`.
+ */
+void column_close(ColumnFile *file) {
+    close(file->fd);
+    pthread_mutex_destroy(&file->mutex);
+}
+
+/**
+ * Initializes a writer thread's buffer of rows.
+ *
+ * @param[out] buffer Pointer to the `ColumnBuffer` to initialize.
+ * @param[in]  file   Pointer to the open `ColumnFile` the rows go to.
+ */
+void column_buffer_init(ColumnBuffer *buffer, ColumnFile *file) {
+    memset(buffer, 0, sizeof(ColumnBuffer));
+    buffer->file = file;
+    for (int c = 0; c < file->n_columns; c++) {
+        buffer->values[c] = malloc(COLUMN_BLOCK_ROWS * sizeof(ColumnValue));
+        assert(buffer->values[c] != NULL);
+    }
+}
+
+/**
+ * Adds a row, writing a block once the buffer is full.
+ *
+ * @param[in,out] buffer Pointer to the `ColumnBuffer`.
+ * @param[in]     row    One value per column, in the order of the schema.
+ */
+void column_append(ColumnBuffer *buffer, const ColumnValue *row) {
+    for (int c = 0; c < buffer->file->n_columns; c++) {
+        buffer->values[c][buffer->n_rows] = row[c];
+    }
+    if (++buffer->n_rows == COLUMN_BLOCK_ROWS) {
+        column_flush(buffer);
+    }
+}
+
+/**
+ * Writes the buffered rows as a block, if there are any.
+ *
+ * @param[in,out] buffer Pointer to the `ColumnBuffer`.
+ */
+void column_flush(ColumnBuffer *buffer) {
+    ColumnFile *file = buffer->file;
+    int n_columns = file->n_columns;
+    if (buffer->n_rows == 0) return;
+
+    // A varint or a trimmed double never takes more than 10 bytes
+    size_t header = 2 * sizeof(uint32_t) + n_columns * sizeof(ColumnStats);
+    uint8_t *block = malloc(header + (size_t)n_columns * buffer->n_rows * 10);
+    ColumnStats *stats = (ColumnStats *)(block + 2 * sizeof(uint32_t));
+    uint32_t words[2] = {COLUMN_BLOCK_MAGIC, (uint32_t)buffer->n_rows};
+    size_t size = header;
+    assert(block != NULL);
+
+    memcpy(block, words, sizeof(words));
+    for (int c = 0; c < n_columns; c++) {
+        const ColumnValue *values = buffer->values[c];
+        ColumnStats column = {values[0], values[0], 0, 0};
+
+        for (int i = 1; i < buffer->n_rows; i++) {
+            if (file->columns[c].type == COLUMN_INT) {
+                if (values[i].i < column.min.i) column.min = values[i];
+                if (values[i].i > column.max.i) column.max = values[i];
+            } else {
+                if (values[i].d < column.min.d) column.min = values[i];
+                if (values[i].d > column.max.d) column.max = values[i];
+            }
+        }
+        column.size = (uint32_t)column_encode(values, buffer->n_rows, file->columns[c].type, block + size);
+        size += column.size;
+        memcpy(&stats[c], &column, sizeof(ColumnStats));
+    }
+
+    // O_APPEND and one write per block keep blocks whole, the mutex orders the writers of this process
+    pthread_mutex_lock(&file->mutex);
+    if (column_write_all(file->fd, block, size) != 0) {
+        perror("write results file");
+    }
+    file->blocks++;
+    pthread_mutex_unlock(&file->mutex);
+
+    free(block);
+    buffer->n_rows = 0;
+}
+
+/**
+ * Flushes the buffered rows and frees the buffer.
+ *
+ * @param[in,out] buffer Pointer to the `ColumnBuffer`.
+ */
+void column_buffer_free(ColumnBuffer *buffer) {
+    column_flush(buffer);
+    for (int c = 0; c < buffer->file->n_columns; c++) {
+        free(buffer->values[c]);
+    }
+}
+
+/**
+ * Opens a results file for reading and reads its schema.
+ *
+ * @param[out] reader Pointer to the `ColumnReader` to open.
+ * @param[in]  path   Path of the results file.
+ * @return 0 on success, 1 if the file cannot be opened or is not a results file.
+ */
+int column_reader_open(ColumnReader *reader, const char *path) {
+    memset(reader, 0, sizeof(ColumnReader));
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0) {
+        perror("open results file");
+        return 1;
+    }
+    if (column_read_schema(reader->fd, reader->columns, &reader->n_columns) != 0) {
+        printf("%s is not a results file\n", path);
+        close(reader->fd);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Reads the header of the next block: its row count and the statistics of every column.
+ *
+ * @param[in,out] reader Pointer to the open `ColumnReader`.
+ * @param[out]    n_rows Set to the number of rows of the block.
+ * @param[out]    stats  Set to the statistics of each column, `COLUMN_MAX` entries.
+ * @return 1 if a block follows, 0 at the end of the file or of its last complete block.
+ */
+int column_next_block(ColumnReader *reader, int *n_rows, ColumnStats *stats) {
+    uint32_t words[2];
+    size_t size = reader->n_columns * sizeof(ColumnStats);
+
+    if (read(reader->fd, words, sizeof(words)) != sizeof(words) || words[0] != COLUMN_BLOCK_MAGIC) return 0;
+    if (read(reader->fd, stats, size) != (ssize_t)size) return 0;
+    *n_rows = (int)words[1];
+    return *n_rows > 0 && *n_rows <= COLUMN_BLOCK_ROWS;
+}
+
+/**
+ * Decodes the wanted columns of the block whose header was just read and skips the rest of it.
+ *
+ * @param[in,out] reader Pointer to the open `ColumnReader`.
+ * @param[in]     n_rows Number of rows of the block.
+ * @param[in]     stats  Statistics of the block from `column_next_block()`.
+ * @param[in]     wanted Whether each column is to be decoded, NULL to skip the whole block.
+ * @param[out]    values Arrays of at least `n_rows` values, filled for every wanted column.
+ * @return 0 on success, 1 if the block is cut short or corrupt.
+ */
+int column_read_block(ColumnReader *reader, int n_rows, const ColumnStats *stats, const int *wanted, ColumnValue **values) {
+    uint8_t *encoded = NULL;
+    size_t capacity = 0;
+
+    for (int c = 0; c < reader->n_columns; c++) {
+        if (wanted == NULL || !wanted[c]) {
+            if (lseek(reader->fd, stats[c].size, SEEK_CUR) < 0) return 1;
+            continue;
+        }
+        if (stats[c].size > capacity) {
+            free(encoded);
+            capacity = stats[c].size;
+            encoded = malloc(capacity);
+            assert(encoded != NULL);
+        }
+        if (read(reader->fd, encoded, stats[c].size) != (ssize_t)stats[c].size ||
+            column_decode(encoded, stats[c].size, n_rows, reader->columns[c].type, values[c]) != 0) {
+            free(encoded);
+            return 1;
+        }
+    }
+    free(encoded);
+    return 0;
+}
+
+/**
+ * Closes a results file opened for reading.
+ *
+ * @param[in,out] reader Pointer to the open `ColumnReader`.
+ */
+void column_reader_close(ColumnReader *reader) {
+    close(reader->fd);
+}
+
+/**
+ * Local helper that reads the schema at the start of a results file.
+ *
+ * @param[in]  fd        The file, positioned at its start.
+ * @param[out] columns   Set to the schema, `COLUMN_MAX` entries.
+ * @param[out] n_columns Set to the number of columns.
+ * @return 0 on success, 1 if the file is not a results file.
+ */
+static int column_read_schema(int fd, ColumnSpec *columns, int *n_columns) {
+    char magic[sizeof(COLUMN_MAGIC)];
+    uint32_t count;
+
+    if (read(fd, magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, COLUMN_MAGIC, sizeof(magic)) != 0) return 1;
+    if (read(fd, &count, 4) != 4 || count == 0 || count > COLUMN_MAX) return 1;
+
+    memset(columns, 0, COLUMN_MAX * sizeof(ColumnSpec));
+    for (uint32_t c = 0; c < count; c++) {
+        uint8_t type;
+        if (read(fd, &type, 1) != 1 || (type != COLUMN_INT && type != COLUMN_DOUBLE)) return 1;
+        if (read(fd, columns[c].name, COLUMN_NAME_MAX) != COLUMN_NAME_MAX) return 1;
+        columns[c].name[COLUMN_NAME_MAX - 1] = '\0';
+        columns[c].type = type;
+    }
+    *n_columns = (int)count;
+    return 0;
+}
+
+/**
+ * Local helper that writes a whole buffer, however many writes it takes.
+ *
+ * @return 0 on success, 1 on error.
+ */
+static int column_write_all(int fd, const uint8_t *bytes, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) return 1;
+        bytes += written;
+        size -= written;
+    }
+    return 0;
+}
+
+/**
+ * Local helper that encodes the values of one column of a block.
+ *
+ * @param[in]  values Values of the column.
+ * @param[in]  n_rows Number of values.
+ * @param[in]  type   COLUMN_INT or COLUMN_DOUBLE.
+ * @param[out] out    Receives the encoded bytes, at least 10 per value.
+ * @return The number of bytes written.
+ */
+static size_t column_encode(const ColumnValue *values, int n_rows, int type, uint8_t *out) {
+    size_t size = 0;
+    uint64_t previous = 0;
+
+    for (int i = 0; i < n_rows; i++) {
+        if (type == COLUMN_INT) {
+            uint64_t delta = (uint64_t)values[i].i - previous;
+            size += column_put_varint(out + size, (delta << 1) ^ (uint64_t)((int64_t)delta >> 63));  // Zigzag
+            previous = (uint64_t)values[i].i;
+        } else {
+            uint64_t bits;
+            memcpy(&bits, &values[i].d, sizeof(bits));
+            uint64_t changed = bits ^ previous;
+            previous = bits;
+
+            // One byte with the zero bytes dropped at the low end and the number of bytes kept, then those bytes
+            if (changed == 0) {
+                out[size++] = 0;
+                continue;
+            }
+            int leading = __builtin_clzll(changed) / 8;
+            int trailing = __builtin_ctzll(changed) / 8;
+            out[size++] = (uint8_t)(trailing << 4 | (8 - leading - trailing));
+            for (int b = trailing; b < 8 - leading; b++) {
+                out[size++] = (uint8_t)(changed >> (8 * b));
+            }
+        }
+    }
+    return size;
+}
+
+/**
+ * Local helper that decodes the values of one column of a block.
+ *
+ * @param[in]  in     The encoded bytes.
+ * @param[in]  size   Number of encoded bytes.
+ * @param[in]  n_rows Number of values.
+ * @param[in]  type   COLUMN_INT or COLUMN_DOUBLE.
+ * @param[out] values Receives the values.
+ * @return 0 on success, 1 if the bytes run out or are corrupt.
+ */
+static int column_decode(const uint8_t *in, size_t size, int n_rows, int type, ColumnValue *values) {
+    size_t at = 0;
+    uint64_t previous = 0;
+
+    for (int i = 0; i < n_rows; i++) {
+        if (type == COLUMN_INT) {
+            uint64_t zigzag;
+            if (column_get_varint(in, size, &at, &zigzag) != 0) return 1;
+            previous += (zigzag >> 1) ^ (0 - (zigzag & 1));
+            values[i].i = (int64_t)previous;
+        } else {
+            if (at >= size) return 1;
+            int trailing = in[at] >> 4, kept = in[at] & 0xF;
+            uint64_t changed = 0;
+            at++;
+
+            if (trailing + kept > 8 || at + kept > size) return 1;
+            for (int b = trailing; b < trailing + kept; b++) {
+                changed |= (uint64_t)in[at++] << (8 * b);
+            }
+            previous ^= changed;
+            memcpy(&values[i].d, &previous, sizeof(previous));
+        }
+    }
+    return at == size ? 0 : 1;
+}
+
+/**
+ * Local helper that writes a value as a varint, 7 bits per byte with the high bit marking more to come.
+ *
+ * @return The number of bytes written.
+ */
+static size_t column_put_varint(uint8_t *out, uint64_t value) {
+    size_t size = 0;
+    while (value >= 0x80) {
+        out[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[size++] = (uint8_t)value;
+    return size;
+}
+
+/**
+ * Local helper that reads a varint.
+ *
+ * @return 0 on success, 1 if the bytes run out or the varint is too long.
+ */
+static int column_get_varint(const uint8_t *in, size_t size, size_t *at, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*at >= size) return 1;
+        uint8_t byte = in[(*at)++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return 0;
+    }
+    return 1;
+}
@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <stdint.h>
 // Multi-threading headers
 #include <pthread.h>
 #include <semaphore.h>
@@ -26,38 +27,234 @@
 #define EVENT_HIGH         (PRIORITY_MED  | 0x0004)
 #define EVENT_PRODUCED     (PRIORITY_IGN  | 0x0010)
 
+#define THRESHOLD_OK           0 // Input level between the low and high thresholds
+#define THRESHOLD_LOW          1 // Input level at or below the low threshold
+#define THRESHOLD_INSUFFICIENT 3 // Input level below one recipe's input amount, always also low
+#define THRESHOLD_HIGH         4 // Input level above the high threshold
+
+#define QUIESCENCE_NONE    0 // Systems are still making progress
+#define QUIESCENCE_STARVED 1 // Every running system waits on input that nobody can produce
+#define QUIESCENCE_STALLED 2 // No resource changed for PARAM_QUIESCENCE_TIMEOUT simulated milliseconds
+
+#define RECORD_PUSH          1 // Event pushed onto the event queue
+#define RECORD_POP           2 // Event popped from the event queue
+#define RECORD_TRANSFER_FROM 3 // Amount taken out of a resource
+#define RECORD_TRANSFER_INTO 4 // Amount put into a resource
+#define RECORD_SET_MODE      5 // Mode of a system changed
+
+#define DES_ENGINE_SEQUENTIAL   0 // One heap of steps in time order, the reference engine
+#define DES_ENGINE_CONSERVATIVE 1 // Partitions advance together in windows bounded by the lookahead
+#define DES_ENGINE_OPTIMISTIC   2 // Partitions run ahead and roll back (Time Warp)
+
+#define DES_CAUSE_OXYGEN      1 // Discrete-event run ended because the oxygen ran out
+#define DES_CAUSE_DESTINATION 2 // Discrete-event run ended at the destination
+#define DES_CAUSE_HORIZON     3 // Discrete-event run reached PARAM_DES_HORIZON
+#define DES_CAUSE_IDLE        4 // Discrete-event run had no steps left
+
 #define PARAM_MANAGER_WAIT    10   // Milliseconds for the manager to wait between popping the queue
 #define PARAM_SYSTEM_WAIT    500   // Milliseconds between loops of the system to prevent spamming with events
 #define PARAM_RESOURCE_LOW   2     // Multiplier for whether a recipe has low resources (e.g., 2 * input amount)
 #define PARAM_RESOURCE_HIGH  5     // Multiplier for whether a recipe has enough resources (e.g., 5 * input amount)
+#define PARAM_QUIESCENCE_TIMEOUT 30000 // Simulated milliseconds without any state change before the simulation is stalled
 #define PARAM_SPEED_MODIFIER 1    // Usleep times are divided by this to speed up the simulation, faster for single-threaded mode recommended
 
+#define FLUID_MODE           0       // Set this to one to run the continuous fluid-approximation engine instead of threads
+#define FLUID_FLEET_SIZE     1       // Number of copies of the vehicle simulated by the fluid engine
+#define PARAM_FLUID_STEP     50      // Simulated milliseconds per fluid solver step
+#define PARAM_FLUID_HORIZON  3600000 // Maximum simulated milliseconds for the fluid engine
+
+#define AFFINITY_MODE        0       // Set this to one to pin the manager and clusters of systems sharing resources to CPUs
+
+#define SHM_PROCESS_MODE     0       // Set this to one to run the manager and the systems in separate processes sharing memory
+#define SHM_WORKER_PROCESSES 2       // Number of worker processes running the systems in shared-memory mode
+#define SHM_SEGMENT_NAME     "/cuinspace_sim"  // Name of the POSIX shared-memory segment
+#define SHM_SEGMENT_SIZE     (16 * 1024 * 1024) // Size of the shared-memory segment in bytes
+
+#define REMOTE_MODE          0       // Set this to one to run the systems in worker processes connected to the manager by sockets
+#define REMOTE_WORKERS       2       // Number of loopback worker processes standing in for remote nodes
+#define REMOTE_USE_TCP       0       // Set this to one to use TCP on localhost instead of a Unix socket
+#define REMOTE_SOCKET_PATH   "/tmp/cuinspace_sim.sock" // Path of the manager's Unix socket
+#define REMOTE_TCP_PORT      47800   // Port of the manager's TCP socket
+#define REMOTE_PIPELINE_DEPTH 4      // Batches a worker may have sent without a reply yet
+
+#define FORECAST_LEVELS      0       // Set this to one to forecast when each resource runs out or fills up
+#define FORECAST_WINDOW      16      // Most recent transfers each forecast is fitted to
+#define PARAM_FORECAST_SPAN  10000   // Simulated milliseconds of history a forecast looks back at most
+#define PARAM_FORECAST_WARNING 5000  // The manager warns when a resource is forecast to run out within this many simulated milliseconds
+
+#define SKETCH_LEVELS        0       // Set this to one to sketch the distribution of every resource's level and report its quantiles
+#define SKETCH_PATH          "levels.sketch" // Level sketches merged across runs
+#define SKETCH_ACCURACY      0.01    // Relative error of the reported quantiles
+#define SKETCH_BUCKETS       1100    // Buckets per sketch, enough to cover every int level at SKETCH_ACCURACY
+
+#define RECORD_LOG           0       // Set this to one to record every operation of the threaded simulation to RECORD_LOG_PATH
+#define REPLAY_LOG           0       // Set this to one to replay RECORD_LOG_PATH single-threaded instead of running the simulation
+#define REPLAY_MANAGER_ONLY   0       // Set this to one with REPLAY_LOG to feed only the logged events to the manager, as a benchmark
+#define RECORD_LOG_PATH      "simulation.evlog" // Event log written by RECORD_LOG and read by REPLAY_LOG
+
+#define DES_MODE             0       // Set this to one to run the discrete-event engines in virtual time instead of threads
+#define DES_FLEET_SIZE       1       // Number of copies of the vehicle simulated by the discrete-event engines
+#define DES_PARTITIONS       2       // Worker threads of the parallel discrete-event engines
+#define PARAM_DES_OPTIMISM   2000    // Simulated milliseconds the optimistic engine may run ahead of the global virtual time
+#define PARAM_DES_HORIZON    3600000 // Maximum simulated milliseconds for the discrete-event engines
+#define PARAM_DES_JITTER     10      // Percent a seeded discrete-event run jitters each processing time by at most
+
+#define RECONFIG_MODE        0       // Set this to one to attach a reserve oxygen system and its tank mid-flight and detach them later
+#define PARAM_RECONFIG_ATTACH 8000   // Simulated milliseconds into the flight the reserve is attached
+#define PARAM_RECONFIG_DETACH 20000  // Simulated milliseconds into the flight the reserve is detached
+
+#define HOT_RELOAD           0       // Set this to one to reload SCENARIO_PATH into the running simulation on SIGHUP
+#define SCENARIO_PATH        "scenario.txt" // Resources, systems and thresholds applied by a reload
+
+#define OPTIMIZE_MODE        0       // Set this to one to search recipe amounts and capacities for the furthest, fastest flight
+#define OPTIMIZE_POPULATION  32      // Candidates per generation of the optimizer
+#define OPTIMIZE_GENERATIONS 25      // Generations the optimizer breeds
+#define OPTIMIZE_SEED        1       // Seed of the optimizer's random numbers, the same seed finds the same configuration
+
+#define SENSITIVITY_MODE     0       // Set this to one to rank every recipe field and starting amount by how much it changes the flight's outcome
+#define SENSITIVITY_ENSEMBLE 16      // Jittered runs each finite difference is averaged over
+#define SENSITIVITY_STEP     10      // Percent each parameter is nudged down and up by
+#define SENSITIVITY_SEED     1       // Seed of the ensemble's jitter, the same seed gives the same table
+
+#define RESULT_CACHE         0       // Set this to one to answer repeated optimizer and sensitivity runs from CACHE_PATH
+#define CACHE_PATH           "results.cache" // Discrete-event results keyed by scenario, shared by concurrent runs
+#define CACHE_SLOTS          65536   // Results the cache file holds, it is started over when this changes
+
+#define RESULTS_STORE        0       // Set this to one to append every sensitivity run to RESULTS_PATH, read it with ./query
+#define RESULTS_PATH         "sensitivity.col" // Columnar file of sensitivity runs, appended to by every analysis
+#define COLUMN_INT           0       // Column of 64-bit integers
+#define COLUMN_DOUBLE        1       // Column of doubles
+#define COLUMN_MAX           32      // Columns a results file may have
+#define COLUMN_NAME_MAX      32      // Bytes of a column name, with its terminating zero
+#define COLUMN_BLOCK_ROWS    4096    // Rows a writer buffers before appending them as a block
+
+#define RESOURCE_GROUPS      0       // Set this to one to hold the fuel in three tanks that the systems draw from as one
+#define GROUP_FULLEST        0       // A group draws from its fullest tank and fills its emptiest
+#define GROUP_NEAREST        1       // A group draws from and fills its nearest tank first, the first one added
+#define PARAM_GROUP_POLICY   GROUP_FULLEST // Policy of the fuel tanks
+#define GROUP_MAX_MEMBERS    256     // Tanks a group may have
+
+#define AUDIT_LOG            0       // Set this to one to log every transfer of the threaded simulation, with its time and system, to AUDIT_PATH
+#define AUDIT_PATH           "transfers.audit" // Time-ordered CSV of transfers, rewritten by every audited run
+#define AUDIT_RING_RECORDS   4096    // Transfers a thread can append before it has to wait for the flusher
+#define PARAM_AUDIT_FLUSH    100     // Milliseconds between two flushes of the threads' transfers
+
+#define INVARIANT_CHECK      1       // Set this to zero to stop checking that every resource holds exactly what was moved into and out of it
+#define PARAM_INVARIANT_PERIOD 1000  // Simulated milliseconds between two checks of every resource
+#define INVARIANT_MAX_RESOURCES 256  // Resources whose transfers are counted, resources with higher ids are not checked
+#define INVARIANT_PRODUCED   0       // Amount moved into storage
+#define INVARIANT_CONSUMED   1       // Amount moved out of storage
+#define INVARIANT_DISCARDED  2       // Amount thrown away when a capacity was lowered
+
+#define EVENT_AGING          1       // Set this to zero to pop events strictly by priority, a stream of high priority events can then starve the rest
+#define PARAM_AGING_HIGH     0       // Later events that may still be popped before a PRIORITY_HIGH event
+#define PARAM_AGING_MED      8       // Later events that may still be popped before a PRIORITY_MED event
+#define PARAM_AGING_LOW      16      // Later events that may still be popped before a PRIORITY_LOW event
+#define PARAM_AGING_IGN      32      // Later events that may still be popped before a PRIORITY_IGN event
+#define EVENT_CLASSES        4       // Priority classes with latency metrics: high, medium, low and ignored
+
+#define EVENT_RING           0       // Set this to one to also publish every event of the threaded simulation to a ring the display and TELEMETRY_PATH read at their own pace
+#define RING_SIZE            1024    // Events the ring holds, a power of two
+#define RING_MAX_CONSUMERS   8       // Consumers that may read the ring at once
+#define RING_LAG             0       // Producers wait for the consumer when it falls a whole ring behind, it sees every event
+#define RING_SKIP            1       // Producers never wait for the consumer, it skips the events overwritten before it got to them
+#define PARAM_RING_DISPLAY   RING_SKIP // Policy of the event log on the display
+#define PARAM_RING_TELEMETRY RING_LAG  // Policy of the telemetry recorder
+#define TELEMETRY_PATH       "events.telemetry" // CSV of every event published, rewritten by every run with EVENT_RING
+#define PARAM_TELEMETRY_WAIT 10      // Milliseconds the telemetry recorder sleeps once it has caught up
+
+#define CACHE_LINE_SIZE      64      // Bytes of a cache line, the fields of resources and systems used on every cycle fill one
+
 #define SINGLE_THREAD_MODE 0       // Set this to zero to run the simulation in multi-threaded mode
 #define TUI_MODE                   // Text UI Mode, comment this line out if you want it to print without fancy formatting.
 
+// Streaming quantile sketch, a histogram with logarithmically sized buckets, updated with atomic increments
+typedef struct QuantileSketch {
+    uint64_t zero;                      // Samples of zero
+    uint64_t count;                     // All samples
+    uint64_t buckets[SKETCH_BUCKETS];   // Samples in (gamma^(i-1), gamma^i], gamma from SKETCH_ACCURACY
+} QuantileSketch;
+
+// Sliding-window least-squares fit of a resource's amount over time, for time-to-empty and time-to-full
+typedef struct Forecast {
+    long times[FORECAST_WINDOW];    // Simulated milliseconds of each sample, a ring buffer
+    int levels[FORECAST_WINDOW];    // Amount of the resource at each sample
+    int head;                       // Slot of the oldest sample
+    int size;                       // Number of samples in the window
+    int updates;                    // Samples added since the sums were last recomputed
+    long base_ms;                   // Time subtracted from every sample time, keeps the sums small
+    double sum_t, sum_y, sum_tt, sum_ty;  // Regression sums over the window, times in seconds
+    int warned;                     // Whether the manager already warned about this resource running out
+} Forecast;
+
+struct ResourceGroup;
+
+// Part of a resource that transfers never touch, kept off the cache line they do
+typedef struct ResourceInfo {
+    char *name;         // Dynamically allocated string
+    Forecast *forecast; // Forecast of when the resource runs out or fills up, NULL unless FORECAST_LEVELS is set
+    QuantileSketch *sketch; // Distribution of the amount after every transfer, NULL unless SKETCH_LEVELS is set
+    int member;         // Index of the tank in `member_of`
+    int initial_amount; // Amount the resource was created with, what the invariant check starts from
+} ResourceInfo;
+
 // Represents the resource amounts for the entire rocket
+// Everything a transfer reads or writes fills the first cache line, the rest is in `info` on the next one
 typedef struct Resource {
-    char *name;         // Dynamically allocated string
+    sem_t mutex;        // Binary semaphore to protect the resource from race conditions
     int amount;         // Current amount of the resource in storage
     int max_capacity;   // Maximum capacity of the resource
-    sem_t mutex;        // Binary semaphore to protect the resource from race conditions
+    int id;             // Index of the resource in the manager's storage, -1 until added
+    int last_system;    // Id of the last system that moved the resource, -1 for none
+    struct ResourceGroup *group;     // Set if this is the total of a group, transfers go to its tanks
+    struct ResourceGroup *member_of; // Group this is a tank of, NULL for none
+    ResourceInfo info __attribute__((aligned(CACHE_LINE_SIZE)));  // Names and bookkeeping for the display and reports
 } Resource;
 
-// Represents the amount of a resource consumed/produced for a single system
+// Tanks of one resource used as one through their total, see group.c
+typedef struct ResourceGroup {
+    Resource *total;    // Amount and capacity are the sums of the members', updated with every transfer
+    Resource *members[GROUP_MAX_MEMBERS];  // In order of nearness
+    int n_members;
+    int policy;         // GROUP_FULLEST or GROUP_NEAREST
+    int amounts[GROUP_MAX_MEMBERS];        // The group's view of each member, updated under `mutex`
+    int rooms[GROUP_MAX_MEMBERS];          // Capacity left in each member
+    int draw_heap[GROUP_MAX_MEMBERS], draw_position[GROUP_MAX_MEMBERS];  // Max-heap of members by amount
+    int fill_heap[GROUP_MAX_MEMBERS], fill_position[GROUP_MAX_MEMBERS];  // Max-heap of members by room
+    uint64_t nonempty[(GROUP_MAX_MEMBERS + 63) / 64];  // Bit of each member with anything in it
+    uint64_t nonfull[(GROUP_MAX_MEMBERS + 63) / 64];   // Bit of each member with room left
+    sem_t mutex;        // Taken after a member's mutex, never before
+} ResourceGroup;
+
+// Represents the amount of a resource consumed/produced for a single system, a system's recipe is never changed but replaced
 typedef struct Recipe {
     Resource *input;    // Resource that is consumed, from central storage
     Resource *output;   // Resource that is produced, from central storage
     int input_amount;   // Amount of the input resource consumed
     int output_amount;  // Amount of the output resource produced
     int processing_time; // Processing time in milliseconds
+    int low_threshold;  // Input level at or below which the system reports EVENT_LOW
+    int high_threshold; // Input level above which the system reports EVENT_HIGH
 } Recipe;
 
+// Part of a system that its cycles never touch, kept off the cache line they do
+typedef struct SystemInfo {
+    char *name;         // Dynamically allocated string
+    sem_t wake;         // Posted when the system leaves MODE_DISABLED, a disabled system's thread waits on it
+    sem_t mode_lock;    // Taken to change `mode`, so a change and its sequence number in the event log are one step
+    pthread_t thread;   // Thread running the system in multi-threaded mode
+    struct Resource *cycle_input;   // Input of the recipe the running cycle copied, NULL between cycles
+    struct Resource *cycle_output;  // Output of that recipe, a resource is only detached once no cycle uses it
+} SystemInfo;
+
 // A system which consumes resources, waits for `processing_time` milliseconds, then produced the produced resource
+// Everything a cycle or the manager's loop reads fills the first cache line, the rest is in `info` on the next one
 typedef struct System {
-    char *name;         // Dynamically allocated string
+    const Recipe *recipe; // Stores information about what resources are produced / consumed, swapped by system_set_recipe()
     struct EventQueue *global_queue;  // Pointer to event queue shared by all systems and manager
-    Recipe recipe;      // Stores information about what resources are produced / consumed
     int mode;           // Current mode of the system (e.g., STANDARD, SLOW, FAST, DISABLED, MODE_TERMINATE)
+    int id;             // Index of the system in the manager's system array, -1 until added
+    SystemInfo info __attribute__((aligned(CACHE_LINE_SIZE)));  // Name and thread for the display, logs and reconfiguration
 } System;
 
 // Used to send notifications to the manager about an issue / state of the system
@@ -71,16 +268,54 @@ typedef struct Event {
 // Linked List Node for the Event queue
 typedef struct EventNode {
     Event event;
+    uint64_t deadline;      // Push count the event is due by, its class's PARAM_AGING_* pushes after its own
+    uint64_t pushed;        // Push count when it was pushed, tells the events pushed after it apart
+    long passed;            // Events pushed after it that were popped before it
+    long pushed_ms;         // Simulated time it was pushed
     struct EventNode *next;
 } EventNode;
 
+// How long the events of one priority class waited in the queue
+typedef struct EventLatency {
+    long popped;        // Events of the class popped so far
+    long total_ms;      // Simulated milliseconds they waited altogether
+    long max_ms;        // Longest wait
+    long max_passed;    // Most later events popped ahead of one of the class
+} EventLatency;
+
 // Linked List structure, single instance shared by all systems
 typedef struct EventQueue {
     EventNode *head;
     sem_t mutex;        // Binary semaphore to protect the event queue from race conditions
+    uint64_t pushes;    // Events ever pushed, the clock deadlines are counted in
+    EventLatency latency[EVENT_CLASSES];  // Waits of each class: high, medium, low, ignored
+    struct EventRing *ring;  // Ring every pushed event is also published to, NULL for none
 } EventQueue;
 
+// Slot of the event ring, `published` works as a sequence lock for readers that may be lapped
+typedef struct RingSlot {
+    uint64_t published; // Sequence of the event plus one once it is written, 0 while it is being written
+    Event event;
+} RingSlot;
+
+// Reader of the event ring, on a cache line of its own so consumers never share one
+typedef struct RingConsumer {
+    uint64_t cursor __attribute__((aligned(CACHE_LINE_SIZE)));  // Sequence of the next event to read
+    int policy;         // RING_LAG or RING_SKIP, -1 while the consumer is unused
+    uint64_t skipped;   // Events the consumer never read because they were overwritten
+} RingConsumer;
+
+// Multi-producer, multi-consumer broadcast ring: every event is written once and read in place by every consumer
+typedef struct EventRing {
+    uint64_t claimed __attribute__((aligned(CACHE_LINE_SIZE)));  // Sequences handed out to producers
+    uint64_t gate;      // Lowest cursor of the RING_LAG consumers the producers last saw
+    uint64_t stalls;    // Publishes that waited for a RING_LAG consumer
+    RingConsumer consumers[RING_MAX_CONSUMERS];
+    RingSlot slots[RING_SIZE];
+} EventRing;
+
 // A basic dynamic array to store all of the systems in the simulation
+// Systems can be attached and detached while it is read, detached systems leave a NULL slot so ids stay stable
 typedef struct SystemArray {
     System **systems;
     int size;
@@ -94,26 +329,228 @@ typedef struct SharedResourceArray {
     int capacity;
 } SharedResourceArray;
 
+// Batch of recipe thresholds classified together with SIMD compares, all arrays are vector aligned
+typedef struct ThresholdBatch {
+    int size;           // Number of systems in the batch
+    int padded;         // `size` rounded up to a whole number of vectors
+    int words;          // Number of 64-bit words in `changed`
+    float *amount;      // Input resource amounts, gathered by the caller before classifying
+    float *need;        // Input amount of one cycle, below this the system is starved
+    float *low;         // Low threshold, input amount * PARAM_RESOURCE_LOW
+    float *high;        // High threshold, input amount * PARAM_RESOURCE_HIGH
+    int *status;        // Classification from the last call (THRESHOLD_OK, THRESHOLD_LOW, ...)
+    uint64_t *changed;  // Bitmask of systems whose classification changed in the last call
+} ThresholdBatch;
+
+// Tracks starvation and progress so the manager can end a simulation that can no longer change
+typedef struct Quiescence {
+    Resource **starved_on;  // Per system id: resource of its last EVENT_INSUFFICIENT, NULL if it progressed since
+    int n_systems;
+    int *amounts;           // Per resource id: amount seen by the last check
+    int n_resources;
+    long last_change_ms;    // Simulated time of the last observed change in storage
+    long last_check_ms;     // Simulated time of the last check
+    long starved_since_ms;  // Simulated time since all running systems have been starved, -1 if they are not
+    long grace_ms;          // How long global starvation must last, the longest possible system cycle
+} Quiescence;
+
+// Outcome of a discrete-event run, identical for every engine
+typedef struct DesResult {
+    long duration_ms;   // Simulated time until the simulation ended
+    int cause;          // Why it ended (DES_CAUSE_OXYGEN, ...)
+    int distance;       // Total amount of all resources named "Distance" at the end
+    long steps;         // System steps executed
+    long rolled_back;   // Steps undone by the optimistic engine, not part of the outcome
+    long events;        // Events handled by the manager
+    uint64_t checksum;  // Hash of every final resource amount and system mode history
+    int partitions;     // Partitions the run used
+    long lookahead_ms;  // Window length of the conservative engine, 0 for the others
+    double wall_s;      // Wall clock seconds the run took
+} DesResult;
+
+// Numbered jobs shared by the threads of a worker pool, each taken once
+typedef struct WorkPool {
+    int size;           // Number of jobs
+    int next;           // Next job to take, taken atomically
+} WorkPool;
+
+// A column of a results file
+typedef struct ColumnSpec {
+    char name[COLUMN_NAME_MAX];
+    int type;           // COLUMN_INT or COLUMN_DOUBLE
+} ColumnSpec;
+
+// One value of a row, read as its column's type
+typedef union ColumnValue {
+    int64_t i;
+    double d;
+} ColumnValue;
+
+// Range of a column within a block, stored ahead of the block's values so a reader can skip it
+typedef struct ColumnStats {
+    ColumnValue min, max;
+    uint32_t size;      // Bytes of the column's encoded values in the block
+    uint32_t unused;
+} ColumnStats;
+
+// A results file open for appending, shared by every writer thread
+typedef struct ColumnFile {
+    int fd;
+    int n_columns;
+    ColumnSpec columns[COLUMN_MAX];
+    pthread_mutex_t mutex;  // Orders the blocks of this process' writers
+    long blocks;        // Blocks appended through this handle
+} ColumnFile;
+
+// Rows buffered by one writer thread, appended to the file a block at a time
+typedef struct ColumnBuffer {
+    ColumnFile *file;
+    ColumnValue *values[COLUMN_MAX];  // One array of COLUMN_BLOCK_ROWS values per column
+    int n_rows;
+} ColumnBuffer;
+
+// A results file open for reading, one block at a time
+typedef struct ColumnReader {
+    int fd;
+    int n_columns;
+    ColumnSpec columns[COLUMN_MAX];
+} ColumnReader;
+
 // Container structure which contains all of the core data for our simulation
 typedef struct Manager {
     int simulation_running;
+    int quiet;          // Skips the display, debug output and pacing, for replaying recorded events
     SystemArray system_array;
     SharedResourceArray resources;
     EventQueue event_queue;
+    Quiescence quiescence;
 } Manager;
 
 // Manager functions
 void manager_init(Manager *manager);
 void manager_clean(Manager *manager);
 void manager_run(Manager *manager);
+int  manager_decide_mode(const Event *event);
+
+// Batched threshold evaluation functions
+void threshold_batch_init(ThresholdBatch *batch, int size);
+void threshold_batch_clean(ThresholdBatch *batch);
+void threshold_batch_set(ThresholdBatch *batch, int i, int input_amount);
+int  threshold_batch_classify(ThresholdBatch *batch);
+
+// Quiescence detection functions
+void quiescence_init(Quiescence *quiescence);
+void quiescence_clean(Quiescence *quiescence);
+long quiescence_now_ms(void);
+void quiescence_observe(Quiescence *quiescence, const Event *event);
+int  quiescence_check(Quiescence *quiescence, const Manager *manager, long now_ms);
+void quiescence_report(const Quiescence *quiescence, const Manager *manager, int result);
+
+// Shared-memory functions, simulation state is allocated through these so it can live in the segment
+Manager *shm_create(void);
+void shm_destroy(void);
+int  shm_run(Manager *manager);
+void *sim_alloc(size_t size);
+void sim_free(void *ptr);
+int  sim_pshared(void);
+
+// Remote worker transport functions
+int  remote_run(Manager *manager);
+
+// Epoch-based reclamation functions, readers of the system and resource arrays never block
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void *ptr, void (*destroy)(void *));
+void epoch_synchronize(void);
+void epoch_clean(void);
+
+// Runtime reconfiguration functions, the simulation keeps running while they work
+void reconfig_lock(void);
+void reconfig_unlock(void);
+void reconfig_attach_resource(Manager *manager, Resource *resource);
+int  reconfig_detach_resource(Manager *manager, Resource *resource);
+int  reconfig_attach_system(Manager *manager, System *system);
+void reconfig_detach_system(Manager *manager, System *system);
+
+// Scenario reload functions
+int  scenario_reload(Manager *manager, const char *path);
+
+// Thread placement functions
+void affinity_pin_threads(const Manager *manager, pthread_t manager_thread, const pthread_t *system_threads);
+
+// Resource forecast functions
+void   forecast_init(Forecast *forecast, long now_ms, int level);
+void   forecast_add(Forecast *forecast, long now_ms, int level);
+double forecast_rate(const Forecast *forecast);
+long   forecast_time_to_empty(const Forecast *forecast, int level);
+long   forecast_time_to_full(const Forecast *forecast, int level, int capacity);
+
+// Quantile sketch functions
+void   sketch_init(QuantileSketch *sketch);
+void   sketch_add(QuantileSketch *sketch, int value);
+void   sketch_merge(QuantileSketch *into, const QuantileSketch *from);
+double sketch_quantile(const QuantileSketch *sketch, double q);
+void   sketch_report(const Manager *manager, const char *path);
+
+// Event log recording and replay functions
+void record_start(void);
+int  record_finish(const Manager *manager, const char *path);
+void record_attach(int system);
+void record_event(int kind, const Event *event);
+void record_transfer(int kind, const Resource *resource, int amount, int moved);
+void record_mode(const System *system, int mode);
+int  record_replay(Manager *manager, const char *path);
+int  record_benchmark_manager(Manager *manager, const char *path);
+
+// Discrete-event engine functions
+void des_run(Manager *manager, int engine, int partitions, DesResult *result);
+void des_run_until(Manager *manager, int engine, int partitions, long horizon_ms, uint64_t seed, DesResult *result);
+int  des_result_equal(const DesResult *a, const DesResult *b);
+void des_print_result(const char *label, const DesResult *result);
+
+// Scenario optimizer functions
+int  optimize_run(void);
+
+// Worker pool functions
+int  pool_threads(void);
+int  pool_take(WorkPool *pool);
+void pool_run(WorkPool *pool, void *(*worker)(void *), void *arg, int n_threads);
+
+// Result cache functions
+void cache_run_until(Manager *manager, int engine, int partitions, long horizon_ms, uint64_t seed, DesResult *result);
+void cache_stats(long *hits, long *misses);
+void cache_close(void);
+
+// Columnar results file functions
+int  column_open(ColumnFile *file, const char *path, const ColumnSpec *columns, int n_columns);
+void column_close(ColumnFile *file);
+void column_buffer_init(ColumnBuffer *buffer, ColumnFile *file);
+void column_append(ColumnBuffer *buffer, const ColumnValue *row);
+void column_flush(ColumnBuffer *buffer);
+void column_buffer_free(ColumnBuffer *buffer);
+int  column_reader_open(ColumnReader *reader, const char *path);
+int  column_next_block(ColumnReader *reader, int *n_rows, ColumnStats *stats);
+int  column_read_block(ColumnReader *reader, int n_rows, const ColumnStats *stats, const int *wanted, ColumnValue **values);
+void column_reader_close(ColumnReader *reader);
+
+// Sensitivity analysis functions
+int  sensitivity_run(void);
+
+// Loads the vehicle's resources and systems, defined in main.c
+void load_data(Manager *manager);
+
+// Fluid-approximation engine functions
+void fluid_run(Manager *manager);
 
 // System functions
 void system_create(System **system, const char *name, Recipe recipe, EventQueue *event_queue);
 void system_destroy(System *system);
 void system_run(System *system);
+void system_set_recipe(System *system, Recipe recipe);
 
 // These getters help us tell the compiler, with this attribute tag, not to consider these functions for race conditions
 int system_get_mode(const System *system) __attribute__((no_sanitize("thread")));
+int  system_mode_applies(int current, int mode);
 void system_set_mode(System *system, int mode) __attribute__((no_sanitize("thread")));
 
 // Resource functions
@@ -121,6 +558,43 @@ void resource_create(Resource **resource, const char *name, int amount, int max_
 void resource_destroy(Resource *resource);
 void resource_transfer_into(Resource *resource, int *amount);
 void resource_transfer_from(Resource *resource, int *amount);
+void resource_set_capacity(Resource *resource, int max_capacity);
+
+// Transfer audit log functions
+int  audit_start(Manager *manager, const char *path);
+void audit_finish(void);
+void audit_attach(int system);
+void audit_transfer(const Resource *resource, int delta);
+
+// Event ring functions
+void event_ring_init(EventRing *ring);
+int  event_ring_subscribe(EventRing *ring, int policy);
+void event_ring_unsubscribe(EventRing *ring, int consumer);
+void event_ring_publish(EventRing *ring, const Event *event);
+uint64_t event_ring_available(EventRing *ring, int consumer, uint64_t *first);
+const Event *event_ring_get(const EventRing *ring, uint64_t sequence);
+int  event_ring_valid(const EventRing *ring, uint64_t sequence);
+void event_ring_release(EventRing *ring, int consumer, uint64_t next);
+void event_ring_synchronize(EventRing *ring);
+int  event_ring_start(Manager *manager, const char *path);
+void event_ring_finish(Manager *manager);
+void event_ring_display(Manager *manager);
+
+// Mass-conservation invariant functions
+void invariant_attach(int system);
+void invariant_transfer(Resource *resource, int kind, int moved);
+void invariant_poll(Manager *manager, long now_ms);
+int invariant_verify(Manager *manager);
+void invariant_report(Manager *manager);
+
+// Resource group functions
+void group_create(ResourceGroup **group, Resource **total, const char *name, int policy);
+void group_destroy(ResourceGroup *group);
+void group_add(ResourceGroup *group, Resource *member);
+void group_update(ResourceGroup *group, int member, int amount, int max_capacity);
+void group_transfer_from(ResourceGroup *group, int *amount);
+void group_transfer_into(ResourceGroup *group, int *amount);
+void group_set_policy(ResourceGroup *group, int policy);
 
 // ResourceAmount functions
 void recipe_init(Recipe *recipe, Resource *input, Resource *output, int input_amount, int output_amount, int processing_time);
@@ -133,15 +607,24 @@ void event_queue_init(EventQueue *queue);
 void event_queue_clean(EventQueue *queue);
 void event_queue_push(EventQueue *queue, const Event *event); 
 int  event_queue_pop(EventQueue *queue, Event* event);
+void event_queue_latency(EventQueue *queue, EventLatency *latency);
+void event_queue_report(EventQueue *queue);
+int  event_queue_discard(EventQueue *queue, const System *system, const Resource *resource);
 
 // Dynamic array functions for systems and resources
 void system_array_init(SystemArray *array);
 void system_array_clean(SystemArray *array);
 void system_array_add(SystemArray *array, System *system);
+void system_array_remove(SystemArray *array, const System *system);
+int  system_array_size(const SystemArray *array);
+System *system_array_get(const SystemArray *array, int i);
 
 void storage_init(SharedResourceArray *array);
 void storage_clean(SharedResourceArray *array);
 void storage_add(SharedResourceArray *array, Resource *resource);
+void storage_remove(SharedResourceArray *array, const Resource *resource);
+int  storage_size(const SharedResourceArray *array);
+Resource *storage_get(const SharedResourceArray *array, int i);
 
 // Simulation display functionality
 void display_simulation_state(Manager *manager) __attribute__((no_sanitize("thread")));
@@ -150,4 +633,6 @@ void display_finish_sim();
 
 //Thread funciton declarations
 void* system_thread(void *arg);
-void* manager_thread(void *arg);
\ No newline at end of file
+void* manager_thread(void *arg);
+void* reconfig_thread(void *arg);
+void* scenario_thread(void *arg);
\ No newline at end of file
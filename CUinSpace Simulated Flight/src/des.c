@@ -0,0 +1,1154 @@
+/***************************************************************
+ * des.c
+ * Contains the discrete-event engines.
+ * The simulation is run in virtual time without any sleeps: every system is a sequence of
+ * steps (pull its input, push its output) scheduled at the simulated millisecond they happen.
+ * Each step touches a single resource, the events it raises are handled by the manager's policy,
+ * and the manager's decisions take effect `PARAM_MANAGER_WAIT` milliseconds later, its reaction time.
+ * A step carries the state of its system, so a system's state always travels with its one pending step.
+ *
+ * The sequential engine runs every step in (time, system) order from one heap. The parallel engines
+ * partition the resources across worker threads, each with its own heap, and run the steps of a
+ * system at the partition owning the resource the step touches.
+ *
+ * The conservative engine advances in windows no longer than the lookahead: the shortest delay between
+ * two steps of a recipe spanning partitions, and the manager's reaction time. Nothing sent across
+ * partitions can land inside the current window.
+ *
+ * The optimistic engine (Time Warp) lets every partition run up to `PARAM_DES_OPTIMISM` milliseconds
+ * ahead, logging the resource amount each step overwrote. A step arriving in a partition's past, or a
+ * manager decision taking effect there, rolls the partition back and cancels the steps it sent on.
+ * Between epochs the global virtual time (GVT) is the earliest pending step: the manager handles the
+ * events before it, and the logs before it are dropped.
+ *
+ * Both parallel engines produce exactly the same results as the sequential one.
+ *
+ * A run may be given a seed, which jitters every processing time by up to `PARAM_DES_JITTER` percent.
+ * The jitter is a hash of the seed, the system and the simulated time rather than a stream of random
+ * numbers, so it is the same whatever order steps run or roll back in, and runs of two slightly
+ * different vehicles with the same seed see the same random numbers wherever they stay in step.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#include <limits.h>
+#include <sys/time.h>
+
+#define DES_PULL 0  // Next step pulls the system's input
+#define DES_PUSH 1  // Next step pushes the system's output
+
+// A system's next step, a system has exactly one pending step while it runs
+typedef struct DesStep {
+    long time;          // Simulated millisecond of the step
+    int system;         // Id of the system
+    int phase;          // DES_PULL or DES_PUSH
+    int amount;         // Input still to pull, or output still to push
+    int report;         // Whether the thresholds of the last cycle are still to be reported
+    int seq;            // Number of events the system raised so far
+} DesStep;
+
+// Binary min-heap of steps ordered by (time, system)
+typedef struct DesHeap {
+    DesStep *items;
+    int size;
+    int capacity;
+} DesHeap;
+
+// An event raised by a step, ordered by (time, system, seq) for the manager
+typedef struct DesEvent {
+    long time;
+    int system;
+    int seq;            // Orders events of one system at the same time
+    int resource;
+    int status;
+} DesEvent;
+
+// A mode taking effect at a simulated time
+typedef struct DesModeChange {
+    long time;
+    int mode;
+} DesModeChange;
+
+// Recipe and mode history of one system
+typedef struct DesSystem {
+    int input, output;  // Resource ids, -1 for none
+    int input_amount, output_amount, processing_time;
+    int low_threshold, high_threshold;
+    DesModeChange *modes;  // Mode timeline in increasing time order, only appended by the manager
+    int n_modes, cap_modes;
+} DesSystem;
+
+// A step sent to a partition
+typedef struct DesToken {
+    DesStep step;
+    int partition;      // -1 when no step was sent
+} DesToken;
+
+// What the optimistic engine needs to undo one executed step
+typedef struct DesLogEntry {
+    DesStep step;       // The step as it was before executing
+    int resource;       // Resource the step may have changed, -1 for none
+    int level;          // Amount of `resource` before the step
+    int executed;       // 0 if the system was already terminated and nothing happened
+    int emitted;        // Number of events the step raised
+    DesToken sent;      // The system's next step
+} DesLogEntry;
+
+struct DesModel;
+
+// State of one partition of a parallel engine, or of the whole sequential engine
+typedef struct DesPartition {
+    struct DesModel *model;
+    int index;
+    DesHeap heap;
+    DesToken *outbox;   // Steps for other partitions, delivered between windows
+    int n_out, cap_out;
+    DesEvent *events;   // Events for the manager, handled between windows
+    int n_events, cap_events;
+    DesToken sent;      // The next step scheduled by the last executed step
+    DesLogEntry *log;   // Steps executed after the GVT, optimistic engine only
+    int n_log, cap_log;
+    long steps;         // Steps executed and not rolled back
+    long rolled_back;   // Steps undone by rollbacks
+    long last_time;     // Time of the last step executed
+    pthread_t thread;
+} DesPartition;
+
+// Everything the engines share
+typedef struct DesModel {
+    Manager *manager;
+    int engine;         // DES_ENGINE_SEQUENTIAL, ...
+    long horizon;       // Steps at or after this simulated time are dropped
+    int truncated;      // Set once a step was dropped at the horizon
+    uint64_t seed;      // Seed of the processing time jitter, 0 for none
+    int n_systems, n_resources;
+    DesSystem *systems;
+    int *level;         // Amount of each resource, only touched by the owning partition
+    int *capacity;
+    int *owner;         // Partition owning each resource
+    int *producer_start, *producers;  // Producers of each resource in CSR form
+    int *position;      // Index of each system's pending step in its partition's heap, -1 if none
+
+    int n_partitions;
+    DesPartition *partitions;
+    long lookahead;     // Window length of the conservative engine
+    long window_end;    // End of the current window
+    int finished;       // Set when the parallel workers should stop
+    pthread_barrier_t barrier;
+
+    int running;        // Cleared when the manager terminates the simulation
+    long end_time;      // When the termination takes effect
+    int cause;          // DES_CAUSE_*
+    long events;        // Events handled by the manager
+} DesModel;
+
+static void des_build(DesModel *model, Manager *manager, int engine, int n_partitions, long horizon_ms, uint64_t seed);
+static void des_free(DesModel *model);
+static void des_partition(DesModel *model);
+static void des_result(const DesModel *model, DesResult *result);
+static void des_run_conservative(DesModel *model);
+static void des_run_optimistic(DesModel *model);
+static void des_deliver(DesModel *model);
+static long des_earliest(const DesModel *model);
+static void des_execute(DesPartition *partition, DesStep step);
+static void des_schedule(DesPartition *partition, DesStep step);
+static int des_step_resource(const DesModel *model, const DesStep *step);
+static void des_emit(DesPartition *partition, DesStep *step, int resource, int status);
+static void des_manager_handle(DesModel *model, const DesEvent *event);
+static long des_jitter(const DesModel *model, const DesStep *step, long duration);
+static int des_mode_at(const DesSystem *system, long time);
+static void des_set_mode(DesSystem *system, long time, int mode);
+static void *des_worker(void *arg);
+static void des_speculate(DesPartition *partition);
+static void des_rollback(DesModel *model, int partition, long time, int system);
+static void des_cancel(DesModel *model, const DesToken *token);
+static void des_rollback_system(DesModel *model, int system, long time);
+static void des_collect(DesModel *model, long gvt);
+static int des_event_compare(const void *a, const void *b);
+static int des_step_before(const DesStep *a, long time, int system);
+static void des_heap_push(DesHeap *heap, DesStep step, int *position);
+static DesStep des_heap_remove(DesHeap *heap, int index, int *position);
+static void *des_grow(void *items, int *capacity, int size, size_t item_size);
+
+/**
+ * Runs the loaded simulation with a discrete-event engine, without changing the manager.
+ *
+ * @param[in]  manager    Pointer to the loaded `Manager`, only read.
+ * @param[in]  engine     `DES_ENGINE_SEQUENTIAL`, `DES_ENGINE_CONSERVATIVE` or `DES_ENGINE_OPTIMISTIC`.
+ * @param[in]  partitions Number of worker threads of the parallel engines, ignored by the sequential one.
+ * @param[out] result     Pointer to the `DesResult` to fill.
+ */
+void des_run(Manager *manager, int engine, int partitions, DesResult *result) {
+    des_run_until(manager, engine, partitions, PARAM_DES_HORIZON, 0, result);
+}
+
+/**
+ * Runs the loaded simulation with a discrete-event engine until at most a given simulated time.
+ *
+ * A run cut short ends with `DES_CAUSE_HORIZON` and a duration of `horizon_ms`.
+ *
+ * @param[in]  manager    Pointer to the loaded `Manager`, only read.
+ * @param[in]  engine     `DES_ENGINE_SEQUENTIAL`, `DES_ENGINE_CONSERVATIVE` or `DES_ENGINE_OPTIMISTIC`.
+ * @param[in]  partitions Number of worker threads of the parallel engines, ignored by the sequential one.
+ * @param[in]  horizon_ms Simulated milliseconds after which nothing happens anymore.
+ * @param[in]  seed       Seed of the processing time jitter, 0 to run without any.
+ * @param[out] result     Pointer to the `DesResult` to fill.
+ */
+void des_run_until(Manager *manager, int engine, int partitions, long horizon_ms, uint64_t seed, DesResult *result) {
+    DesModel model;
+    struct timeval start, end;
+
+    des_build(&model, manager, engine, engine == DES_ENGINE_SEQUENTIAL ? 1 : partitions, horizon_ms, seed);
+    gettimeofday(&start, NULL);
+
+    if (engine == DES_ENGINE_SEQUENTIAL) {
+        DesPartition *partition = &model.partitions[0];
+        while (partition->heap.size > 0) {
+            des_execute(partition, des_heap_remove(&partition->heap, 0, model.position));
+        }
+    } else {
+        pthread_barrier_init(&model.barrier, NULL, model.n_partitions + 1);
+        for (int p = 0; p < model.n_partitions; p++) {
+            pthread_create(&model.partitions[p].thread, NULL, des_worker, &model.partitions[p]);
+        }
+
+        if (engine == DES_ENGINE_CONSERVATIVE) {
+            des_run_conservative(&model);
+        } else {
+            des_run_optimistic(&model);
+        }
+
+        for (int p = 0; p < model.n_partitions; p++) {
+            pthread_join(model.partitions[p].thread, NULL);
+        }
+        pthread_barrier_destroy(&model.barrier);
+    }
+
+    gettimeofday(&end, NULL);
+    des_result(&model, result);
+    result->wall_s = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+    des_free(&model);
+}
+
+/**
+ * Compares the outcome of two discrete-event runs.
+ *
+ * @param[in] a First `DesResult`.
+ * @param[in] b Second `DesResult`.
+ * @return 1 if both runs ended identically, 0 otherwise.
+ */
+int des_result_equal(const DesResult *a, const DesResult *b) {
+    return a->duration_ms == b->duration_ms && a->cause == b->cause && a->distance == b->distance &&
+           a->steps == b->steps && a->events == b->events && a->checksum == b->checksum;
+}
+
+/**
+ * Prints a one line summary of a discrete-event run.
+ *
+ * @param[in] label  Name of the engine.
+ * @param[in] result The `DesResult` to print.
+ */
+void des_print_result(const char *label, const DesResult *result) {
+    static const char *causes[] = {"", "oxygen depleted", "destination reached", "horizon reached", "no steps left"};
+    printf("%-12s: %d partition(s), lookahead %ld ms, %.1f s simulated in %.3f s, %ld steps (%ld rolled back), %ld events, %s, checksum %016llx\n",
+        label, result->partitions, result->lookahead_ms, result->duration_ms / 1000.0, result->wall_s,
+        result->steps, result->rolled_back, result->events, causes[result->cause], (unsigned long long)result->checksum);
+}
+
+/**
+ * Local helper that builds the engine's model from the manager and schedules every system's first step.
+ *
+ * @param[out] model        Pointer to the `DesModel` to build.
+ * @param[in]  manager      Pointer to the loaded `Manager`.
+ * @param[in]  engine       The engine that will run the model.
+ * @param[in]  n_partitions Number of partitions.
+ * @param[in]  horizon_ms   Simulated time at which the run stops.
+ * @param[in]  seed         Seed of the processing time jitter, 0 for none.
+ */
+static void des_build(DesModel *model, Manager *manager, int engine, int n_partitions, long horizon_ms, uint64_t seed) {
+    int n = manager->system_array.size;
+    int r_count = manager->resources.size;
+
+    memset(model, 0, sizeof(DesModel));
+    model->manager = manager;
+    model->engine = engine;
+    model->horizon = horizon_ms;
+    model->seed = seed;
+    model->n_systems = n;
+    model->n_resources = r_count;
+    model->n_partitions = n_partitions < 1 ? 1 : n_partitions;
+    model->running = 1;
+    model->end_time = LONG_MAX;
+
+    model->systems = calloc(n + 1, sizeof(DesSystem));
+    model->level = calloc(r_count + 1, sizeof(int));
+    model->capacity = calloc(r_count + 1, sizeof(int));
+    model->owner = calloc(r_count + 1, sizeof(int));
+    model->producer_start = calloc(r_count + 2, sizeof(int));
+    model->producers = calloc(n + 1, sizeof(int));
+    model->position = malloc((n + 1) * sizeof(int));
+    model->partitions = calloc(model->n_partitions, sizeof(DesPartition));
+    assert(model->systems && model->level && model->capacity && model->owner &&
+           model->producer_start && model->producers && model->position && model->partitions);
+
+    for (int r = 0; r < r_count; r++) {
+        model->level[r] = manager->resources.resources[r]->amount;
+        model->capacity[r] = manager->resources.resources[r]->max_capacity;
+    }
+
+    for (int i = 0; i < n; i++) {
+        const System *source = manager->system_array.systems[i];
+        DesSystem *system = &model->systems[i];
+        system->input = source->recipe->input ? source->recipe->input->id : -1;
+        system->output = source->recipe->output ? source->recipe->output->id : -1;
+        system->input_amount = source->recipe->input_amount;
+        system->output_amount = source->recipe->output_amount;
+        system->processing_time = source->recipe->processing_time;
+        system->low_threshold = source->recipe->low_threshold;
+        system->high_threshold = source->recipe->high_threshold;
+        des_set_mode(system, LONG_MIN, system_get_mode(source));
+        model->position[i] = -1;
+
+        if (system->output >= 0) model->producer_start[system->output + 1]++;
+    }
+    for (int r = 0; r < r_count; r++) {
+        model->producer_start[r + 1] += model->producer_start[r];
+    }
+    int *fill = calloc(r_count + 1, sizeof(int));
+    assert(fill != NULL);
+    for (int i = 0; i < n; i++) {
+        int r = model->systems[i].output;
+        if (r >= 0) model->producers[model->producer_start[r] + fill[r]++] = i;
+    }
+    free(fill);
+
+    for (int p = 0; p < model->n_partitions; p++) {
+        model->partitions[p].model = model;
+        model->partitions[p].index = p;
+    }
+    des_partition(model);
+
+    // Every system starts by pulling its input at time zero
+    for (int i = 0; i < n; i++) {
+        DesStep first = {0, i, DES_PULL, model->systems[i].input_amount, 0, 0};
+        des_schedule(&model->partitions[0], first);
+    }
+    des_deliver(model);
+}
+
+/**
+ * Local helper that frees everything allocated by `des_build()`.
+ *
+ * @param[in,out] model Pointer to the `DesModel` to free.
+ */
+static void des_free(DesModel *model) {
+    for (int i = 0; i < model->n_systems; i++) {
+        free(model->systems[i].modes);
+    }
+    for (int p = 0; p < model->n_partitions; p++) {
+        free(model->partitions[p].heap.items);
+        free(model->partitions[p].outbox);
+        free(model->partitions[p].events);
+        free(model->partitions[p].log);
+    }
+    free(model->systems);
+    free(model->level);
+    free(model->capacity);
+    free(model->owner);
+    free(model->producer_start);
+    free(model->producers);
+    free(model->position);
+    free(model->partitions);
+}
+
+/**
+ * Local helper that assigns every resource to a partition and derives the lookahead.
+ *
+ * Connected components of the recipe graph are kept together when there are at least as many of them as
+ * partitions, largest first onto the least loaded partition, so no recipe spans partitions. Otherwise the
+ * resources are dealt out round-robin. The lookahead is the manager's reaction time, lowered to the
+ * shortest delay between the pull and push steps of any recipe whose input and output are in different partitions.
+ *
+ * @param[in,out] model Pointer to the `DesModel`.
+ */
+static void des_partition(DesModel *model) {
+    int r_count = model->n_resources;
+    int *parent = malloc((r_count + 1) * sizeof(int));
+    int *size = calloc(r_count + 1, sizeof(int));
+    int *load = calloc(model->n_partitions, sizeof(int));
+    int *order = malloc((r_count + 1) * sizeof(int));
+    int components = 0;
+    assert(parent && size && load && order);
+
+    for (int r = 0; r < r_count; r++) parent[r] = r;
+    for (int i = 0; i < model->n_systems; i++) {
+        int a = model->systems[i].input, b = model->systems[i].output;
+        if (a < 0 || b < 0) continue;
+        while (parent[a] != a) a = parent[a] = parent[parent[a]];
+        while (parent[b] != b) b = parent[b] = parent[parent[b]];
+        parent[a] = b;
+    }
+    for (int r = 0; r < r_count; r++) {
+        int root = r;
+        while (parent[root] != root) root = parent[root];
+        parent[r] = root;
+        if (size[root]++ == 0) order[components++] = root;
+    }
+
+    if (components >= model->n_partitions) {
+        // Components were found in resource order, sort them largest first, ties staying in that order
+        for (int c = 1; c < components; c++) {
+            int root = order[c], k = c;
+            for (; k > 0 && size[order[k - 1]] < size[root]; k--) order[k] = order[k - 1];
+            order[k] = root;
+        }
+
+        // Then place each on the least loaded partition
+        for (int c = 0; c < components; c++) {
+            int best = 0;
+            for (int p = 1; p < model->n_partitions; p++) {
+                if (load[p] < load[best]) best = p;
+            }
+            model->owner[order[c]] = best;
+            load[best] += size[order[c]];
+        }
+        for (int r = 0; r < r_count; r++) model->owner[r] = model->owner[parent[r]];
+    } else {
+        for (int r = 0; r < r_count; r++) model->owner[r] = r % model->n_partitions;
+    }
+
+    model->lookahead = PARAM_MANAGER_WAIT;
+    for (int i = 0; i < model->n_systems; i++) {
+        const DesSystem *system = &model->systems[i];
+        if (system->input < 0 || system->output < 0 || model->owner[system->input] == model->owner[system->output]) continue;
+        long fastest = system->processing_time / 4;
+        if (model->seed != 0) fastest -= fastest * PARAM_DES_JITTER / 100;
+        if (fastest < 1) fastest = 1;
+        if (fastest < model->lookahead) model->lookahead = fastest;
+        if (PARAM_SYSTEM_WAIT < model->lookahead) model->lookahead = PARAM_SYSTEM_WAIT;
+    }
+
+    free(parent);
+    free(size);
+    free(load);
+    free(order);
+}
+
+/**
+ * Local helper that fills a `DesResult` from a finished model.
+ *
+ * @param[in]  model  Pointer to the finished `DesModel`.
+ * @param[out] result Pointer to the `DesResult` to fill.
+ */
+static void des_result(const DesModel *model, DesResult *result) {
+    uint64_t hash = 1469598103934665603ULL;  // FNV-1a
+    long last_time = 0;
+
+    memset(result, 0, sizeof(DesResult));
+    for (int p = 0; p < model->n_partitions; p++) {
+        result->steps += model->partitions[p].steps;
+        result->rolled_back += model->partitions[p].rolled_back;
+        if (model->partitions[p].last_time > last_time) last_time = model->partitions[p].last_time;
+    }
+
+    for (int r = 0; r < model->n_resources; r++) {
+        hash = (hash ^ (uint32_t)model->level[r]) * 1099511628211ULL;
+        if (strcmp(model->manager->resources.resources[r]->info.name, "Distance") == 0) {
+            result->distance += model->level[r];
+        }
+    }
+    for (int i = 0; i < model->n_systems; i++) {
+        const DesSystem *system = &model->systems[i];
+        hash = (hash ^ (uint32_t)system->n_modes) * 1099511628211ULL;
+        hash = (hash ^ (uint32_t)system->modes[system->n_modes - 1].mode) * 1099511628211ULL;
+    }
+
+    result->checksum = hash;
+    result->events = model->events;
+    result->partitions = model->n_partitions;
+    result->lookahead_ms = model->engine == DES_ENGINE_CONSERVATIVE ? model->lookahead : 0;
+    if (!model->running) {
+        result->duration_ms = model->end_time;
+        result->cause = model->cause;
+    } else {
+        result->duration_ms = model->truncated ? model->horizon : last_time;
+        result->cause = model->truncated ? DES_CAUSE_HORIZON : DES_CAUSE_IDLE;
+    }
+}
+
+/**
+ * Local helper that coordinates the conservative engine's workers window by window.
+ *
+ * @param[in,out] model Pointer to the `DesModel`, with its workers started.
+ */
+static void des_run_conservative(DesModel *model) {
+    for (;;) {
+        // Jump straight to the earliest pending step, there is nothing to do before it
+        long next = des_earliest(model);
+        model->finished = (next == LONG_MAX);
+        model->window_end = next + model->lookahead;
+
+        pthread_barrier_wait(&model->barrier);  // Start of window
+        if (model->finished) break;
+        pthread_barrier_wait(&model->barrier);  // End of window
+
+        // Steps that crossed partitions are all at or after the window's end
+        for (int p = 0; p < model->n_partitions; p++) {
+            for (int k = 0; k < model->partitions[p].n_out; k++) {
+                assert(model->partitions[p].outbox[k].step.time >= model->window_end);
+            }
+        }
+        des_deliver(model);
+
+        // Hand the window's events to the manager in the same order the sequential engine does
+        int n_events = 0;
+        for (int p = 0; p < model->n_partitions; p++) n_events += model->partitions[p].n_events;
+        if (n_events == 0) continue;
+
+        DesEvent *events = malloc(n_events * sizeof(DesEvent));
+        assert(events != NULL);
+        n_events = 0;
+        for (int p = 0; p < model->n_partitions; p++) {
+            memcpy(&events[n_events], model->partitions[p].events, model->partitions[p].n_events * sizeof(DesEvent));
+            n_events += model->partitions[p].n_events;
+            model->partitions[p].n_events = 0;
+        }
+        qsort(events, n_events, sizeof(DesEvent), des_event_compare);
+        for (int e = 0; e < n_events; e++) {
+            des_manager_handle(model, &events[e]);
+        }
+        free(events);
+    }
+}
+
+/**
+ * Local helper that coordinates the optimistic engine's workers epoch by epoch.
+ *
+ * After each epoch, delivers the steps sent across partitions and rolls back every partition that
+ * already went past one of them. The earliest pending step is then the GVT: nothing can happen before it
+ * anymore, except for the manager's decisions on the events before it. Those are handled in order, each
+ * mode change rolling back the steps its system took after the change takes effect, which lowers the
+ * GVT to that time at most. Everything before the final GVT is committed and its logs are dropped.
+ *
+ * @param[in,out] model Pointer to the `DesModel`, with its workers started.
+ */
+static void des_run_optimistic(DesModel *model) {
+    int *modes_before = malloc((model->n_systems + 1) * sizeof(int));
+    long gvt = des_earliest(model);
+    assert(modes_before != NULL);
+
+    for (;;) {
+        model->finished = (gvt == LONG_MAX);
+        model->window_end = model->finished ? LONG_MAX : gvt + PARAM_DES_OPTIMISM;
+
+        pthread_barrier_wait(&model->barrier);  // Start of epoch
+        if (model->finished) break;
+        pthread_barrier_wait(&model->barrier);  // End of epoch
+
+        // Every live step must be in a heap before rollbacks go looking for the ones to cancel
+        des_deliver(model);
+        for (int p = 0; p < model->n_partitions; p++) {
+            DesPartition *partition = &model->partitions[p];
+            if (partition->heap.size == 0 || partition->n_log == 0) continue;
+
+            const DesStep *last = &partition->log[partition->n_log - 1].step;
+            DesStep straggler = partition->heap.items[0];
+            if (des_step_before(&straggler, last->time, last->system)) {
+                des_rollback(model, p, straggler.time, straggler.system);
+            }
+        }
+        gvt = des_earliest(model);
+
+        // Events before the GVT come from steps that no straggler can undo anymore
+        int n_events = 0;
+        for (int p = 0; p < model->n_partitions; p++) n_events += model->partitions[p].n_events;
+        DesEvent *events = malloc((n_events > 0 ? n_events : 1) * sizeof(DesEvent));
+        assert(events != NULL);
+        n_events = 0;
+        for (int p = 0; p < model->n_partitions; p++) {
+            const DesPartition *partition = &model->partitions[p];
+            for (int e = 0; e < partition->n_events && partition->events[e].time < gvt; e++) {
+                events[n_events++] = partition->events[e];
+            }
+        }
+        qsort(events, n_events, sizeof(DesEvent), des_event_compare);
+
+        // A decision can undo later steps and their events, so stop at the lowered GVT
+        for (int e = 0; e < n_events && events[e].time < gvt; e++) {
+            int first = model->producer_start[events[e].resource];
+            int last = model->producer_start[events[e].resource + 1];
+            int running = model->running;
+            long effective = events[e].time + PARAM_MANAGER_WAIT;
+
+            for (int k = first; k < last; k++) {
+                modes_before[k - first] = model->systems[model->producers[k]].n_modes;
+            }
+            des_manager_handle(model, &events[e]);
+
+            if (running && !model->running) {
+                for (int p = 0; p < model->n_partitions; p++) {
+                    des_rollback(model, p, effective, INT_MIN);
+                }
+                if (effective < gvt) gvt = effective;
+                continue;
+            }
+            for (int k = first; k < last; k++) {
+                if (model->systems[model->producers[k]].n_modes == modes_before[k - first]) continue;
+                des_rollback_system(model, model->producers[k], effective);
+                if (effective < gvt) gvt = effective;
+            }
+        }
+        free(events);
+
+        des_collect(model, gvt);
+    }
+
+    free(modes_before);
+}
+
+/**
+ * Local helper that moves every step sent across partitions into its partition's heap.
+ *
+ * @param[in,out] model Pointer to the `DesModel`.
+ */
+static void des_deliver(DesModel *model) {
+    for (int p = 0; p < model->n_partitions; p++) {
+        DesPartition *partition = &model->partitions[p];
+        for (int k = 0; k < partition->n_out; k++) {
+            des_heap_push(&model->partitions[partition->outbox[k].partition].heap, partition->outbox[k].step, model->position);
+        }
+        partition->n_out = 0;
+    }
+}
+
+/**
+ * Local helper that finds the earliest pending step of all partitions.
+ *
+ * @param[in] model Pointer to the `DesModel`.
+ * @return Time of the earliest pending step, LONG_MAX if there is none.
+ */
+static long des_earliest(const DesModel *model) {
+    long earliest = LONG_MAX;
+    for (int p = 0; p < model->n_partitions; p++) {
+        if (model->partitions[p].heap.size > 0 && model->partitions[p].heap.items[0].time < earliest) {
+            earliest = model->partitions[p].heap.items[0].time;
+        }
+    }
+    return earliest;
+}
+
+/**
+ * Local helper that executes one step of a system, then schedules its next step.
+ *
+ * Follows `system_run()`: a pull that comes up short reports INSUFFICIENT and retries after
+ * `PARAM_SYSTEM_WAIT`, a full pull processes for the mode's processing time and then pushes, and a push
+ * that does not fit reports CAPACITY and retries. The thresholds of a finished cycle are reported by the
+ * next pull, which happens at the input's partition anyway.
+ *
+ * @param[in,out] partition Pointer to the `DesPartition` owning the resource the step touches.
+ * @param[in]     step      The step to execute.
+ */
+static void des_execute(DesPartition *partition, DesStep step) {
+    DesModel *model = partition->model;
+    const DesSystem *system = &model->systems[step.system];
+    int mode = des_mode_at(system, step.time);
+    long now = step.time;
+
+    partition->sent.partition = -1;
+    if (mode == MODE_TERMINATE) {
+        return;
+    }
+    partition->steps++;
+    if (model->engine != DES_ENGINE_OPTIMISTIC) partition->last_time = now;
+
+    // A disabled system holds on to whatever it has and looks again later
+    if (mode == MODE_DISABLED) {
+        step.time = now + PARAM_SYSTEM_WAIT;
+        des_schedule(partition, step);
+        return;
+    }
+
+    if (step.phase == DES_PULL) {
+        if (system->input >= 0) {
+            int *level = &model->level[system->input];
+
+            // Classified here rather than with a ThresholdBatch: a step runs one system at the one
+            // time it executes, and the engines must match the sequential order event for event, so
+            // there is never more than one system to classify at once
+            if (step.report) {
+                if (*level <= system->low_threshold) {
+                    des_emit(partition, &step, system->input, EVENT_LOW);
+                } else if (*level > system->high_threshold) {
+                    des_emit(partition, &step, system->input, EVENT_HIGH);
+                }
+                step.report = 0;
+            }
+
+            int taken = *level < step.amount ? *level : step.amount;
+            *level -= taken;
+            step.amount -= taken;
+        } else {
+            step.amount = 0;
+        }
+
+        if (step.amount > 0) {
+            des_emit(partition, &step, system->input, EVENT_INSUFFICIENT);
+            step.time = now + PARAM_SYSTEM_WAIT;
+        } else {
+            long duration = system->processing_time;
+            if (mode == MODE_SLOW) duration *= 4;
+            if (mode == MODE_FAST) duration /= 4;
+            duration = des_jitter(model, &step, duration);
+            if (duration < 1) duration = 1;
+
+            if (system->output >= 0) {
+                step.phase = DES_PUSH;
+                step.amount = system->output_amount;
+                step.time = now + duration;
+            } else {
+                step.amount = system->input_amount;
+                step.report = 1;
+                step.time = now + duration + PARAM_SYSTEM_WAIT;
+            }
+        }
+    } else {
+        int *level = &model->level[system->output];
+        int room = model->capacity[system->output] - *level;
+        int stored = room < step.amount ? room : step.amount;
+
+        *level += stored;
+        step.amount -= stored;
+
+        if (step.amount > 0) {
+            des_emit(partition, &step, system->output, EVENT_CAPACITY);
+        } else {
+            step.phase = DES_PULL;
+            step.amount = system->input_amount;
+            step.report = 1;
+        }
+        step.time = now + PARAM_SYSTEM_WAIT;
+    }
+
+    des_schedule(partition, step);
+}
+
+/**
+ * Local helper that schedules a system's next step at the partition owning the resource it touches.
+ *
+ * Steps past the model's horizon are dropped, which ends the system. Records what was sent in `partition->sent`.
+ *
+ * @param[in,out] partition Pointer to the `DesPartition` scheduling the step.
+ * @param[in]     step      The step to schedule.
+ */
+static void des_schedule(DesPartition *partition, DesStep step) {
+    DesModel *model = partition->model;
+    int resource = des_step_resource(model, &step);
+    int owner = resource >= 0 ? model->owner[resource] : 0;
+
+    if (step.time >= model->horizon) {
+        __atomic_store_n(&model->truncated, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    partition->sent.step = step;
+    partition->sent.partition = owner;
+    if (owner == partition->index) {
+        des_heap_push(&partition->heap, step, model->position);
+    } else {
+        partition->outbox = des_grow(partition->outbox, &partition->cap_out, partition->n_out, sizeof(DesToken));
+        partition->outbox[partition->n_out++] = partition->sent;
+    }
+}
+
+/**
+ * Local helper that finds the resource a step touches.
+ *
+ * @param[in] model Pointer to the `DesModel`.
+ * @param[in] step  The step.
+ * @return Id of the resource, -1 if the system has none.
+ */
+static int des_step_resource(const DesModel *model, const DesStep *step) {
+    const DesSystem *system = &model->systems[step->system];
+    return (step->phase == DES_PULL && system->input >= 0) ? system->input : system->output;
+}
+
+/**
+ * Local helper that raises an event for the manager.
+ *
+ * The sequential engine hands it to the manager right away, which is already in (time, system, seq)
+ * order. The parallel engines collect it and sort the events before handing them over.
+ *
+ * @param[in,out] partition Pointer to the `DesPartition` executing the step.
+ * @param[in,out] step      The step raising the event, its event counter is advanced.
+ * @param[in]     resource  Id of the resource the event is about.
+ * @param[in]     status    Status code of the event.
+ */
+static void des_emit(DesPartition *partition, DesStep *step, int resource, int status) {
+    DesModel *model = partition->model;
+    DesEvent event = {step->time, step->system, step->seq++, resource, status};
+
+    if (model->engine == DES_ENGINE_SEQUENTIAL) {
+        des_manager_handle(model, &event);
+        return;
+    }
+    partition->events = des_grow(partition->events, &partition->cap_events, partition->n_events, sizeof(DesEvent));
+    partition->events[partition->n_events++] = event;
+}
+
+/**
+ * Local helper that applies the manager's policy to one event.
+ *
+ * The decision comes from `manager_decide_mode()` and takes effect `PARAM_MANAGER_WAIT` milliseconds after the event.
+ *
+ * @param[in,out] model Pointer to the `DesModel`.
+ * @param[in]     event The event to handle.
+ */
+static void des_manager_handle(DesModel *model, const DesEvent *event) {
+    Event manager_event;
+    long effective = event->time + PARAM_MANAGER_WAIT;
+
+    if (!model->running) return;
+    model->events++;
+
+    event_init(&manager_event, model->manager->system_array.systems[event->system],
+               model->manager->resources.resources[event->resource], event->status);
+    if (manager_event.priority == PRIORITY_IGN) return;
+    int mode = manager_decide_mode(&manager_event);
+
+    if (mode == MODE_TERMINATE) {
+        model->running = 0;
+        model->end_time = effective;
+        model->cause = event->status == EVENT_INSUFFICIENT ? DES_CAUSE_OXYGEN : DES_CAUSE_DESTINATION;
+        for (int i = 0; i < model->n_systems; i++) {
+            DesSystem *system = &model->systems[i];
+            if (system->modes[system->n_modes - 1].mode != MODE_TERMINATE) des_set_mode(system, effective, MODE_TERMINATE);
+        }
+        return;
+    }
+
+    for (int p = model->producer_start[event->resource]; p < model->producer_start[event->resource + 1]; p++) {
+        DesSystem *system = &model->systems[model->producers[p]];
+        int latest = system->modes[system->n_modes - 1].mode;
+        if (latest != MODE_TERMINATE && latest != mode && system_mode_applies(latest, mode)) des_set_mode(system, effective, mode);
+    }
+}
+
+/**
+ * Local helper that finds a system's mode at a simulated time.
+ *
+ * @param[in] system Pointer to the `DesSystem`.
+ * @param[in] time   Simulated time.
+ * @return The mode of the latest change at or before `time`.
+ */
+static int des_mode_at(const DesSystem *system, long time) {
+    int low = 0, high = system->n_modes - 1;
+
+    // Binary search for the last change at or before `time`, the first change is always in effect
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (system->modes[middle].time <= time) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return system->modes[low].mode;
+}
+
+/**
+ * Local helper that jitters a processing time by up to `PARAM_DES_JITTER` percent.
+ *
+ * @param[in] model    Pointer to the `DesModel`.
+ * @param[in] step     The step starting the processing.
+ * @param[in] duration Processing time before the jitter.
+ * @return The jittered processing time, `duration` itself if the run has no seed.
+ */
+static long des_jitter(const DesModel *model, const DesStep *step, long duration) {
+    if (model->seed == 0) return duration;
+
+    // splitmix64 of the seed, system and time, the same step always draws the same number
+    uint64_t hash = (model->seed * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)step->system << 48) ^ (uint64_t)step->time;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
+
+    long percent = (long)(hash % (2 * PARAM_DES_JITTER + 1)) - PARAM_DES_JITTER;
+    return duration + duration * percent / 100;
+}
+
+/**
+ * Local helper that appends a mode change to a system's timeline.
+ *
+ * @param[in,out] system Pointer to the `DesSystem`.
+ * @param[in]     time   Simulated time the mode takes effect, not before the previous change.
+ * @param[in]     mode   The new mode.
+ */
+static void des_set_mode(DesSystem *system, long time, int mode) {
+    assert(system->n_modes == 0 || system->modes[system->n_modes - 1].time <= time);
+    system->modes = des_grow(system->modes, &system->cap_modes, system->n_modes, sizeof(DesModeChange));
+    system->modes[system->n_modes].time = time;
+    system->modes[system->n_modes].mode = mode;
+    system->n_modes++;
+}
+
+/**
+ * Local helper, thread function of one partition of a parallel engine.
+ *
+ * Executes the local steps before the end of each window or epoch, between the two barriers the
+ * coordinator waits on.
+ *
+ * @param[in] arg Pointer to the `DesPartition` to run.
+ * @return NULL
+ */
+static void *des_worker(void *arg) {
+    DesPartition *partition = arg;
+    DesModel *model = partition->model;
+
+    for (;;) {
+        pthread_barrier_wait(&model->barrier);
+        if (model->finished) break;
+
+        if (model->engine == DES_ENGINE_OPTIMISTIC) {
+            des_speculate(partition);
+        } else {
+            while (partition->heap.size > 0 && partition->heap.items[0].time < model->window_end) {
+                des_execute(partition, des_heap_remove(&partition->heap, 0, model->position));
+            }
+        }
+
+        pthread_barrier_wait(&model->barrier);
+    }
+    return NULL;
+}
+
+/**
+ * Local helper that executes a partition's steps up to the end of the epoch, logging how to undo each.
+ *
+ * @param[in,out] partition Pointer to the `DesPartition`.
+ */
+static void des_speculate(DesPartition *partition) {
+    DesModel *model = partition->model;
+
+    while (partition->heap.size > 0 && partition->heap.items[0].time < model->window_end) {
+        DesStep step = des_heap_remove(&partition->heap, 0, model->position);
+        DesLogEntry entry;
+        long steps = partition->steps;
+        int events = partition->n_events;
+
+        entry.step = step;
+        entry.resource = des_step_resource(model, &step);
+        entry.level = entry.resource >= 0 ? model->level[entry.resource] : 0;
+        des_execute(partition, step);
+        entry.executed = partition->steps != steps;
+        entry.emitted = partition->n_events - events;
+        entry.sent = partition->sent;
+
+        partition->log = des_grow(partition->log, &partition->cap_log, partition->n_log, sizeof(DesLogEntry));
+        partition->log[partition->n_log++] = entry;
+    }
+}
+
+/**
+ * Local helper that rolls a partition back to just before a step.
+ *
+ * Undoes every logged step at or after (time, system) latest first: restores the resource amount,
+ * drops the events it raised, cancels the step it sent on and puts it back in the heap.
+ *
+ * @param[in,out] model     Pointer to the `DesModel`.
+ * @param[in]     partition Index of the partition to roll back.
+ * @param[in]     time      Time of the earliest step to undo.
+ * @param[in]     system    System of the earliest step to undo, INT_MIN for every step at `time`.
+ */
+static void des_rollback(DesModel *model, int partition, long time, int system) {
+    DesPartition *state = &model->partitions[partition];
+
+    while (state->n_log > 0) {
+        DesLogEntry entry = state->log[state->n_log - 1];
+        if (des_step_before(&entry.step, time, system)) break;
+        state->n_log--;
+
+        if (entry.resource >= 0) model->level[entry.resource] = entry.level;
+        state->n_events -= entry.emitted;
+        if (entry.executed) {
+            state->steps--;
+            state->rolled_back++;
+        }
+        if (entry.sent.partition >= 0) des_cancel(model, &entry.sent);
+        des_heap_push(&state->heap, entry.step, model->position);
+    }
+}
+
+/**
+ * Local helper that cancels a step sent by a rolled back step, the anti-message.
+ *
+ * If the step was already executed, its partition is rolled back to it first. Its successors are later
+ * in time, so the recursion always ends.
+ *
+ * @param[in,out] model Pointer to the `DesModel`.
+ * @param[in]     token The step that was sent and where it went.
+ */
+static void des_cancel(DesModel *model, const DesToken *token) {
+    DesHeap *heap = &model->partitions[token->partition].heap;
+    int system = token->step.system;
+    int i = model->position[system];
+
+    if (i < 0 || i >= heap->size || heap->items[i].system != system || heap->items[i].time != token->step.time) {
+        des_rollback(model, token->partition, token->step.time, system);
+        i = model->position[system];
+    }
+    assert(i >= 0 && i < heap->size && heap->items[i].system == system && heap->items[i].time == token->step.time);
+    des_heap_remove(heap, i, model->position);
+}
+
+/**
+ * Local helper that rolls back every step a system executed at or after a time.
+ *
+ * Undoing the earliest one cancels the rest of the system's steps with it.
+ *
+ * @param[in,out] model  Pointer to the `DesModel`.
+ * @param[in]     system Id of the system.
+ * @param[in]     time   Time from which its steps are wrong.
+ */
+static void des_rollback_system(DesModel *model, int system, long time) {
+    int best_partition = -1;
+    long best_time = LONG_MAX;
+
+    for (int p = 0; p < model->n_partitions; p++) {
+        const DesPartition *partition = &model->partitions[p];
+        for (int k = partition->n_log - 1; k >= 0 && partition->log[k].step.time >= time; k--) {
+            if (partition->log[k].step.system == system && partition->log[k].step.time < best_time) {
+                best_time = partition->log[k].step.time;
+                best_partition = p;
+            }
+        }
+    }
+    if (best_partition >= 0) {
+        des_rollback(model, best_partition, best_time, system);
+    }
+}
+
+/**
+ * Local helper that drops the logs and handled events before the GVT, fossil collection.
+ *
+ * @param[in,out] model Pointer to the `DesModel`.
+ * @param[in]     gvt   Global virtual time, nothing before it can be rolled back.
+ */
+static void des_collect(DesModel *model, long gvt) {
+    for (int p = 0; p < model->n_partitions; p++) {
+        DesPartition *partition = &model->partitions[p];
+        int k = 0, e = 0;
+
+        for (; k < partition->n_log && partition->log[k].step.time < gvt; k++) {
+            if (partition->log[k].executed) partition->last_time = partition->log[k].step.time;
+        }
+        memmove(partition->log, partition->log + k, (partition->n_log - k) * sizeof(DesLogEntry));
+        partition->n_log -= k;
+
+        while (e < partition->n_events && partition->events[e].time < gvt) e++;
+        memmove(partition->events, partition->events + e, (partition->n_events - e) * sizeof(DesEvent));
+        partition->n_events -= e;
+    }
+}
+
+/**
+ * Local helper that orders events by (time, system, seq) for `qsort()`.
+ */
+static int des_event_compare(const void *a, const void *b) {
+    const DesEvent *x = a, *y = b;
+    if (x->time != y->time) return x->time < y->time ? -1 : 1;
+    if (x->system != y->system) return x->system < y->system ? -1 : 1;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/**
+ * Local helper that orders a step against a (time, system) key.
+ *
+ * @return 1 if the step comes strictly before the key, 0 otherwise.
+ */
+static int des_step_before(const DesStep *a, long time, int system) {
+    return a->time < time || (a->time == time && a->system < system);
+}
+
+/**
+ * Local helper that adds a step to a heap, keeping track of its position.
+ *
+ * @param[in,out] heap     Pointer to the `DesHeap`.
+ * @param[in]     step     The step to add.
+ * @param[in,out] position Heap index of every system's step.
+ */
+static void des_heap_push(DesHeap *heap, DesStep step, int *position) {
+    heap->items = des_grow(heap->items, &heap->capacity, heap->size, sizeof(DesStep));
+
+    int i = heap->size++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (des_step_before(&heap->items[parent], step.time, step.system)) break;
+        heap->items[i] = heap->items[parent];
+        position[heap->items[i].system] = i;
+        i = parent;
+    }
+    heap->items[i] = step;
+    position[step.system] = i;
+}
+
+/**
+ * Local helper that removes the step at any index from a heap, 0 being the earliest step.
+ *
+ * @param[in,out] heap     Pointer to the `DesHeap`.
+ * @param[in]     index    Index of the step to remove.
+ * @param[in,out] position Heap index of every system's step, the removed step's becomes -1.
+ * @return The removed step.
+ */
+static DesStep des_heap_remove(DesHeap *heap, int index, int *position) {
+    DesStep removed = heap->items[index];
+    DesStep last = heap->items[--heap->size];
+    int i = index;
+
+    position[removed.system] = -1;
+    if (i == heap->size) return removed;
+
+    // The last step moves into the hole, either up or down
+    while (i > 0 && des_step_before(&last, heap->items[(i - 1) / 2].time, heap->items[(i - 1) / 2].system)) {
+        heap->items[i] = heap->items[(i - 1) / 2];
+        position[heap->items[i].system] = i;
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= heap->size) break;
+        if (child + 1 < heap->size && des_step_before(&heap->items[child + 1], heap->items[child].time, heap->items[child].system)) {
+            child++;
+        }
+        if (des_step_before(&last, heap->items[child].time, heap->items[child].system)) break;
+        heap->items[i] = heap->items[child];
+        position[heap->items[i].system] = i;
+        i = child;
+    }
+    heap->items[i] = last;
+    position[last.system] = i;
+    return removed;
+}
+
+/**
+ * Local helper that makes room for one more item in a dynamic array, doubling its capacity when full.
+ *
+ * @param[in]     items     The array, may be NULL.
+ * @param[in,out] capacity  Capacity of the array in items.
+ * @param[in]     size      Number of items in use.
+ * @param[in]     item_size Size of one item in bytes.
+ * @return The array, moved if it had to grow.
+ */
+static void *des_grow(void *items, int *capacity, int size, size_t item_size) {
+    if (size < *capacity) return items;
+
+    // Manually allocate new memory and copy over (can't use realloc)
+    int new_capacity = *capacity > 0 ? *capacity * 2 : 16;
+    void *new_items = malloc(new_capacity * item_size);
+    assert(new_items != NULL);
+    if (items != NULL) {
+        memcpy(new_items, items, size * item_size);
+        free(items);
+    }
+    *capacity = new_capacity;
+    return new_items;
+}
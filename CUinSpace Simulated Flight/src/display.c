@@ -115,25 +115,47 @@ static void display_with_header(const Manager* manager) {
 }
 
 static void display_modes(const Manager *manager) {
-    for (int i = 0; i < manager->system_array.size; i++) {
-        System *system = manager->system_array.systems[i];
+    for (int i = 0; i < system_array_size(&manager->system_array); i++) {
+        System *system = system_array_get(&manager->system_array, i);
+        if (system == NULL) {
+            // Blank out the row of a detached system
+            printf("%-*s\n", STATUS_WIDTH - 1, "");
+            continue;
+        }
         const char *mode_str = display_get_mode_str(system);
-        printf("%-20s: %-s\n", system->name, mode_str);
+        printf("%-20s: %-s\n", system->info.name, mode_str);
     }
 }
 
 static void display_resources(const Manager *manager) {
-    for (int i = 0; i < manager->resources.size; i++) {
-        Resource *resource = manager->resources.resources[i];
+    for (int i = 0; i < storage_size(&manager->resources); i++) {
+        Resource *resource = storage_get(&manager->resources, i);
         int current_amount;
+        long time_to_empty = -1, time_to_full = -1;
+        char trend[16] = "";
 
-        // Acquire the semaphore to read the resource amount safely
+        if (resource == NULL) {
+            // Blank out the row of a detached resource
+            MOVE_CURSOR(i + 4, 1);
+            printf("%-*s\n", STATUS_WIDTH - 1, "");
+            continue;
+        }
+
+        // Acquire the semaphore to read the resource amount and its forecast safely
         sem_wait(&resource->mutex);
         current_amount = resource->amount;
+        if (resource->info.forecast != NULL) {
+            time_to_empty = forecast_time_to_empty(resource->info.forecast, current_amount);
+            time_to_full = forecast_time_to_full(resource->info.forecast, current_amount, resource->max_capacity);
+        }
         sem_post(&resource->mutex);
 
+        // Down arrow with the seconds until empty, up arrow with the seconds until full
+        if (time_to_empty >= 0) snprintf(trend, sizeof(trend), "v%lds", time_to_empty / 1000 < 9999 ? time_to_empty / 1000 : 9999);
+        if (time_to_full >= 0) snprintf(trend, sizeof(trend), "^%lds", time_to_full / 1000 < 9999 ? time_to_full / 1000 : 9999);
+
         MOVE_CURSOR(i + 4, 1);
-        printf("%-20s: %4d / %4d\n", resource->name, current_amount, resource->max_capacity);
+        printf("%-14s: %4d / %4d %-6s\n", resource->info.name, current_amount, resource->max_capacity, trend);
     }
 }
 
@@ -151,8 +173,8 @@ void display_event(const Event *event) {
 
     printf("Event [%04d]: [%s] Reported Resource [%s] Status [%s]\n",
         N_DISPLAYED_EVENTS,
-        event->system->name,
-        event->resource->name,
+        event->system->info.name,
+        event->resource->info.name,
         status_str);
 
     SHOW_CURSOR();
@@ -183,6 +205,8 @@ static const char* display_get_mode_str(const System *system) {
             return "SLOW";
         case MODE_FAST:
             return "FAST";
+        case MODE_DISABLED:
+            return "DISABLED";
         case MODE_TERMINATE:
             return "TERMINATE";
         default:
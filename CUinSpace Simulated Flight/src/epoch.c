@@ -0,0 +1,195 @@
+/***************************************************************
+ * epoch.c
+ * Contains the epoch-based reclamation that lets the system and resource arrays change at runtime.
+ * Readers announce the global epoch when they start iterating and withdraw when they are done,
+ * without taking any lock. Anything unlinked from an array is retired into the list of the current
+ * epoch and only freed once the epoch has advanced twice, which can only happen after every reader
+ * that might still hold a pointer to it has withdrawn.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+
+#define EPOCH_MAX_READERS 64  // Threads that may read the arrays at once, a slot is released when its thread exits
+#define EPOCH_LISTS       3   // Retired objects of the current epoch and the two before it
+
+// An object waiting for every reader that could still see it to move on
+typedef struct Retired {
+    void *ptr;
+    void (*destroy)(void *);
+    struct Retired *next;
+} Retired;
+
+static uint64_t global_epoch = 1;
+static uint64_t reader_epochs[EPOCH_MAX_READERS];   // Epoch a reader announced, 0 while it is not reading
+static int reader_claimed[EPOCH_MAX_READERS];       // Whether a live thread owns the slot
+static int n_readers = 0;                           // Slots ever claimed, the rest were never used
+static pthread_key_t reader_key;
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
+static __thread int reader_slot = -1;
+static __thread int reader_depth = 0;
+
+static pthread_mutex_t retired_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Retired *retired[EPOCH_LISTS];
+
+static void epoch_claim_slot(void);
+static void epoch_make_key(void);
+static void epoch_release_slot(void *slot);
+static void epoch_try_advance(void);
+static void epoch_free_list(int list);
+
+/**
+ * Starts a read-side critical section, pointers read from the arrays stay valid until `epoch_exit()`.
+ *
+ * Never blocks. Sections may nest, only the outermost one counts.
+ */
+void epoch_enter(void) {
+    if (reader_depth++ > 0) return;
+
+    if (reader_slot < 0) {
+        epoch_claim_slot();
+    }
+
+    // Announce the epoch before loading any pointer, and read it again in case it moved meanwhile
+    uint64_t epoch;
+    do {
+        epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&reader_epochs[reader_slot], epoch, __ATOMIC_SEQ_CST);
+    } while (epoch != __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST));
+}
+
+/**
+ * Ends a read-side critical section started by `epoch_enter()`.
+ */
+void epoch_exit(void) {
+    assert(reader_depth > 0);
+    if (--reader_depth > 0) return;
+    __atomic_store_n(&reader_epochs[reader_slot], 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Hands an object that was unlinked from a shared array over to be freed once no reader can see it.
+ *
+ * @param[in] ptr     The unlinked object.
+ * @param[in] destroy Function that frees it.
+ */
+void epoch_retire(void *ptr, void (*destroy)(void *)) {
+    Retired *node = malloc(sizeof(Retired));
+    assert(node != NULL);
+    node->ptr = ptr;
+    node->destroy = destroy;
+
+    pthread_mutex_lock(&retired_mutex);
+    int list = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST) % EPOCH_LISTS;
+    node->next = retired[list];
+    retired[list] = node;
+    epoch_try_advance();
+    pthread_mutex_unlock(&retired_mutex);
+}
+
+/**
+ * Waits until every reader that was reading when this was called has finished.
+ *
+ * Only writers wait, readers keep going. Must not be called inside a read-side critical section.
+ */
+void epoch_synchronize(void) {
+    assert(reader_depth == 0);
+    uint64_t start = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+
+    // Two advances push out every reader that announced the starting epoch or the one before
+    while (__atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST) < start + 2) {
+        pthread_mutex_lock(&retired_mutex);
+        epoch_try_advance();
+        pthread_mutex_unlock(&retired_mutex);
+
+        if (__atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST) < start + 2) {
+            usleep(1000);
+        }
+    }
+}
+
+/**
+ * Frees every retired object. Only safe once no thread reads the arrays anymore, of any manager:
+ * the lists are shared by every manager of the process.
+ */
+void epoch_clean(void) {
+    pthread_mutex_lock(&retired_mutex);
+    for (int list = 0; list < EPOCH_LISTS; list++) {
+        epoch_free_list(list);
+    }
+    pthread_mutex_unlock(&retired_mutex);
+}
+
+/**
+ * Local helper that claims a free reader slot for the calling thread, released again when it exits.
+ */
+static void epoch_claim_slot(void) {
+    for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+        int unclaimed = 0;
+        if (__atomic_compare_exchange_n(&reader_claimed[i], &unclaimed, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            reader_slot = i;
+            break;
+        }
+    }
+    assert(reader_slot >= 0);
+
+    // Writers only scan the slots that were ever claimed
+    int readers = __atomic_load_n(&n_readers, __ATOMIC_SEQ_CST);
+    while (readers <= reader_slot &&
+           !__atomic_compare_exchange_n(&n_readers, &readers, reader_slot + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    }
+
+    pthread_once(&reader_key_once, epoch_make_key);
+    pthread_setspecific(reader_key, (void *)(intptr_t)(reader_slot + 1));
+}
+
+/**
+ * Local helper that creates the key whose destructor releases a thread's slot.
+ */
+static void epoch_make_key(void) {
+    pthread_key_create(&reader_key, epoch_release_slot);
+}
+
+/**
+ * Local helper run when a thread that claimed a slot exits.
+ *
+ * @param[in] slot The slot index plus one, as stored with the key.
+ */
+static void epoch_release_slot(void *slot) {
+    int i = (int)(intptr_t)slot - 1;
+    __atomic_store_n(&reader_epochs[i], 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&reader_claimed[i], 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Local helper that advances the global epoch if every active reader has announced it, then frees
+ * the objects retired two epochs ago. Must be called while holding `retired_mutex`.
+ */
+static void epoch_try_advance(void) {
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    int readers = __atomic_load_n(&n_readers, __ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < readers && i < EPOCH_MAX_READERS; i++) {
+        uint64_t announced = __atomic_load_n(&reader_epochs[i], __ATOMIC_SEQ_CST);
+        if (announced != 0 && announced != epoch) return;
+    }
+
+    __atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    epoch_free_list((epoch + 2) % EPOCH_LISTS);
+}
+
+/**
+ * Local helper that frees one list of retired objects. Must be called while holding `retired_mutex`.
+ *
+ * @param[in] list Index of the list to free.
+ */
+static void epoch_free_list(int list) {
+    Retired *node = retired[list];
+    while (node != NULL) {
+        Retired *next = node->next;
+        node->destroy(node->ptr);
+        free(node);
+        node = next;
+    }
+    retired[list] = NULL;
+}
@@ -2,6 +2,14 @@
  * event.c 
  * Contains functionality for events and event queues.
  * Event queues pop from the head and push into priority order, highest priority at the beginning.
+ *
+ * With EVENT_AGING, priority order is relaxed into earliest deadline first: an event is due
+ * PARAM_AGING_* pushes after its own, depending on its class, and the queue is kept in deadline
+ * order. Higher classes get shorter deadlines and still go first, but an event can only be passed
+ * by that many later events, so a stream of PRIORITY_HIGH events no longer starves the rest.
+ * Deadlines count pushes rather than time, so a replayed log pops in the same order it was recorded.
+ *
+ * With EVENT_RING, every pushed event is also published to the queue's ring for the observers.
  ***************************************************************/
 
 #include <stdlib.h>
@@ -9,6 +17,11 @@
 #include <assert.h>
 #include "defs.h"
 
+// Later events that may pass an event of each class, indexed like `EventQueue.latency`
+static const int event_budgets[EVENT_CLASSES] = {PARAM_AGING_HIGH, PARAM_AGING_MED, PARAM_AGING_LOW, PARAM_AGING_IGN};
+
+static int event_class(int priority);
+
 /**
  * Initializes an `Event` structure.
  *
@@ -34,9 +47,12 @@ void event_init(Event *event, System *system, Resource *resource, int status) {
 void event_queue_init(EventQueue *queue) {
     assert(queue != NULL);
     queue->head = NULL;
+    queue->pushes = 0;
+    memset(queue->latency, 0, sizeof(queue->latency));
+    queue->ring = NULL;
 
     // Initialize the semaphore
-    int result = sem_init(&queue->mutex, 0, 1);
+    int result = sem_init(&queue->mutex, sim_pshared(), 1);
     assert(result == 0); // Check if the semaphore was initialized successfully
 }
 
@@ -55,7 +71,7 @@ void event_queue_clean(EventQueue *queue) {
         // Free all nodes in the linked list
         while (current != NULL) {
             EventNode *next = current->next;
-            free(current);
+            sim_free(current);
             current = next;
         }
         
@@ -67,7 +83,8 @@ void event_queue_clean(EventQueue *queue) {
 /**
  * Pushes an `Event` onto the `EventQueue`.
  *
- * Adds the event to the queue in a thread-safe manner, maintaining priority order (highest first).
+ * Adds the event to the queue in a thread-safe manner, maintaining priority order (highest first),
+ * or deadline order with EVENT_AGING. Also publishes it to the queue's ring if it has one.
  *
  * @param[in,out] queue  Pointer to the `EventQueue`.
  * @param[in]     event  Pointer to the `Event` to push onto the queue.
@@ -75,16 +92,26 @@ void event_queue_clean(EventQueue *queue) {
 void event_queue_push(EventQueue *queue, const Event *event) {
     assert(queue != NULL);
     assert(event != NULL);
+
+    // The observers read the ring at their own pace, outside of the queue's semaphore
+    if (queue->ring != NULL) {
+        event_ring_publish(queue->ring, event);
+    }
     
     // Acquire the semaphore
     sem_wait(&queue->mutex);
+    record_event(RECORD_PUSH, event);
 
     // Create a new node
-    EventNode *new_node = (EventNode *)malloc(sizeof(EventNode));
+    EventNode *new_node = (EventNode *)sim_alloc(sizeof(EventNode));
     assert(new_node != NULL);
     
     // Copy the event data
     new_node->event = *event;
+    new_node->pushed = queue->pushes++;
+    new_node->deadline = new_node->pushed + event_budgets[event_class(event->priority)];
+    new_node->passed = 0;
+    new_node->pushed_ms = quiescence_now_ms();
     new_node->next = NULL;
     
     // If queue is empty, make this the head
@@ -96,13 +123,13 @@ void event_queue_push(EventQueue *queue, const Event *event) {
         return;
     }
     
-    // Find the correct position to insert based on priority
-    // Higher priority values come first, same priority maintains order (FIFO)
+    // Find the correct position to insert based on priority, or on deadline with aging
+    // Higher priority values (earlier deadlines) come first, same priority (deadline) maintains order (FIFO)
     EventNode *current = queue->head;
     EventNode *prev = NULL;
     
-    // Traverse until we find a node with lower priority
-    while (current != NULL && current->event.priority >= event->priority) {
+    // Traverse until we find a node with lower priority (a later deadline)
+    while (current != NULL && (EVENT_AGING ? current->deadline <= new_node->deadline : current->event.priority >= event->priority)) {
         prev = current;
         current = current->next;
     }
@@ -125,7 +152,7 @@ void event_queue_push(EventQueue *queue, const Event *event) {
 /**
  * Pops an `Event` from the `EventQueue`.
  *
- * Removes the highest priority event from the queue in a thread safe manner and returns it.
+ * Removes the highest priority event (earliest deadline) from the queue in a thread safe manner and returns it.
  *
  * @param[in,out] queue  Pointer to the `EventQueue`.
  * @param[out]    event  Pointer to the `Event` to fill with the popped data.
@@ -149,15 +176,114 @@ int event_queue_pop(EventQueue *queue, Event* event) {
     
     // Copy the event data
     *event = head_node->event;
+    record_event(RECORD_POP, event);
     
+    // Account for how long it waited
+    EventLatency *latency = &queue->latency[event_class(event->priority)];
+    long waited_ms = quiescence_now_ms() - head_node->pushed_ms;
+    latency->popped++;
+    latency->total_ms += waited_ms;
+    if (waited_ms > latency->max_ms) latency->max_ms = waited_ms;
+    if (head_node->passed > latency->max_passed) latency->max_passed = head_node->passed;
+
     // Update head to next node
     queue->head = head_node->next;
+
+    // Every event still waiting that was pushed earlier has just been passed, a walk like the one of a push
+    for (EventNode *node = queue->head; node != NULL; node = node->next) {
+        if (node->pushed < head_node->pushed) node->passed++;
+    }
     
     // Free the old head node
-    free(head_node);
+    sim_free(head_node);
     
     // Release the semaphore
     sem_post(&queue->mutex);
     
     return 1;
 }
+
+/**
+ * Discards every queued `Event` from a system or about a resource, so neither is referenced once freed.
+ * If the queue has a ring, also waits until no observer can read such an event from it.
+ *
+ * @param[in,out] queue    Pointer to the `EventQueue`.
+ * @param[in]     system   Pointer to the `System` whose events are discarded, NULL for none.
+ * @param[in]     resource Pointer to the `Resource` whose events are discarded, NULL for none.
+ * @return The number of events discarded.
+ */
+int event_queue_discard(EventQueue *queue, const System *system, const Resource *resource) {
+    int discarded = 0;
+    assert(queue != NULL);
+
+    sem_wait(&queue->mutex);
+
+    EventNode **link = &queue->head;
+    while (*link != NULL) {
+        EventNode *node = *link;
+        if ((system != NULL && node->event.system == system) || (resource != NULL && node->event.resource == resource)) {
+            *link = node->next;
+            sim_free(node);
+            discarded++;
+        } else {
+            link = &node->next;
+        }
+    }
+
+    sem_post(&queue->mutex);
+
+    if (queue->ring != NULL) {
+        event_ring_synchronize(queue->ring);
+    }
+    return discarded;
+}
+
+/**
+ * Copies how long the events of each priority class waited in the queue so far.
+ *
+ * @param[in,out] queue   Pointer to the `EventQueue`.
+ * @param[out]    latency Array of EVENT_CLASSES `EventLatency`, for high, medium, low and ignored events.
+ */
+void event_queue_latency(EventQueue *queue, EventLatency *latency) {
+    sem_wait(&queue->mutex);
+    memcpy(latency, queue->latency, sizeof(queue->latency));
+    sem_post(&queue->mutex);
+}
+
+/**
+ * Prints how long the events of each priority class waited in the queue, and how many later events
+ * passed one of them at most next to how many could, the bound aging puts on their wait.
+ *
+ * @param[in,out] queue Pointer to the `EventQueue`.
+ */
+void event_queue_report(EventQueue *queue) {
+    static const char *names[EVENT_CLASSES] = {"High", "Medium", "Low", "Ignored"};
+    EventLatency latency[EVENT_CLASSES];
+
+    event_queue_latency(queue, latency);
+    printf("Event queue latency (%s):\n", EVENT_AGING ? "earliest deadline first" : "strict priority");
+    for (int c = 0; c < EVENT_CLASSES; c++) {
+        if (latency[c].popped == 0) continue;
+        printf("  %-8s %6ld popped, mean %7.1f ms, max %6ld ms, passed by at most %4ld later events, ", names[c], latency[c].popped,
+            (double)latency[c].total_ms / latency[c].popped, latency[c].max_ms, latency[c].max_passed);
+        if (EVENT_AGING) {
+            printf("bound %d\n", event_budgets[c]);
+        } else {
+            printf("no bound\n");
+        }
+    }
+}
+
+/**
+ * Local helper that maps a priority to its class in the latency metrics.
+ *
+ * @return 0 for PRIORITY_HIGH, 1 for PRIORITY_MED, 2 for PRIORITY_LOW and 3 for anything else.
+ */
+static int event_class(int priority) {
+    switch (priority) {
+        case PRIORITY_HIGH: return 0;
+        case PRIORITY_MED:  return 1;
+        case PRIORITY_LOW:  return 2;
+        default:            return 3;
+    }
+}
@@ -0,0 +1,378 @@
+/***************************************************************
+ * fluid.c
+ * Contains the continuous fluid-approximation engine.
+ * Instead of running discrete cycles, every system is treated as a constant flow of
+ * its input and output resources, and resource levels are integrated with a fixed-step solver.
+ * Mode switches happen on threshold crossings detected between steps, using the same
+ * decisions as `manager_run()`.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#include <sys/time.h>
+
+#define FLUID_LANES 8                               // Floats per SIMD vector
+#define FLUID_ALIGN (FLUID_LANES * sizeof(float))   // Alignment of all per-system arrays
+
+// GCC vector extension, compiled to whatever SIMD the target supports
+typedef float fluid_vec __attribute__((vector_size(FLUID_ALIGN)));
+
+// Structure-of-arrays copy of the simulation used by the solver
+typedef struct FluidModel {
+    int n_systems;      // Number of systems in the model
+    int padded;         // `n_systems` rounded up to a whole number of vectors
+    int n_resources;    // Number of resources in the model
+
+    // Per-system arrays, padded with zero rates so vector loops never need a tail
+    float *rate_in;     // Input consumed per millisecond in the current mode
+    float *rate_out;    // Output produced per millisecond in the current mode
+    float *want_in;     // Scratch: input wanted during the current step
+    float *want_out;    // Scratch: output offered during the current step
+    float *fraction;    // Scratch: fraction of the wanted flow that can run this step
+    int *input;         // Resource index of the input, -1 for none
+    int *output;        // Resource index of the output, -1 for none
+    int *mode;          // Current mode of the system
+
+    // Per-resource arrays
+    float *level;       // Current amount in storage
+    float *capacity;    // Maximum capacity
+    float *limit_in;    // Scratch: fraction of the demand that storage can satisfy
+    float *limit_out;   // Scratch: fraction of the supply that storage has room for
+    int *full;          // Whether the resource was at capacity after the previous step
+
+    // Thresholds on every system's input level, classified in one batch per step
+    ThresholdBatch thresholds;
+
+    // Producers of each resource in CSR form, so mode switches never scan every system
+    int *producer_start;
+    int *producers;
+
+    int running;        // Cleared when the manager's policy terminates the simulation
+    const char *cause;  // Why the simulation terminated
+} FluidModel;
+
+static void *fluid_alloc(int count, size_t size);
+static void fluid_build(FluidModel *model, Manager *manager);
+static void fluid_free(FluidModel *model);
+static void fluid_set_mode(FluidModel *model, const Manager *manager, int i, int mode);
+static void fluid_step(FluidModel *model, float dt);
+static void fluid_detect_crossings(FluidModel *model, Manager *manager);
+static void fluid_apply_event(FluidModel *model, Manager *manager, int system, int resource, int status);
+
+/**
+ * Runs the simulation with the fluid-approximation engine.
+ *
+ * Integrates resource levels until the manager's policy terminates the flight or
+ * `PARAM_FLUID_HORIZON` simulated milliseconds pass, then writes the final levels and modes back
+ * into the manager's resources and systems.
+ *
+ * @param[in,out] manager  Pointer to the `Manager` containing the systems and resources to simulate.
+ */
+void fluid_run(Manager *manager) {
+    FluidModel model;
+    struct timeval start, end;
+    long steps = 0;
+    double sim_ms = 0, wall_s;
+
+    fluid_build(&model, manager);
+    gettimeofday(&start, NULL);
+
+    while (model.running && sim_ms < PARAM_FLUID_HORIZON) {
+        fluid_step(&model, PARAM_FLUID_STEP);
+        fluid_detect_crossings(&model, manager);
+        sim_ms += PARAM_FLUID_STEP;
+        steps++;
+    }
+
+    gettimeofday(&end, NULL);
+    wall_s = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+
+    // Copy the final state back so the usual reporting works
+    for (int r = 0; r < model.n_resources; r++) {
+        manager->resources.resources[r]->amount = (int)model.level[r];
+    }
+    for (int i = 0; i < model.n_systems; i++) {
+        system_set_mode(manager->system_array.systems[i], model.mode[i]);
+    }
+    manager->simulation_running = 0;
+
+    printf("Fluid engine: %d systems, %d resources, %ld steps of %d ms\n",
+        model.n_systems, model.n_resources, steps, PARAM_FLUID_STEP);
+    printf("Fluid engine: simulated %.1f s in %.3f s (%.1fx real time), %s.\n",
+        sim_ms / 1000.0, wall_s, wall_s > 0 ? sim_ms / 1000.0 / wall_s : 0.0,
+        model.cause ? model.cause : "horizon reached");
+
+    fluid_free(&model);
+}
+
+/**
+ * Local helper that allocates a zeroed, vector aligned array padded to a whole number of vectors.
+ *
+ * @param[in] count Number of elements.
+ * @param[in] size  Size of one element in bytes.
+ * @return Pointer to the new array.
+ */
+static void *fluid_alloc(int count, size_t size) {
+    size_t bytes = ((count * size + FLUID_ALIGN - 1) / FLUID_ALIGN + 1) * FLUID_ALIGN;
+    void *array = aligned_alloc(FLUID_ALIGN, bytes);
+    assert(array != NULL);
+    memset(array, 0, bytes);
+    return array;
+}
+
+/**
+ * Local helper that copies the manager's systems and resources into a `FluidModel`.
+ *
+ * @param[out] model   Pointer to the `FluidModel` to build.
+ * @param[in]  manager Pointer to the `Manager` to copy from.
+ */
+static void fluid_build(FluidModel *model, Manager *manager) {
+    int n = manager->system_array.size;
+    int r_count = manager->resources.size;
+
+    model->n_systems = n;
+    model->padded = (n + FLUID_LANES - 1) / FLUID_LANES * FLUID_LANES;
+    model->n_resources = r_count;
+    model->running = 1;
+    model->cause = NULL;
+
+    model->rate_in   = fluid_alloc(model->padded, sizeof(float));
+    model->rate_out  = fluid_alloc(model->padded, sizeof(float));
+    model->want_in   = fluid_alloc(model->padded, sizeof(float));
+    model->want_out  = fluid_alloc(model->padded, sizeof(float));
+    model->fraction  = fluid_alloc(model->padded, sizeof(float));
+    model->input     = fluid_alloc(model->padded, sizeof(int));
+    model->output    = fluid_alloc(model->padded, sizeof(int));
+    model->mode      = fluid_alloc(model->padded, sizeof(int));
+    threshold_batch_init(&model->thresholds, n);
+
+    model->level     = fluid_alloc(r_count, sizeof(float));
+    model->capacity  = fluid_alloc(r_count, sizeof(float));
+    model->limit_in  = fluid_alloc(r_count, sizeof(float));
+    model->limit_out = fluid_alloc(r_count, sizeof(float));
+    model->full      = fluid_alloc(r_count, sizeof(int));
+    model->producer_start = fluid_alloc(r_count + 1, sizeof(int));
+    model->producers = fluid_alloc(n, sizeof(int));
+
+    for (int r = 0; r < r_count; r++) {
+        Resource *resource = manager->resources.resources[r];
+        model->level[r] = resource->amount;
+        model->capacity[r] = resource->max_capacity;
+        model->full[r] = resource->amount >= resource->max_capacity;
+    }
+
+    for (int i = 0; i < n; i++) {
+        System *system = manager->system_array.systems[i];
+        model->input[i]  = system->recipe->input  ? system->recipe->input->id  : -1;
+        model->output[i] = system->recipe->output ? system->recipe->output->id : -1;
+        threshold_batch_set(&model->thresholds, i, model->input[i] >= 0 ? system->recipe->input_amount : -1);
+        fluid_set_mode(model, manager, i, system_get_mode(system));
+
+        // Count producers per resource, turned into offsets below
+        if (model->output[i] >= 0) model->producer_start[model->output[i] + 1]++;
+    }
+
+    for (int r = 0; r < r_count; r++) {
+        model->producer_start[r + 1] += model->producer_start[r];
+    }
+    int *fill = fluid_alloc(r_count, sizeof(int));
+    for (int i = 0; i < n; i++) {
+        int r = model->output[i];
+        if (r >= 0) model->producers[model->producer_start[r] + fill[r]++] = i;
+    }
+    free(fill);
+}
+
+/**
+ * Local helper that frees all arrays of a `FluidModel`.
+ *
+ * @param[in,out] model Pointer to the `FluidModel` to free.
+ */
+static void fluid_free(FluidModel *model) {
+    free(model->rate_in);
+    free(model->rate_out);
+    free(model->want_in);
+    free(model->want_out);
+    free(model->fraction);
+    free(model->input);
+    free(model->output);
+    free(model->mode);
+    threshold_batch_clean(&model->thresholds);
+    free(model->level);
+    free(model->capacity);
+    free(model->limit_in);
+    free(model->limit_out);
+    free(model->full);
+    free(model->producer_start);
+    free(model->producers);
+}
+
+/**
+ * Local helper that sets a system's mode and recomputes its flow rates.
+ *
+ * One cycle of a system takes its mode-adjusted processing time plus the `PARAM_SYSTEM_WAIT` pause
+ * between loops, so the continuous rate is the recipe amount divided by that cycle time.
+ *
+ * @param[in,out] model   Pointer to the `FluidModel`.
+ * @param[in]     manager Pointer to the `Manager` holding the system's recipe.
+ * @param[in]     i       Index of the system.
+ * @param[in]     mode    The new mode of the system.
+ */
+static void fluid_set_mode(FluidModel *model, const Manager *manager, int i, int mode) {
+    const Recipe *recipe = manager->system_array.systems[i]->recipe;
+    float cycle;
+
+    model->mode[i] = mode;
+    switch (mode) {
+        case MODE_SLOW:
+            cycle = recipe->processing_time * 4;
+            break;
+        case MODE_FAST:
+            cycle = recipe->processing_time / 4;
+            break;
+        case MODE_STANDARD:
+            cycle = recipe->processing_time;
+            break;
+        default:
+            // Disabled and terminated systems do not flow at all
+            model->rate_in[i] = 0;
+            model->rate_out[i] = 0;
+            return;
+    }
+    cycle += PARAM_SYSTEM_WAIT;
+
+    model->rate_in[i]  = model->input[i]  >= 0 ? recipe->input_amount  / cycle : 0;
+    model->rate_out[i] = model->output[i] >= 0 ? recipe->output_amount / cycle : 0;
+}
+
+/**
+ * Local helper that integrates every resource level over one step.
+ *
+ * Flows are computed with vector kernels over the per-system arrays. A system only runs as much of
+ * its flow as both its input (level available) and its output (room left) allow during the step.
+ *
+ * @param[in,out] model Pointer to the `FluidModel` to advance.
+ * @param[in]     dt    Step size in milliseconds.
+ */
+static void fluid_step(FluidModel *model, float dt) {
+    int i, r;
+
+    // Wanted flows for the whole step
+    for (i = 0; i < model->padded; i += FLUID_LANES) {
+        *(fluid_vec *)&model->want_in[i]  = *(fluid_vec *)&model->rate_in[i]  * dt;
+        *(fluid_vec *)&model->want_out[i] = *(fluid_vec *)&model->rate_out[i] * dt;
+    }
+
+    // Total demand and supply per resource, reusing the limit arrays as accumulators
+    memset(model->limit_in, 0, model->n_resources * sizeof(float));
+    memset(model->limit_out, 0, model->n_resources * sizeof(float));
+    for (i = 0; i < model->n_systems; i++) {
+        if (model->input[i] >= 0)  model->limit_in[model->input[i]]   += model->want_in[i];
+        if (model->output[i] >= 0) model->limit_out[model->output[i]] += model->want_out[i];
+    }
+
+    // Turn the totals into the fraction each resource can satisfy
+    for (r = 0; r < model->n_resources; r++) {
+        float room = model->capacity[r] - model->level[r];
+        model->limit_in[r]  = model->limit_in[r]  > model->level[r] ? model->level[r] / model->limit_in[r] : 1.0f;
+        model->limit_out[r] = model->limit_out[r] > room ? room / model->limit_out[r] : 1.0f;
+    }
+
+    // Each system runs at the tighter of its input and output limits
+    for (i = 0; i < model->n_systems; i++) {
+        float in_limit  = model->input[i]  >= 0 ? model->limit_in[model->input[i]]   : 1.0f;
+        float out_limit = model->output[i] >= 0 ? model->limit_out[model->output[i]] : 1.0f;
+        model->fraction[i] = in_limit < out_limit ? in_limit : out_limit;
+    }
+    for (i = 0; i < model->padded; i += FLUID_LANES) {
+        *(fluid_vec *)&model->want_in[i]  *= *(fluid_vec *)&model->fraction[i];
+        *(fluid_vec *)&model->want_out[i] *= *(fluid_vec *)&model->fraction[i];
+    }
+
+    // Apply the flows
+    for (i = 0; i < model->n_systems; i++) {
+        if (model->input[i] >= 0)  model->level[model->input[i]]  -= model->want_in[i];
+        if (model->output[i] >= 0) model->level[model->output[i]] += model->want_out[i];
+    }
+    for (r = 0; r < model->n_resources; r++) {
+        if (model->level[r] < 0) model->level[r] = 0;
+        if (model->level[r] > model->capacity[r]) model->level[r] = model->capacity[r];
+    }
+}
+
+/**
+ * Local helper that looks for threshold crossings since the previous step and reports them.
+ *
+ * Mirrors the events of the threaded engine: a system reports INSUFFICIENT, LOW or HIGH when its input
+ * level enters that band, and a resource reaching capacity is reported as CAPACITY by its producers.
+ *
+ * @param[in,out] model   Pointer to the `FluidModel`.
+ * @param[in,out] manager Pointer to the `Manager` whose policy decides the mode switches.
+ */
+static void fluid_detect_crossings(FluidModel *model, Manager *manager) {
+    ThresholdBatch *batch = &model->thresholds;
+    static const int events[] = {
+        [THRESHOLD_LOW] = EVENT_LOW, [THRESHOLD_INSUFFICIENT] = EVENT_INSUFFICIENT, [THRESHOLD_HIGH] = EVENT_HIGH
+    };
+
+    // Gather every system's input level and classify them all at once
+    for (int i = 0; i < model->n_systems; i++) {
+        batch->amount[i] = model->input[i] >= 0 ? model->level[model->input[i]] : 0;
+    }
+
+    if (threshold_batch_classify(batch) > 0) {
+        // Only visit the systems whose classification changed
+        for (int w = 0; w < batch->words && model->running; w++) {
+            uint64_t bits = batch->changed[w];
+            while (bits != 0 && model->running) {
+                int i = w * 64 + __builtin_ctzll(bits);
+                int status = batch->status[i];
+                bits &= bits - 1;
+
+                if (status == THRESHOLD_OK || model->mode[i] == MODE_TERMINATE || model->mode[i] == MODE_DISABLED) continue;
+                fluid_apply_event(model, manager, i, model->input[i], events[status]);
+            }
+        }
+    }
+
+    for (int r = 0; r < model->n_resources && model->running; r++) {
+        int full = model->level[r] >= model->capacity[r];
+        int first = model->producer_start[r];
+
+        if (full && !model->full[r] && first < model->producer_start[r + 1]) {
+            fluid_apply_event(model, manager, model->producers[first], r, EVENT_CAPACITY);
+        }
+        model->full[r] = full;
+    }
+}
+
+/**
+ * Local helper that applies the manager's decision for a single event.
+ *
+ * @param[in,out] model    Pointer to the `FluidModel`.
+ * @param[in,out] manager  Pointer to the `Manager` holding the systems and resources.
+ * @param[in]     system   Index of the system reporting the event.
+ * @param[in]     resource Index of the resource the event is about.
+ * @param[in]     status   Status code of the event.
+ */
+static void fluid_apply_event(FluidModel *model, Manager *manager, int system, int resource, int status) {
+    Event event;
+    int mode;
+
+    event_init(&event, manager->system_array.systems[system], manager->resources.resources[resource], status);
+    mode = manager_decide_mode(&event);
+
+    if (mode == MODE_TERMINATE) {
+        model->cause = status == EVENT_INSUFFICIENT ? "oxygen depleted" : "destination reached";
+        model->running = 0;
+        for (int i = 0; i < model->n_systems; i++) {
+            fluid_set_mode(model, manager, i, MODE_TERMINATE);
+        }
+        return;
+    }
+
+    for (int p = model->producer_start[resource]; p < model->producer_start[resource + 1]; p++) {
+        int i = model->producers[p];
+        if (model->mode[i] != MODE_TERMINATE && system_mode_applies(model->mode[i], mode)) fluid_set_mode(model, manager, i, mode);
+    }
+}
@@ -0,0 +1,139 @@
+/***************************************************************
+ * forecast.c
+ * Contains the time-to-empty and time-to-full forecaster of a resource.
+ * Keeps a least-squares line through the resource's amount after its most recent transfers,
+ * at most `FORECAST_WINDOW` of them and none older than `PARAM_FORECAST_SPAN`. The sums behind
+ * the line are updated as samples enter and leave the window, so adding a sample and reading
+ * a forecast are O(1) and no history is ever rescanned, except to shed rounding errors.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+
+static void forecast_drop_oldest(Forecast *forecast);
+static void forecast_resum(Forecast *forecast);
+
+/**
+ * Initializes a `Forecast` with the resource's starting amount.
+ *
+ * @param[out] forecast Pointer to the `Forecast` to initialize.
+ * @param[in]  now_ms   Current simulated time in milliseconds.
+ * @param[in]  level    Current amount of the resource.
+ */
+void forecast_init(Forecast *forecast, long now_ms, int level) {
+    memset(forecast, 0, sizeof(Forecast));
+    forecast->base_ms = now_ms;
+    forecast_add(forecast, now_ms, level);
+}
+
+/**
+ * Adds the resource's amount after a transfer. Must be called while holding the resource's mutex.
+ *
+ * @param[in,out] forecast Pointer to the `Forecast`.
+ * @param[in]     now_ms   Current simulated time in milliseconds.
+ * @param[in]     level    Amount of the resource after the transfer.
+ */
+void forecast_add(Forecast *forecast, long now_ms, int level) {
+    // Expire samples that fell out of the window, at most one per sample added on average
+    while (forecast->size > 0 && (forecast->size == FORECAST_WINDOW ||
+           now_ms - forecast->times[forecast->head] > PARAM_FORECAST_SPAN)) {
+        forecast_drop_oldest(forecast);
+    }
+
+    int slot = (forecast->head + forecast->size) % FORECAST_WINDOW;
+    double t = (now_ms - forecast->base_ms) / 1000.0;
+    forecast->times[slot] = now_ms;
+    forecast->levels[slot] = level;
+    forecast->size++;
+    forecast->sum_t += t;
+    forecast->sum_y += level;
+    forecast->sum_tt += t * t;
+    forecast->sum_ty += t * level;
+
+    // Adding and subtracting accumulates rounding errors, start over from the samples once per window
+    if (++forecast->updates >= FORECAST_WINDOW) {
+        forecast_resum(forecast);
+    }
+}
+
+/**
+ * Returns the net flow of the resource, the slope of the line through the window.
+ *
+ * @param[in] forecast Pointer to the `Forecast`.
+ * @return Change in amount per simulated second, 0 with fewer than two distinct sample times.
+ */
+double forecast_rate(const Forecast *forecast) {
+    double n = forecast->size;
+    double denominator = n * forecast->sum_tt - forecast->sum_t * forecast->sum_t;
+
+    // Denominator is n^2 times the variance of the sample times, tiny when they (nearly) coincide
+    if (forecast->size < 2 || denominator <= 1e-9 * n * n) {
+        return 0;
+    }
+    return (n * forecast->sum_ty - forecast->sum_t * forecast->sum_y) / denominator;
+}
+
+/**
+ * Forecasts when the resource runs out at its current net flow.
+ *
+ * @param[in] forecast Pointer to the `Forecast`.
+ * @param[in] level    Current amount of the resource.
+ * @return Simulated milliseconds until the resource is empty, -1 if it is not being drained.
+ */
+long forecast_time_to_empty(const Forecast *forecast, int level) {
+    double rate = forecast_rate(forecast);
+    if (rate >= 0) return -1;
+    return level <= 0 ? 0 : (long)(level / -rate * 1000.0);
+}
+
+/**
+ * Forecasts when the resource reaches its capacity at its current net flow.
+ *
+ * @param[in] forecast Pointer to the `Forecast`.
+ * @param[in] level    Current amount of the resource.
+ * @param[in] capacity Maximum capacity of the resource.
+ * @return Simulated milliseconds until the resource is full, -1 if it is not filling up.
+ */
+long forecast_time_to_full(const Forecast *forecast, int level, int capacity) {
+    double rate = forecast_rate(forecast);
+    if (rate <= 0) return -1;
+    return level >= capacity ? 0 : (long)((capacity - level) / rate * 1000.0);
+}
+
+/**
+ * Local helper that removes the oldest sample from the window.
+ *
+ * @param[in,out] forecast Pointer to the `Forecast` with at least one sample.
+ */
+static void forecast_drop_oldest(Forecast *forecast) {
+    double t = (forecast->times[forecast->head] - forecast->base_ms) / 1000.0;
+    int level = forecast->levels[forecast->head];
+
+    forecast->sum_t -= t;
+    forecast->sum_y -= level;
+    forecast->sum_tt -= t * t;
+    forecast->sum_ty -= t * level;
+    forecast->head = (forecast->head + 1) % FORECAST_WINDOW;
+    forecast->size--;
+}
+
+/**
+ * Local helper that recomputes the sums from the samples in the window.
+ *
+ * Also moves the time base to the oldest sample, so the sums stay small however long the flight.
+ *
+ * @param[in,out] forecast Pointer to the `Forecast`.
+ */
+static void forecast_resum(Forecast *forecast) {
+    forecast->base_ms = forecast->times[forecast->head];
+    forecast->sum_t = forecast->sum_y = forecast->sum_tt = forecast->sum_ty = 0;
+    for (int k = 0; k < forecast->size; k++) {
+        int slot = (forecast->head + k) % FORECAST_WINDOW;
+        double t = (forecast->times[slot] - forecast->base_ms) / 1000.0;
+        forecast->sum_t += t;
+        forecast->sum_y += forecast->levels[slot];
+        forecast->sum_tt += t * t;
+        forecast->sum_ty += t * forecast->levels[slot];
+    }
+    forecast->updates = 0;
+}
@@ -0,0 +1,261 @@
+/***************************************************************
+ * group.c
+ * Contains resource groups, several tanks of one resource used as one.
+ * A group is seen by systems, the manager and the display as a single `Resource`, its total, whose
+ * amount and capacity are the sums of its members'. Transfers with the total are passed on to the
+ * members picked by the group's policy; the members stay ordinary resources with amounts of their own.
+ *
+ * Every transfer with a member updates the group in O(log n): the total with an atomic add, and the
+ * group's own view of the member in two heaps (fullest and emptiest first) and two bitmaps (nearest
+ * tank with anything in it, nearest tank with room), so picking a tank never scans the members.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+
+#define GROUP_WORDS ((GROUP_MAX_MEMBERS + 63) / 64)  // Words of a member bitmap
+
+static int  group_select(ResourceGroup *group, int draw);
+static void group_sample(ResourceGroup *group);
+static void group_sift(int *heap, int *position, const int *keys, int n, int slot);
+static int  group_above(const int *keys, int a, int b);
+static void group_set_bit(uint64_t *bits, int member, int set);
+static int  group_first_bit(const uint64_t *bits);
+
+/**
+ * Creates an empty group and the resource standing for its total.
+ *
+ * @param[out] group  Pointer to the `ResourceGroup` to create, freed with its total.
+ * @param[out] total  Pointer to the `Resource` to create, to be added to storage in place of the tanks' resource.
+ * @param[in]  name   Name of the total, the name systems and the manager know the resource by.
+ * @param[in]  policy GROUP_FULLEST or GROUP_NEAREST.
+ */
+void group_create(ResourceGroup **group, Resource **total, const char *name, int policy) {
+    *group = (ResourceGroup *)sim_alloc(sizeof(ResourceGroup));
+    assert(*group != NULL);
+    memset(*group, 0, sizeof(ResourceGroup));
+    (*group)->policy = policy;
+
+    int result = sem_init(&(*group)->mutex, sim_pshared(), 1);
+    assert(result == 0); // Check if the semaphore was initialized successfully
+
+    resource_create(total, name, 0, 0);
+    (*total)->group = *group;
+    (*group)->total = *total;
+}
+
+/**
+ * Destroys a group, called when its total is destroyed. Its members are not freed.
+ *
+ * @param[in] group Pointer to the `ResourceGroup` to destroy.
+ */
+void group_destroy(ResourceGroup *group) {
+    if (group != NULL) {
+        sem_destroy(&group->mutex);
+        sim_free(group);
+    }
+}
+
+/**
+ * Adds a tank to a group, before the simulation starts or while holding `reconfig_lock()`.
+ *
+ * @param[in,out] group  Pointer to the `ResourceGroup`.
+ * @param[in,out] member Pointer to the `Resource` of the tank, in no other group. Tanks added first are nearest.
+ */
+void group_add(ResourceGroup *group, Resource *member) {
+    assert(group->n_members < GROUP_MAX_MEMBERS);
+    assert(member->member_of == NULL && member->group == NULL);
+
+    sem_wait(&member->mutex);
+    sem_wait(&group->mutex);
+
+    int i = group->n_members++;
+    group->members[i] = member;
+    group->amounts[i] = member->amount;
+    group->rooms[i] = member->max_capacity - member->amount;
+    group->draw_heap[i] = group->fill_heap[i] = i;
+    group->draw_position[i] = group->fill_position[i] = i;
+    group_sift(group->draw_heap, group->draw_position, group->amounts, group->n_members, i);
+    group_sift(group->fill_heap, group->fill_position, group->rooms, group->n_members, i);
+    group_set_bit(group->nonempty, i, member->amount > 0);
+    group_set_bit(group->nonfull, i, group->rooms[i] > 0);
+
+    __atomic_add_fetch(&group->total->amount, member->amount, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&group->total->max_capacity, member->max_capacity, __ATOMIC_SEQ_CST);
+    member->member_of = group;
+    member->info.member = i;
+
+    sem_post(&group->mutex);
+    sem_post(&member->mutex);
+}
+
+/**
+ * Tells the group a member's amount or capacity changed. Called by the member's transfers while
+ * holding the member's mutex, which is always taken before the group's.
+ *
+ * @param[in,out] group        Pointer to the `ResourceGroup`.
+ * @param[in]     member       Index of the member in the group.
+ * @param[in]     amount       The member's new amount.
+ * @param[in]     max_capacity The member's new capacity.
+ */
+void group_update(ResourceGroup *group, int member, int amount, int max_capacity) {
+    sem_wait(&group->mutex);
+
+    int room = max_capacity - amount;
+    int delta_amount = amount - group->amounts[member];
+    int delta_capacity = room + amount - group->rooms[member] - group->amounts[member];
+
+    group->amounts[member] = amount;
+    group->rooms[member] = room;
+    group_sift(group->draw_heap, group->draw_position, group->amounts, group->n_members, group->draw_position[member]);
+    group_sift(group->fill_heap, group->fill_position, group->rooms, group->n_members, group->fill_position[member]);
+    group_set_bit(group->nonempty, member, amount > 0);
+    group_set_bit(group->nonfull, member, room > 0);
+
+    __atomic_add_fetch(&group->total->amount, delta_amount, __ATOMIC_SEQ_CST);
+    if (delta_capacity != 0) __atomic_add_fetch(&group->total->max_capacity, delta_capacity, __ATOMIC_SEQ_CST);
+
+    sem_post(&group->mutex);
+}
+
+/**
+ * Draws from the group's tanks in the order of its policy until enough is drawn or every tank is empty.
+ *
+ * @param[in,out] group  Pointer to the `ResourceGroup`.
+ * @param[in,out] amount Pointer to the amount to draw, decreased by the amount that was drawn.
+ */
+void group_transfer_from(ResourceGroup *group, int *amount) {
+    // A tank another system empties first is passed over next time, each try takes something or ends it
+    for (int tries = 0; *amount > 0 && tries <= group->n_members; tries++) {
+        int member = group_select(group, 1);
+        if (member < 0) break;
+        resource_transfer_from(group->members[member], amount);
+    }
+    group_sample(group);
+}
+
+/**
+ * Fills the group's tanks in the order of its policy until all is stored or every tank is full.
+ *
+ * @param[in,out] group  Pointer to the `ResourceGroup`.
+ * @param[in,out] amount Pointer to the amount to store, decreased by the amount that was stored.
+ */
+void group_transfer_into(ResourceGroup *group, int *amount) {
+    for (int tries = 0; *amount > 0 && tries <= group->n_members; tries++) {
+        int member = group_select(group, 0);
+        if (member < 0) break;
+        resource_transfer_into(group->members[member], amount);
+    }
+    group_sample(group);
+}
+
+/**
+ * Changes which tanks the group draws from and fills first, takes effect with the next transfer.
+ *
+ * @param[in,out] group  Pointer to the `ResourceGroup`.
+ * @param[in]     policy GROUP_FULLEST or GROUP_NEAREST.
+ */
+void group_set_policy(ResourceGroup *group, int policy) {
+    __atomic_store_n(&group->policy, policy, __ATOMIC_RELAXED);
+}
+
+/**
+ * Local helper that picks the tank to draw from or fill next, from the group's view of its members.
+ *
+ * @param[in,out] group Pointer to the `ResourceGroup`.
+ * @param[in]     draw  1 to pick a tank to draw from, 0 to pick one to fill.
+ * @return Index of the member, -1 if every tank is empty (or full).
+ */
+static int group_select(ResourceGroup *group, int draw) {
+    int member = -1;
+    sem_wait(&group->mutex);
+
+    if (group->n_members > 0) {
+        if (__atomic_load_n(&group->policy, __ATOMIC_RELAXED) == GROUP_NEAREST) {
+            member = group_first_bit(draw ? group->nonempty : group->nonfull);
+        } else if (draw) {
+            member = group->amounts[group->draw_heap[0]] > 0 ? group->draw_heap[0] : -1;
+        } else {
+            member = group->rooms[group->fill_heap[0]] > 0 ? group->fill_heap[0] : -1;
+        }
+    }
+
+    sem_post(&group->mutex);
+    return member;
+}
+
+/**
+ * Local helper that adds the group's new total to the total's forecast and sketch.
+ */
+static void group_sample(ResourceGroup *group) {
+    Resource *total = group->total;
+    if ((!FORECAST_LEVELS || total->info.forecast == NULL) && (!SKETCH_LEVELS || total->info.sketch == NULL)) return;
+
+    sem_wait(&total->mutex);
+    int amount = __atomic_load_n(&total->amount, __ATOMIC_SEQ_CST);
+    if (total->info.forecast != NULL) forecast_add(total->info.forecast, quiescence_now_ms(), amount);
+    if (total->info.sketch != NULL) sketch_add(total->info.sketch, amount);
+    sem_post(&total->mutex);
+}
+
+/**
+ * Local helper that moves a member whose key changed to its place in an indexed max-heap.
+ *
+ * @param[in,out] heap     Members in heap order.
+ * @param[in,out] position Slot of each member in `heap`.
+ * @param[in]     keys     Key of each member.
+ * @param[in]     n        Number of members in the heap.
+ * @param[in]     slot     Slot of the member that changed.
+ */
+static void group_sift(int *heap, int *position, const int *keys, int n, int slot) {
+    int member = heap[slot];
+
+    while (slot > 0 && group_above(keys, member, heap[(slot - 1) / 2])) {
+        heap[slot] = heap[(slot - 1) / 2];
+        position[heap[slot]] = slot;
+        slot = (slot - 1) / 2;
+    }
+    for (;;) {
+        int child = 2 * slot + 1;
+        if (child >= n) break;
+        if (child + 1 < n && group_above(keys, heap[child + 1], heap[child])) child++;
+        if (!group_above(keys, heap[child], member)) break;
+        heap[slot] = heap[child];
+        position[heap[slot]] = slot;
+        slot = child;
+    }
+    heap[slot] = member;
+    position[member] = slot;
+}
+
+/**
+ * Local helper that orders two members in a heap: larger key first, then the nearer one.
+ *
+ * @return 1 if member `a` goes above member `b`, 0 otherwise.
+ */
+static int group_above(const int *keys, int a, int b) {
+    return keys[a] != keys[b] ? keys[a] > keys[b] : a < b;
+}
+
+/**
+ * Local helper that sets or clears a member's bit.
+ */
+static void group_set_bit(uint64_t *bits, int member, int set) {
+    if (set) {
+        bits[member / 64] |= 1ULL << (member % 64);
+    } else {
+        bits[member / 64] &= ~(1ULL << (member % 64));
+    }
+}
+
+/**
+ * Local helper that finds the nearest member with its bit set.
+ *
+ * @return Index of the member, -1 if no bit is set.
+ */
+static int group_first_bit(const uint64_t *bits) {
+    for (int word = 0; word < GROUP_WORDS; word++) {
+        if (bits[word] != 0) return word * 64 + __builtin_ctzll(bits[word]);
+    }
+    return -1;
+}
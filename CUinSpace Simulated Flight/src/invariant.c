@@ -0,0 +1,226 @@
+/***************************************************************
+ * invariant.c
+ * Contains the mass-conservation check of the running simulation.
+ * Every transfer adds what it moved to counters of the calling thread, one block of counters per
+ * thread so transfers on different CPUs never share a cache line: how much of each resource was
+ * produced into storage, consumed from it and discarded by a smaller capacity. Every resource must
+ * then hold what it started with, plus what was produced, minus what was consumed and discarded.
+ *
+ * A resource's counters only change while its mutex is held, in any thread's block, so the check
+ * takes each mutex once, adds up the blocks and compares: O(resources) for a fixed number of
+ * threads, without stopping the simulation. The first resource found off is reported, with the
+ * last system that moved it.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+
+#define INVARIANT_MAX_THREADS 64  // Threads with counters of their own, any more share the last block
+#define INVARIANT_KINDS       3   // INVARIANT_PRODUCED, INVARIANT_CONSUMED, INVARIANT_DISCARDED
+
+static int64_t invariant_counts[INVARIANT_MAX_THREADS][INVARIANT_MAX_RESOURCES][INVARIANT_KINDS];
+static int invariant_claimed[INVARIANT_MAX_THREADS];  // Whether a live thread owns the block
+static int n_blocks = 0;                              // Blocks ever used, the rest are all zero
+static pthread_key_t invariant_key;
+static pthread_once_t invariant_key_once = PTHREAD_ONCE_INIT;
+static __thread int invariant_block = -1;
+static __thread int invariant_system = -1;
+
+static long invariant_next_ms = 0;    // When the periodic check is due next, 0 before the first one
+static long invariant_checks = 0;     // Checks run so far
+static int invariant_reported = 0;    // Whether a violation was reported already, only the first one is
+
+static void invariant_claim_block(void);
+static void invariant_make_key(void);
+static void invariant_release_block(void *block);
+static int  invariant_check_resource(Manager *manager, Resource *resource);
+static int  invariant_check_group(ResourceGroup *group);
+
+/**
+ * Tells the checker which system the calling thread moves resources for, so a violation can name it.
+ *
+ * @param[in] system Id of the system, -1 for none.
+ */
+void invariant_attach(int system) {
+    invariant_system = system;
+}
+
+/**
+ * Counts an amount moved into or out of a resource. Must be called while holding the resource's
+ * mutex, or while no other thread moves anything.
+ *
+ * @param[in,out] resource The resource, its last system becomes the calling thread's.
+ * @param[in]     kind     INVARIANT_PRODUCED, INVARIANT_CONSUMED or INVARIANT_DISCARDED.
+ * @param[in]     moved    Amount actually moved.
+ */
+void invariant_transfer(Resource *resource, int kind, int moved) {
+    if (!INVARIANT_CHECK || resource->id < 0 || resource->id >= INVARIANT_MAX_RESOURCES) return;
+
+    if (invariant_block < 0) {
+        invariant_claim_block();
+    }
+    invariant_counts[invariant_block][resource->id][kind] += moved;
+    resource->last_system = invariant_system;
+}
+
+/**
+ * Checks every resource if `PARAM_INVARIANT_PERIOD` has passed since the last check.
+ *
+ * @param[in,out] manager Pointer to the running `Manager`.
+ * @param[in]     now_ms  Current simulated time, from `quiescence_now_ms()`.
+ */
+void invariant_poll(Manager *manager, long now_ms) {
+    if (!INVARIANT_CHECK || SHM_PROCESS_MODE) return;
+
+    if (invariant_next_ms == 0) {
+        invariant_next_ms = now_ms + PARAM_INVARIANT_PERIOD;
+    } else if (now_ms >= invariant_next_ms) {
+        invariant_next_ms = now_ms + PARAM_INVARIANT_PERIOD;
+        invariant_verify(manager);
+    }
+}
+
+/**
+ * Checks that every resource holds what it started with plus everything produced into it, minus
+ * everything consumed from it or discarded, and that every group's total is the sum of its tanks.
+ * Safe to call while the simulation runs. The first violation is printed, later ones are not.
+ *
+ * Counts are kept per process: systems run in other processes (`SHM_PROCESS_MODE`) are not seen.
+ *
+ * @param[in,out] manager Pointer to the `Manager` whose resources are checked.
+ * @return 0 if every resource is conserved, 1 otherwise.
+ */
+int invariant_verify(Manager *manager) {
+    int violated = 0;
+    if (!INVARIANT_CHECK || SHM_PROCESS_MODE) return 0;
+
+    epoch_enter();
+    for (int i = 0; i < storage_size(&manager->resources) && !violated; i++) {
+        Resource *resource = storage_get(&manager->resources, i);
+        if (resource == NULL) continue;
+
+        violated = resource->group != NULL ? invariant_check_group(resource->group) : invariant_check_resource(manager, resource);
+    }
+    epoch_exit();
+
+    __atomic_fetch_add(&invariant_checks, 1, __ATOMIC_RELAXED);
+    return violated;
+}
+
+/**
+ * Prints whether every check of the run held, once the simulation is over.
+ *
+ * @param[in,out] manager Pointer to the `Manager` that ran, checked one last time.
+ */
+void invariant_report(Manager *manager) {
+    if (!INVARIANT_CHECK || SHM_PROCESS_MODE) return;
+
+    int violated = invariant_verify(manager) || __atomic_load_n(&invariant_reported, __ATOMIC_SEQ_CST);
+    printf("Invariant: mass conservation %s over %ld check(s)\n", violated ? "VIOLATED" : "held",
+        __atomic_load_n(&invariant_checks, __ATOMIC_RELAXED));
+}
+
+/**
+ * Local helper that checks one resource's amount against its counters, reporting it if it is off
+ * and no violation was reported before.
+ *
+ * @return 1 if the resource is off, 0 otherwise.
+ */
+static int invariant_check_resource(Manager *manager, Resource *resource) {
+    int64_t moved[INVARIANT_KINDS] = {0};
+    if (resource->id >= INVARIANT_MAX_RESOURCES) return 0;
+
+    sem_wait(&resource->mutex);
+    int blocks = __atomic_load_n(&n_blocks, __ATOMIC_SEQ_CST);
+    for (int b = 0; b < blocks; b++) {
+        for (int k = 0; k < INVARIANT_KINDS; k++) {
+            moved[k] += invariant_counts[b][resource->id][k];
+        }
+    }
+    int64_t expected = resource->info.initial_amount + moved[INVARIANT_PRODUCED] - moved[INVARIANT_CONSUMED] - moved[INVARIANT_DISCARDED];
+    int amount = resource->amount;
+    int last_system = resource->last_system;
+    sem_post(&resource->mutex);
+
+    if (amount == expected) return 0;
+
+    // Only the first violation is reported, later ones are mostly its consequences
+    if (!__atomic_exchange_n(&invariant_reported, 1, __ATOMIC_SEQ_CST)) {
+        System *system = last_system >= 0 && last_system < system_array_size(&manager->system_array) ?
+            system_array_get(&manager->system_array, last_system) : NULL;
+        printf("Invariant: [%s] holds %d but should hold %lld (started %d, produced %lld, consumed %lld, discarded %lld), last moved by %s\n",
+            resource->info.name, amount, (long long)expected, resource->info.initial_amount, (long long)moved[INVARIANT_PRODUCED],
+            (long long)moved[INVARIANT_CONSUMED], (long long)moved[INVARIANT_DISCARDED], system != NULL ? system->info.name : "no system");
+    }
+    return 1;
+}
+
+/**
+ * Local helper that checks a group's total against the group's view of its tanks, the tanks
+ * themselves are checked as resources of their own.
+ *
+ * @return 1 if the total is off, 0 otherwise.
+ */
+static int invariant_check_group(ResourceGroup *group) {
+    long sum = 0;
+
+    sem_wait(&group->mutex);
+    for (int i = 0; i < group->n_members; i++) {
+        sum += group->amounts[i];
+    }
+    int total = __atomic_load_n(&group->total->amount, __ATOMIC_SEQ_CST);
+    sem_post(&group->mutex);
+
+    if (total == sum) return 0;
+
+    if (!__atomic_exchange_n(&invariant_reported, 1, __ATOMIC_SEQ_CST)) {
+        printf("Invariant: total [%s] is %d but its tanks hold %ld\n", group->total->info.name, total, sum);
+    }
+    return 1;
+}
+
+/**
+ * Local helper that claims a block of counters for the calling thread, released again when it exits.
+ * A released block keeps its counts and the next thread to claim it adds to them.
+ */
+static void invariant_claim_block(void) {
+    for (int i = 0; i < INVARIANT_MAX_THREADS - 1; i++) {
+        int unclaimed = 0;
+        if (__atomic_compare_exchange_n(&invariant_claimed[i], &unclaimed, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            invariant_block = i;
+            break;
+        }
+    }
+
+    // Counters only change under their resource's mutex, so threads past the last block can share it
+    if (invariant_block < 0) {
+        invariant_block = INVARIANT_MAX_THREADS - 1;
+    }
+
+    // The checker only adds up the blocks that were ever used
+    int blocks = __atomic_load_n(&n_blocks, __ATOMIC_SEQ_CST);
+    while (blocks <= invariant_block &&
+           !__atomic_compare_exchange_n(&n_blocks, &blocks, invariant_block + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    }
+
+    if (invariant_block < INVARIANT_MAX_THREADS - 1) {
+        pthread_once(&invariant_key_once, invariant_make_key);
+        pthread_setspecific(invariant_key, (void *)(intptr_t)(invariant_block + 1));
+    }
+}
+
+/**
+ * Local helper that creates the key whose destructor releases a thread's block.
+ */
+static void invariant_make_key(void) {
+    pthread_key_create(&invariant_key, invariant_release_block);
+}
+
+/**
+ * Local helper run when a thread that claimed a block exits.
+ *
+ * @param[in] block The block index plus one, as stored with the key.
+ */
+static void invariant_release_block(void *block) {
+    __atomic_store_n(&invariant_claimed[(int)(intptr_t)block - 1], 0, __ATOMIC_SEQ_CST);
+}
@@ -1,76 +1,239 @@
 #include "defs.h"
+#include <signal.h>
 
-void load_data(Manager *manager);
+static int run_threads(Manager *manager);
 
 int main(void) {
-    Manager manager;
-    pthread_t manager_thread_id;
+    Manager local_manager;
+    Manager *manager = &local_manager;
+    int total_distance = 0;
+
+    // In shared-memory mode the manager and all of its data live in the shared segment
+    if (SHM_PROCESS_MODE) {
+        manager = shm_create();
+        if (manager == NULL) {
+            printf("Failed to create the shared-memory segment\n");
+            return 1;
+        }
+    }
+
+    manager_init(manager);
+
+    if (FLUID_MODE) {
+        // The fluid engine is meant for large fleets, so load one copy of the vehicle per fleet member
+        for (int i = 0; i < FLUID_FLEET_SIZE; i++) {
+            load_data(manager);
+        }
+        fluid_run(manager);
+    }
+    else if (DES_MODE) {
+        DesResult sequential, conservative, optimistic;
+
+        for (int i = 0; i < DES_FLEET_SIZE; i++) {
+            load_data(manager);
+        }
+
+        // Every engine must agree exactly, the sequential one is the reference
+        des_run(manager, DES_ENGINE_SEQUENTIAL, 1, &sequential);
+        des_print_result("Sequential", &sequential);
+        des_run(manager, DES_ENGINE_CONSERVATIVE, DES_PARTITIONS, &conservative);
+        des_print_result("Conservative", &conservative);
+        des_run(manager, DES_ENGINE_OPTIMISTIC, DES_PARTITIONS, &optimistic);
+        des_print_result("Optimistic", &optimistic);
+        printf("Conservative run %s the sequential run.\n", des_result_equal(&sequential, &conservative) ? "matches" : "DIFFERS FROM");
+        printf("Optimistic run %s the sequential run.\n", des_result_equal(&sequential, &optimistic) ? "matches" : "DIFFERS FROM");
+        total_distance = sequential.distance;
+    }
+    else if (OPTIMIZE_MODE) {
+        // Every candidate is loaded into a manager of its own
+        total_distance = optimize_run();
+    }
+    else if (SENSITIVITY_MODE) {
+        // Every run loads the vehicle into a manager of its own
+        total_distance = sensitivity_run();
+    }
+    else if (REPLAY_LOG) {
+        load_data(manager);
+        if (REPLAY_MANAGER_ONLY) {
+            record_benchmark_manager(manager, RECORD_LOG_PATH);
+        } else {
+            record_replay(manager, RECORD_LOG_PATH);
+        }
+        invariant_report(manager);
+    }
+    else if (REMOTE_MODE) {
+        load_data(manager);
+        remote_run(manager);
+        invariant_report(manager);
+        event_queue_report(&manager->event_queue);
+    }
+    else if (SHM_PROCESS_MODE) {
+        load_data(manager);
+        // An aborted run may have left the queue's semaphore taken by a dead process
+        if (shm_run(manager) == 0) {
+            event_queue_report(&manager->event_queue);
+        }
+    }
+    else {
+        load_data(manager);
+        if (RECORD_LOG) {
+            record_start();
+        }
+        if (AUDIT_LOG && audit_start(manager, AUDIT_PATH) != 0) {
+            return 1;
+        }
+        if (EVENT_RING && event_ring_start(manager, TELEMETRY_PATH) != 0) {
+            return 1;
+        }
+        if (run_threads(manager) != 0) {
+            return 1;
+        }
+        if (RECORD_LOG) {
+            record_finish(manager, RECORD_LOG_PATH);
+        }
+        if (AUDIT_LOG) {
+            audit_finish();
+        }
+        if (EVENT_RING) {
+            event_ring_finish(manager);
+        }
+        invariant_report(manager);
+        event_queue_report(&manager->event_queue);
+    }
+
+    // Find the distance resources to print out how far we went, the discrete-event engines leave them untouched
+    for (int i = 0; i < manager->resources.size && !DES_MODE; i++) {
+        const Resource *resource = manager->resources.resources[i];
+        if (resource != NULL && strcmp(resource->info.name, "Distance") == 0) {
+            total_distance += resource->amount;
+        }
+    }
+    printf("=> Total Distance Travelled: %d furlongs.\n", total_distance);
+    // The sketches are fed by resource_transfer_*(), which the fluid and discrete-event engines never call,
+    // so in those modes they are empty and must not be reported or merged into SKETCH_PATH
+    if (SKETCH_LEVELS && !FLUID_MODE && !DES_MODE) {
+        sketch_report(manager, SKETCH_PATH);
+    }
+
+    // Clean up manager, every thread has finished so whatever was retired can go too
+    manager_clean(manager);
+    epoch_clean();
+    if (SHM_PROCESS_MODE) {
+        shm_destroy();
+    }
+    return 0;
+}
+
+/**
+ * Runs the simulation with one thread for the manager and one thread per system.
+ *
+ * @param[in,out] manager  Pointer to the loaded `Manager` to run.
+ * @return 0 on success, 1 if a thread could not be created.
+ */
+static int run_threads(Manager *manager) {
+    pthread_t manager_thread_id, reconfig_thread_id, scenario_thread_id;
     pthread_t *system_threads;
 
-    manager_init(&manager);
-    load_data(&manager);
-    
     // NOTE: The code to handle the manager run and the systems
     //       will be moved to threading functions.
-    /*while (manager.simulation_running) {
-        manager_run(&manager);
-        for (int i = 0; i < manager.system_array.size; i++) {
-            system_run(manager.system_array.systems[i]);
+    /*while (manager->simulation_running) {
+        manager_run(manager);
+        for (int i = 0; i < manager->system_array.size; i++) {
+            system_run(manager->system_array.systems[i]);
         }
     }*/
 
     // Allocate array for system threads
 
-    system_threads = malloc(manager.system_array.size * sizeof(pthread_t));
+    system_threads = malloc(manager->system_array.size * sizeof(pthread_t));
     if (system_threads == NULL) {
         printf("Failed to allocate memory for system threads\n");
         return 1;
     }
 
+    // Every thread inherits this, so a SIGHUP is only ever taken by the reload thread
+    if (HOT_RELOAD) {
+        sigset_t hangup;
+        sigemptyset(&hangup);
+        sigaddset(&hangup, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &hangup, NULL);
+    }
+
     // Create manager thread
-    if (pthread_create(&manager_thread_id, NULL, manager_thread, &manager) != 0){
+    if (pthread_create(&manager_thread_id, NULL, manager_thread, manager) != 0){
         printf("Failed to create manager thread\n");
         return 1;
     }
 
     // Create system threads
-    for (int i = 0; i < manager.system_array.size; i++) {
-        if (pthread_create(&system_threads[i], NULL, system_thread, manager.system_array.systems[i]) != 0){
+    for (int i = 0; i < manager->system_array.size; i++) {
+        System *system = manager->system_array.systems[i];
+        if (pthread_create(&system->info.thread, NULL, system_thread, system) != 0){
             printf("Failed to create system thread %d\n", i);
             return 1;
         }
+        system_threads[i] = system->info.thread;
     }
 
-    // Wait for manager and system threads to finish
-    pthread_join(manager_thread_id, NULL);
-    for (int i = 0; i < manager.system_array.size; i++) {
-        pthread_join(system_threads[i], NULL);
+    // Attach and detach systems while the others keep running
+    if (RECONFIG_MODE && pthread_create(&reconfig_thread_id, NULL, reconfig_thread, manager) != 0) {
+        printf("Failed to create reconfiguration thread\n");
+        return 1;
+    }
+    if (HOT_RELOAD && pthread_create(&scenario_thread_id, NULL, scenario_thread, manager) != 0) {
+        printf("Failed to create reload thread\n");
+        return 1;
     }
 
-    // Free system threads
-    free(system_threads);
+    // Keep systems sharing resources on CPUs that share a cache
+    if (AFFINITY_MODE) {
+        affinity_pin_threads(manager, manager_thread_id, system_threads);
+    }
 
-    // Find the distance resource to print out how far we went
-    for (int i = 0; i < manager.resources.size; i++) {
-        if (strcmp(manager.resources.resources[i]->name, "Distance") == 0) {
-            printf("=> Total Distance Travelled: %d furlongs.\n", manager.resources.resources[i]->amount);
+    // Wait for manager and system threads to finish, detached systems were already joined when they were detached
+    pthread_join(manager_thread_id, NULL);
+    if (RECONFIG_MODE) {
+        pthread_join(reconfig_thread_id, NULL);
+    }
+    if (HOT_RELOAD) {
+        pthread_join(scenario_thread_id, NULL);
+    }
+    for (int i = 0; i < manager->system_array.size; i++) {
+        if (manager->system_array.systems[i] != NULL) {
+            pthread_join(manager->system_array.systems[i]->info.thread, NULL);
         }
     }
 
-    // Clean up manager
-    manager_clean(&manager);
+    // Free system threads
+    free(system_threads);
     return 0;
 }
 
 void load_data(Manager *manager) {
     // Create resources
     Resource *fuel, *oxygen, *energy, *distance;
-    resource_create(&fuel, "Fuel", 1000, 1000);
+    if (RESOURCE_GROUPS) {
+        // The same 1000 fuel in three tanks, drawn from as one
+        static const char *names[] = {"Fuel Tank A", "Fuel Tank B", "Fuel Tank C"};
+        static const int amounts[] = {400, 350, 250};
+        ResourceGroup *tanks;
+        Resource *tank;
+
+        group_create(&tanks, &fuel, "Fuel", PARAM_GROUP_POLICY);
+        storage_add(&manager->resources, fuel);
+        for (int i = 0; i < 3; i++) {
+            resource_create(&tank, names[i], amounts[i], amounts[i]);
+            group_add(tanks, tank);
+            storage_add(&manager->resources, tank);
+        }
+    } else {
+        resource_create(&fuel, "Fuel", 1000, 1000);
+        storage_add(&manager->resources, fuel);
+    }
     resource_create(&oxygen, "Oxygen", 20, 50);
     resource_create(&energy, "Energy", 30, 50);
     resource_create(&distance, "Distance", 0, 1000);
 
-    storage_add(&manager->resources, fuel);
     storage_add(&manager->resources, oxygen);
     storage_add(&manager->resources, energy);
     storage_add(&manager->resources, distance);
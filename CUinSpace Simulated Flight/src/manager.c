@@ -7,6 +7,8 @@
 
 #include "defs.h"
 
+static void manager_check_forecasts(Manager *manager);
+
 /**
  * Initializes a `Manager` structure.
  *
@@ -16,15 +18,18 @@
  */
 void manager_init(Manager *manager) {
     manager->simulation_running = 1;
+    manager->quiet = 0;
     system_array_init(&manager->system_array);
     storage_init(&manager->resources);
     event_queue_init(&manager->event_queue);
+    quiescence_init(&manager->quiescence);
 }
 
 /**
  * Cleans up the `Manager` structure.
  *
- * Frees all resources associated with the `Manager`.
+ * Frees all resources associated with the `Manager`. What it retired is left to `epoch_clean()`,
+ * since the retire lists are shared with every other manager that may still be running.
  *
  * @param[in,out] manager  Pointer to the `Manager` to clean.
  */
@@ -32,76 +37,144 @@ void manager_clean(Manager *manager) {
     system_array_clean(&manager->system_array);
     storage_clean(&manager->resources);
     event_queue_clean(&manager->event_queue);
+    quiescence_clean(&manager->quiescence);
 }
 
 /**
  * Main execution loop for the manager. 
  *
  * Runs through all currently queued events until either all events are popped 
- * or the simulation is no longer running.
+ * or the simulation is no longer running, then terminates the simulation if it has become quiescent.
  *
  * @param[in,out] manager  Pointer to the `Manager` to run.
 
  */
 void manager_run(Manager *manager) {
     Event event;
-    int i, mode;
-    int no_oxygen_flag = 0, distance_reached_flag = 0, need_more_flag = 0, need_less_flag = 0;
+    int i, mode, quiescence;
     
     System *sys = NULL;
+
+    // Systems and resources attached or detached meanwhile are freed only after this run
+    epoch_enter();
         
     // Update the display of the current state of things
-    display_simulation_state(manager);
+    if (!manager->quiet) display_simulation_state(manager);
 
     // Process events if one is popped
     while (manager->simulation_running && event_queue_pop(&manager->event_queue, &event)) {
-        printf("Manager: Event popped %s\n", event.system->name); // Debug output
+        if (!manager->quiet) printf("Manager: Event popped %s\n", event.system->info.name); // Debug output
+        quiescence_observe(&manager->quiescence, &event);
         if (event.priority == PRIORITY_IGN) continue;
 
-        display_event(&event);
-
-        // Default to swapping systems back into standard mode unless a check tells us otherwise.
-        mode = MODE_STANDARD;
+        // With a ring the display reads the events from it instead, see below
+        if (!manager->quiet && manager->event_queue.ring == NULL) display_event(&event);
 
-        // Set some flags based on the event that we can react to below
-        no_oxygen_flag        = (event.status == EVENT_INSUFFICIENT && strcmp(event.resource->name, "Oxygen") == 0);
-        distance_reached_flag = (event.status == EVENT_CAPACITY && strcmp(event.resource->name, "Distance") == 0);
-        need_more_flag        = (event.status == EVENT_LOW || event.status == EVENT_INSUFFICIENT);
-        need_less_flag        = (event.status == EVENT_CAPACITY) || (event.status == EVENT_HIGH);
-
-        if (no_oxygen_flag) {
-            display_finish_sim();
-            printf("Oxygen depleted. Terminating all systems.\n");
-            mode = MODE_TERMINATE;
-            manager->simulation_running = 0;
-        }
-        else if (distance_reached_flag) {
-            display_finish_sim();
-            printf("Destination reached. Terminating all systems.\n");
-            mode = MODE_TERMINATE;
+        mode = manager_decide_mode(&event);
+        if (mode == MODE_TERMINATE) {
+            if (!manager->quiet) display_finish_sim();
+            if (event.status == EVENT_INSUFFICIENT) {
+                printf("Oxygen depleted. Terminating all systems.\n");
+            } else {
+                printf("Destination reached. Terminating all systems.\n");
+            }
             manager->simulation_running = 0;
         }
-        else if (need_more_flag) {
-            mode = MODE_FAST;
-        }
-        else if (need_less_flag) {
-            mode = MODE_SLOW;
-        }
 
         // Update all of the systems to speed up or slow down production, or terminate
-        for (i = 0; i < manager->system_array.size; i++) {
-            sys = manager->system_array.systems[i];
-            if (system_get_mode(sys) == MODE_TERMINATE) continue;
+        for (i = 0; i < system_array_size(&manager->system_array); i++) {
+            sys = system_array_get(&manager->system_array, i);
+            if (sys == NULL || system_get_mode(sys) == MODE_TERMINATE) continue;
 
-            if (mode == MODE_TERMINATE || sys->recipe.output == event.resource) {
+            if (mode == MODE_TERMINATE || sys->recipe->output == event.resource) {
                 system_set_mode(sys, mode);
             }
         }
 
-        usleep(PARAM_MANAGER_WAIT * 1000 / PARAM_SPEED_MODIFIER);
+        if (!manager->quiet) usleep(PARAM_MANAGER_WAIT * 1000 / PARAM_SPEED_MODIFIER);
+    }
+
+    if (!manager->quiet) event_ring_display(manager);
+    manager_check_forecasts(manager);
+    invariant_poll(manager, quiescence_now_ms());
+
+    // End the simulation if no system can make progress anymore
+    quiescence = quiescence_check(&manager->quiescence, manager, quiescence_now_ms());
+    if (manager->simulation_running && quiescence != QUIESCENCE_NONE) {
+        display_finish_sim();
+        quiescence_report(&manager->quiescence, manager, quiescence);
+        manager->simulation_running = 0;
+
+        for (i = 0; i < system_array_size(&manager->system_array); i++) {
+            sys = system_array_get(&manager->system_array, i);
+            if (sys != NULL) system_set_mode(sys, MODE_TERMINATE);
+        }
+    }
+
+    epoch_exit();
+}
+
+/**
+ * Local helper that warns once whenever a resource is forecast to run out within `PARAM_FORECAST_WARNING`.
+ *
+ * @param[in,out] manager  Pointer to the `Manager` whose resources are checked.
+ */
+static void manager_check_forecasts(Manager *manager) {
+    for (int i = 0; i < storage_size(&manager->resources); i++) {
+        Resource *resource = storage_get(&manager->resources, i);
+        if (resource == NULL || resource->info.forecast == NULL) continue;
+
+        sem_wait(&resource->mutex);
+        long time_to_empty = forecast_time_to_empty(resource->info.forecast, resource->amount);
+        int soon = time_to_empty >= 0 && time_to_empty < PARAM_FORECAST_WARNING;
+        int warn = soon && !resource->info.forecast->warned;
+        resource->info.forecast->warned = soon;
+        sem_post(&resource->mutex);
+
+        if (warn && !manager->quiet) {
+            printf("Manager: [%s] forecast to run out in %.1f s\n", resource->info.name, time_to_empty / 1000.0); // Debug output
+        }
     }
 }
 
+/**
+ * Decides how the manager reacts to a single event.
+ *
+ * This is the manager's whole control policy, kept free of side effects so the alternative
+ * simulation engines can apply exactly the same decisions as `manager_run()`.
+ *
+ * @param[in] event  Pointer to the `Event` to react to.
+ * @return `MODE_TERMINATE` if the simulation should end, otherwise the mode for the systems
+ *         producing the event's resource.
+ */
+int manager_decide_mode(const Event *event) {
+    // Default to swapping systems back into standard mode unless a check tells us otherwise.
+    int mode = MODE_STANDARD;
+
+    // Set some flags based on the event that we can react to below
+    int no_oxygen_flag        = (event->status == EVENT_INSUFFICIENT && strcmp(event->resource->info.name, "Oxygen") == 0);
+    int distance_reached_flag = (event->status == EVENT_CAPACITY && strcmp(event->resource->info.name, "Distance") == 0);
+    int need_more_flag        = (event->status == EVENT_LOW || event->status == EVENT_INSUFFICIENT);
+    int no_room_flag          = (event->status == EVENT_CAPACITY);
+    int need_less_flag        = (event->status == EVENT_HIGH);
+
+    if (no_oxygen_flag || distance_reached_flag) {
+        mode = MODE_TERMINATE;
+    }
+    else if (need_more_flag) {
+        mode = MODE_FAST;
+    }
+    else if (no_room_flag) {
+        // Producers with nowhere to put their output are parked until a consumer runs low again
+        mode = MODE_DISABLED;
+    }
+    else if (need_less_flag) {
+        mode = MODE_SLOW;
+    }
+
+    return mode;
+}
+
 /**
  * Thread function for running the manager.
  * This is the entry point for the manager thread that will be created by pthread_create().
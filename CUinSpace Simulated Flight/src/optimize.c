@@ -0,0 +1,366 @@
+/***************************************************************
+ * optimize.c
+ * Contains the scenario optimizer.
+ * A genetic algorithm searches the recipe amounts and capacities of the vehicle in `load_data()`
+ * for the configuration that goes furthest, and among those reaching the destination the fastest.
+ * Each candidate is a vector of genes, evaluated with the sequential discrete-event engine on its own
+ * `Manager`, a whole generation at a time across a pool of worker threads.
+ *
+ * Candidates seen before are answered from a cache instead of being run again. Once a candidate has
+ * reached the destination, later runs are cut off at its duration: a run still underway by then
+ * cannot be better, however it would end. The cut-off only changes between generations, so the
+ * search gives the same answer whatever the number of threads. With `RESULT_CACHE` the runs of earlier
+ * searches are answered from disk too.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+
+#define OPTIMIZE_GENES      5      // Parameters searched, see `genes`
+#define OPTIMIZE_CACHE      2048   // Slots of the result cache, a power of two above every candidate ever run
+#define OPTIMIZE_ELITE      2      // Best candidates carried over to the next generation unchanged
+#define OPTIMIZE_TOURNAMENT 3      // Candidates drawn to pick each parent
+#define OPTIMIZE_MUTATION   20     // Percent chance of mutating each gene of a child
+
+#define OPTIMIZE_INPUT      0      // Gene is how much a system's recipe converts per cycle
+#define OPTIMIZE_CAPACITY   1      // Gene is a resource's capacity
+
+// Every candidate run, and the baseline, takes a slot of its own
+_Static_assert(OPTIMIZE_CACHE >= OPTIMIZE_POPULATION * OPTIMIZE_GENERATIONS + 1, "OPTIMIZE_CACHE must fit every candidate ever run");
+_Static_assert((OPTIMIZE_CACHE & (OPTIMIZE_CACHE - 1)) == 0, "OPTIMIZE_CACHE must be a power of two");
+
+// A parameter of the vehicle the optimizer may change
+typedef struct OptimizeGene {
+    const char *name;
+    const char *target; // Name of the system or resource in `load_data()`
+    int kind;           // OPTIMIZE_INPUT or OPTIMIZE_CAPACITY
+    int min, max;
+} OptimizeGene;
+
+// A candidate configuration and how it did
+typedef struct OptimizeCandidate {
+    int genes[OPTIMIZE_GENES];
+    DesResult result;
+    int job;            // Index of the job evaluating it this generation, -1 if it was cached
+} OptimizeCandidate;
+
+// A result cache slot, keyed by the genes
+typedef struct OptimizeEntry {
+    int used;
+    int genes[OPTIMIZE_GENES];
+    DesResult result;
+} OptimizeEntry;
+
+// The runs of one generation, shared with the worker threads
+typedef struct OptimizeBatch {
+    int (*genes)[OPTIMIZE_GENES];
+    DesResult *results;
+    WorkPool pool;      // One job per entry of `genes`
+    long horizon_ms;    // Cut-off of every run in the batch
+} OptimizeBatch;
+
+static const OptimizeGene genes[OPTIMIZE_GENES] = {
+    {"Propulsion fuel per cycle",     "Propulsion",   OPTIMIZE_INPUT,    1,  25},
+    {"Generator fuel per cycle",      "Generator",    OPTIMIZE_INPUT,    2,  30},
+    {"Life Support energy per cycle", "Life Support", OPTIMIZE_INPUT,    2,  30},
+    {"Oxygen capacity",               "Oxygen",       OPTIMIZE_CAPACITY, 20, 200},
+    {"Energy capacity",               "Energy",       OPTIMIZE_CAPACITY, 20, 200},
+};
+
+static void optimize_load(Manager *manager, const int *values);
+static void optimize_baseline(int *values);
+static void optimize_evaluate(const int *values, long horizon_ms, DesResult *result);
+static void *optimize_worker(void *arg);
+static int  optimize_better(const DesResult *a, const DesResult *b);
+static OptimizeEntry *optimize_lookup(OptimizeEntry *cache, const int *values);
+static const OptimizeCandidate *optimize_pick(const OptimizeCandidate *population, uint64_t *rng);
+static int  optimize_random(uint64_t *rng, int bound);
+static void optimize_print(const char *label, const int *values, const DesResult *result);
+
+/**
+ * Runs the genetic algorithm and prints the best configuration found against the baseline.
+ *
+ * @return The distance reached by the best configuration.
+ */
+int optimize_run(void) {
+    OptimizeCandidate *population = calloc(OPTIMIZE_POPULATION, sizeof(OptimizeCandidate));
+    OptimizeCandidate *children = calloc(OPTIMIZE_POPULATION, sizeof(OptimizeCandidate));
+    OptimizeEntry *cache = calloc(OPTIMIZE_CACHE, sizeof(OptimizeEntry));
+    OptimizeBatch batch;
+    OptimizeCandidate best, baseline;
+    uint64_t rng = OPTIMIZE_SEED * 0x9E3779B97F4A7C15ULL + 1;
+    int n_threads = pool_threads();
+    long runs = 0, cached = 0, cut = 0;
+    struct timespec start, end;
+
+    batch.genes = malloc(OPTIMIZE_POPULATION * sizeof(*batch.genes));
+    batch.results = malloc(OPTIMIZE_POPULATION * sizeof(DesResult));
+    assert(population && children && cache && batch.genes && batch.results);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Start from the baseline and random configurations around the whole range
+    optimize_baseline(baseline.genes);
+    optimize_evaluate(baseline.genes, PARAM_DES_HORIZON, &baseline.result);
+    OptimizeEntry *entry = optimize_lookup(cache, baseline.genes);
+    entry->used = 1;
+    memcpy(entry->genes, baseline.genes, sizeof(entry->genes));
+    entry->result = baseline.result;
+    runs++;
+    best = baseline;
+    population[0] = baseline;
+    for (int i = 1; i < OPTIMIZE_POPULATION; i++) {
+        for (int g = 0; g < OPTIMIZE_GENES; g++) {
+            population[i].genes[g] = genes[g].min + optimize_random(&rng, genes[g].max - genes[g].min + 1);
+        }
+    }
+
+    for (int generation = 0; generation < OPTIMIZE_GENERATIONS; generation++) {
+        // Runs still underway at the best duration so far cannot win
+        batch.horizon_ms = best.result.cause == DES_CAUSE_DESTINATION ? best.result.duration_ms + 1 : PARAM_DES_HORIZON;
+        batch.pool.size = 0;
+
+        // Answer what the cache knows, and run each new configuration once even if it appears twice
+        for (int i = 0; i < OPTIMIZE_POPULATION; i++) {
+            OptimizeCandidate *candidate = &population[i];
+            OptimizeEntry *entry = optimize_lookup(cache, candidate->genes);
+            candidate->job = -1;
+
+            if (entry->used) {
+                candidate->result = entry->result;
+                cached++;
+                continue;
+            }
+            for (int j = 0; j < batch.pool.size; j++) {
+                if (memcmp(batch.genes[j], candidate->genes, sizeof(candidate->genes)) == 0) candidate->job = j;
+            }
+            if (candidate->job < 0) {
+                candidate->job = batch.pool.size;
+                memcpy(batch.genes[batch.pool.size++], candidate->genes, sizeof(candidate->genes));
+            } else {
+                cached++;
+            }
+        }
+
+        pool_run(&batch.pool, optimize_worker, &batch, n_threads);
+        runs += batch.pool.size;
+
+        for (int j = 0; j < batch.pool.size; j++) {
+            OptimizeEntry *entry = optimize_lookup(cache, batch.genes[j]);
+            entry->used = 1;
+            memcpy(entry->genes, batch.genes[j], sizeof(entry->genes));
+            entry->result = batch.results[j];
+            if (batch.results[j].cause == DES_CAUSE_HORIZON && batch.horizon_ms < PARAM_DES_HORIZON) cut++;
+        }
+        for (int i = 0; i < OPTIMIZE_POPULATION; i++) {
+            if (population[i].job >= 0) population[i].result = batch.results[population[i].job];
+            if (optimize_better(&population[i].result, &best.result)) best = population[i];
+        }
+
+        printf("Generation %2d: best %4d furlongs in %6.1f s, %d run(s), cut-off at %.1f s\n", generation,
+            best.result.distance, best.result.duration_ms / 1000.0, batch.pool.size, batch.horizon_ms / 1000.0);
+
+        // Breed the next generation, keeping the best few unchanged
+        for (int e = 0; e < OPTIMIZE_ELITE; e++) {
+            int top = e;
+            for (int i = e + 1; i < OPTIMIZE_POPULATION; i++) {
+                if (optimize_better(&population[i].result, &population[top].result)) top = i;
+            }
+            OptimizeCandidate swap = population[e];
+            population[e] = population[top];
+            population[top] = swap;
+            children[e] = population[e];
+        }
+        for (int i = OPTIMIZE_ELITE; i < OPTIMIZE_POPULATION; i++) {
+            const OptimizeCandidate *mother = optimize_pick(population, &rng);
+            const OptimizeCandidate *father = optimize_pick(population, &rng);
+
+            for (int g = 0; g < OPTIMIZE_GENES; g++) {
+                int value = optimize_random(&rng, 2) ? mother->genes[g] : father->genes[g];
+                if (optimize_random(&rng, 100) < OPTIMIZE_MUTATION) {
+                    int step = (genes[g].max - genes[g].min) / 8 + 1;
+                    value += optimize_random(&rng, 2 * step + 1) - step;
+                }
+                children[i].genes[g] = value < genes[g].min ? genes[g].min : value > genes[g].max ? genes[g].max : value;
+            }
+        }
+        OptimizeCandidate *swap = population;
+        population = children;
+        children = swap;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Optimizer: %ld run(s) on %d thread(s), %ld answered from the cache, %ld cut off, in %.2f s\n",
+        runs, n_threads, cached, cut, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    if (RESULT_CACHE) {
+        long hits, misses;
+        cache_stats(&hits, &misses);
+        printf("Result cache: %ld run(s) answered from %s, %ld simulated\n", hits, CACHE_PATH, misses);
+        cache_close();
+    }
+    optimize_print("Baseline", baseline.genes, &baseline.result);
+    optimize_print("Best", best.genes, &best.result);
+
+    free(population);
+    free(children);
+    free(cache);
+    free(batch.genes);
+    free(batch.results);
+    return best.result.distance;
+}
+
+/**
+ * Local helper that loads the vehicle of `load_data()` with the given genes.
+ *
+ * Each recipe keeps the conversion ratio of `load_data()`, only how much it converts per cycle changes.
+ * Its output is rounded to the nearest whole amount rather than down, which would cost odd inputs.
+ * A capacity below the starting amount discards the rest, like a hot reload shrinking it.
+ *
+ * @param[in,out] manager Pointer to an empty `Manager`.
+ * @param[in]     values  The genes, in the order of `genes`.
+ */
+static void optimize_load(Manager *manager, const int *values) {
+    load_data(manager);
+
+    for (int g = 0; g < OPTIMIZE_GENES; g++) {
+        if (genes[g].kind == OPTIMIZE_INPUT) {
+            for (int i = 0; i < manager->system_array.size; i++) {
+                System *system = manager->system_array.systems[i];
+                if (strcmp(system->info.name, genes[g].target) != 0) continue;
+
+                Recipe recipe = *system->recipe;
+                recipe.output_amount = (values[g] * recipe.output_amount + recipe.input_amount / 2) / recipe.input_amount;
+                recipe.input_amount = values[g];
+                system_set_recipe(system, recipe);
+            }
+        } else {
+            for (int r = 0; r < manager->resources.size; r++) {
+                Resource *resource = manager->resources.resources[r];
+                if (strcmp(resource->info.name, genes[g].target) == 0) resource_set_capacity(resource, values[g]);
+            }
+        }
+    }
+}
+
+/**
+ * Local helper that reads the genes of the vehicle as `load_data()` defines it.
+ *
+ * @param[out] values The genes, in the order of `genes`.
+ */
+static void optimize_baseline(int *values) {
+    Manager manager;
+
+    manager_init(&manager);
+    load_data(&manager);
+    for (int g = 0; g < OPTIMIZE_GENES; g++) {
+        values[g] = 0;
+        for (int i = 0; i < manager.system_array.size && genes[g].kind == OPTIMIZE_INPUT; i++) {
+            const System *system = manager.system_array.systems[i];
+            if (strcmp(system->info.name, genes[g].target) == 0) values[g] = system->recipe->input_amount;
+        }
+        for (int r = 0; r < manager.resources.size && genes[g].kind == OPTIMIZE_CAPACITY; r++) {
+            const Resource *resource = manager.resources.resources[r];
+            if (strcmp(resource->info.name, genes[g].target) == 0) values[g] = resource->max_capacity;
+        }
+    }
+    manager_clean(&manager);
+}
+
+/**
+ * Local helper that runs one candidate with the sequential discrete-event engine.
+ *
+ * @param[in]  values     The genes of the candidate.
+ * @param[in]  horizon_ms Simulated time the run is cut off at.
+ * @param[out] result     Pointer to the `DesResult` to fill.
+ */
+static void optimize_evaluate(const int *values, long horizon_ms, DesResult *result) {
+    Manager manager;
+
+    manager_init(&manager);
+    optimize_load(&manager, values);
+    cache_run_until(&manager, DES_ENGINE_SEQUENTIAL, 1, horizon_ms, 0, result);
+    manager_clean(&manager);
+}
+
+/**
+ * Thread function that evaluates jobs of a batch until none are left.
+ *
+ * @param[in] arg Pointer to the OptimizeBatch structure (cast from void*)
+ * @return NULL (required for pthread function signature)
+ */
+static void *optimize_worker(void *arg) {
+    OptimizeBatch *batch = (OptimizeBatch *)arg;
+    int job;
+
+    while ((job = pool_take(&batch->pool)) >= 0) {
+        optimize_evaluate(batch->genes[job], batch->horizon_ms, &batch->results[job]);
+    }
+    return NULL;
+}
+
+/**
+ * Local helper that ranks two runs: further is better, then reaching the destination sooner.
+ *
+ * @return 1 if `a` is strictly better than `b`, 0 otherwise.
+ */
+static int optimize_better(const DesResult *a, const DesResult *b) {
+    if (a->distance != b->distance) return a->distance > b->distance;
+    return a->duration_ms < b->duration_ms;
+}
+
+/**
+ * Local helper that finds the cache slot of a configuration, or the empty slot it belongs in.
+ *
+ * @param[in] cache  The cache, `OPTIMIZE_CACHE` slots.
+ * @param[in] values The genes to look up.
+ * @return The slot, with `used` clear if the configuration was never run.
+ */
+static OptimizeEntry *optimize_lookup(OptimizeEntry *cache, const int *values) {
+    uint64_t hash = 1469598103934665603ULL;  // FNV-1a
+    for (int g = 0; g < OPTIMIZE_GENES; g++) {
+        hash = (hash ^ (uint32_t)values[g]) * 1099511628211ULL;
+    }
+
+    for (int probe = 0; probe < OPTIMIZE_CACHE; probe++) {
+        OptimizeEntry *entry = &cache[(hash + probe) & (OPTIMIZE_CACHE - 1)];
+        if (!entry->used || memcmp(entry->genes, values, sizeof(entry->genes)) == 0) return entry;
+    }
+    assert(0 && "optimizer cache is full");
+    return NULL;
+}
+
+/**
+ * Local helper that picks a parent by tournament: the best of a few random candidates.
+ */
+static const OptimizeCandidate *optimize_pick(const OptimizeCandidate *population, uint64_t *rng) {
+    const OptimizeCandidate *winner = &population[optimize_random(rng, OPTIMIZE_POPULATION)];
+    for (int k = 1; k < OPTIMIZE_TOURNAMENT; k++) {
+        const OptimizeCandidate *other = &population[optimize_random(rng, OPTIMIZE_POPULATION)];
+        if (optimize_better(&other->result, &winner->result)) winner = other;
+    }
+    return winner;
+}
+
+/**
+ * Local helper that draws a random number with xorshift64*.
+ *
+ * @param[in,out] rng   State of the generator.
+ * @param[in]     bound Exclusive upper bound.
+ * @return A number from 0 to `bound` - 1.
+ */
+static int optimize_random(uint64_t *rng, int bound) {
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    return (int)(((*rng * 2685821657736338717ULL) >> 33) % (uint64_t)bound);
+}
+
+/**
+ * Local helper that prints a configuration and how it did.
+ */
+static void optimize_print(const char *label, const int *values, const DesResult *result) {
+    static const char *causes[] = {"", "oxygen depleted", "destination reached", "horizon reached", "no steps left"};
+    printf("%s: %d furlongs in %.1f s, %s\n", label, result->distance, result->duration_ms / 1000.0, causes[result->cause]);
+    for (int g = 0; g < OPTIMIZE_GENES; g++) {
+        printf("  %-30s %4d\n", genes[g].name, values[g]);
+    }
+}
@@ -0,0 +1,60 @@
+/***************************************************************
+ * pool.c
+ * Contains the worker pool the optimizer and the sensitivity analysis run their jobs on.
+ * The jobs of a `WorkPool` are numbered, and every thread of the pool takes the next one with an
+ * atomic increment until none are left, so each job runs exactly once on whichever thread is free.
+ * The calling thread is one of the workers.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+
+/**
+ * Gives the number of threads a pool should use, one per online CPU.
+ *
+ * @return The number of threads, at least 1.
+ */
+int pool_threads(void) {
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    return n_threads < 1 ? 1 : (int)n_threads;
+}
+
+/**
+ * Takes the next job of a pool.
+ *
+ * @param[in,out] pool Pointer to the `WorkPool`.
+ * @return Index of the job, or -1 once every job has been taken.
+ */
+int pool_take(WorkPool *pool) {
+    int job = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    return job < pool->size ? job : -1;
+}
+
+/**
+ * Runs `worker` on a pool of threads until it has taken every job, and waits for all of them.
+ *
+ * `pool->next` is reset, the worker takes its jobs with `pool_take()`. The workers' managers all retire
+ * into the one set of epoch lists, so what they retired is only freed here, once every worker has joined.
+ * Must not be called while another thread reads the arrays.
+ *
+ * @param[in,out] pool      Pointer to the `WorkPool` with `size` set.
+ * @param[in]     worker    Thread function taking jobs until none are left.
+ * @param[in]     arg       Argument passed to every worker.
+ * @param[in]     n_threads Number of threads to use, the calling thread being one of them.
+ */
+void pool_run(WorkPool *pool, void *(*worker)(void *), void *arg, int n_threads) {
+    pthread_t *threads = malloc(n_threads * sizeof(pthread_t));
+    int started = 0;
+    assert(threads != NULL);
+
+    pool->next = 0;
+    for (int t = 1; t < n_threads && t < pool->size; t++) {
+        if (pthread_create(&threads[started], NULL, worker, arg) == 0) started++;
+    }
+    worker(arg);
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    epoch_clean();
+}
@@ -0,0 +1,276 @@
+/***************************************************************
+ * query.c
+ * Contains the query tool for columnar results files, built as `./query`.
+ *
+ *     ./query FILE [-w COLUMN OP VALUE]... [-g COLUMN] [COLUMN]...
+ *
+ * Keeps the rows matching every `-w` filter (OP is one of = != < <= > >=), groups them by the
+ * `-g` column and prints the count, mean, minimum and maximum of each listed column per group,
+ * of every column if none are listed. A block whose range cannot match a filter is skipped
+ * without being decoded, and only the columns the query uses are decoded at all.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+
+#define QUERY_MAX_FILTERS 16
+
+#define QUERY_EQUAL         0
+#define QUERY_NOT_EQUAL     1
+#define QUERY_LESS          2
+#define QUERY_LESS_EQUAL    3
+#define QUERY_GREATER       4
+#define QUERY_GREATER_EQUAL 5
+
+// A `-w` filter
+typedef struct QueryFilter {
+    int column;
+    int op;             // QUERY_EQUAL, ...
+    double value;
+} QueryFilter;
+
+// Aggregates of one group, for each column of the query
+typedef struct QueryGroup {
+    double key;
+    long count;
+    double sum[COLUMN_MAX], min[COLUMN_MAX], max[COLUMN_MAX];
+} QueryGroup;
+
+static const char *ops[] = {"=", "!=", "<", "<=", ">", ">="};
+
+static int    query_column(const ColumnReader *reader, const char *name);
+static double query_value(const ColumnReader *reader, int column, ColumnValue value);
+static int    query_compare(double value, int op, double operand);
+static int    query_may_match(const ColumnReader *reader, const QueryFilter *filter, const ColumnStats *stats);
+static QueryGroup *query_group(QueryGroup **groups, int *n_groups, int *capacity, double key);
+static int    query_group_compare(const void *a, const void *b);
+static void   query_usage(const char *program);
+
+int main(int argc, char *argv[]) {
+    ColumnReader reader;
+    QueryFilter filters[QUERY_MAX_FILTERS];
+    int n_filters = 0, group_by = -1, n_selected = 0;
+    int selected[COLUMN_MAX], wanted[COLUMN_MAX] = {0};
+    ColumnStats stats[COLUMN_MAX];
+    ColumnValue *values[COLUMN_MAX] = {0};
+    long blocks = 0, skipped = 0, rows = 0, matched = 0;
+    int n_rows;
+
+    if (argc < 2) {
+        query_usage(argv[0]);
+        return 1;
+    }
+    if (column_reader_open(&reader, argv[1]) != 0) {
+        return 1;
+    }
+
+    for (int a = 2; a < argc; a++) {
+        if (strcmp(argv[a], "-w") == 0 && a + 3 < argc && n_filters < QUERY_MAX_FILTERS) {
+            QueryFilter *filter = &filters[n_filters++];
+            filter->column = query_column(&reader, argv[a + 1]);
+            filter->op = -1;
+            for (int o = 0; o < (int)(sizeof(ops) / sizeof(ops[0])); o++) {
+                if (strcmp(argv[a + 2], ops[o]) == 0) filter->op = o;
+            }
+            filter->value = atof(argv[a + 3]);
+            if (filter->column < 0 || filter->op < 0) {
+                query_usage(argv[0]);
+                column_reader_close(&reader);
+                return 1;
+            }
+            wanted[filter->column] = 1;
+            a += 3;
+        } else if (strcmp(argv[a], "-g") == 0 && a + 1 < argc) {
+            group_by = query_column(&reader, argv[++a]);
+            if (group_by < 0) {
+                query_usage(argv[0]);
+                column_reader_close(&reader);
+                return 1;
+            }
+            wanted[group_by] = 1;
+        } else {
+            int column = query_column(&reader, argv[a]);
+            if (column < 0 || n_selected == COLUMN_MAX) {
+                query_usage(argv[0]);
+                column_reader_close(&reader);
+                return 1;
+            }
+            selected[n_selected++] = column;
+        }
+    }
+    if (n_selected == 0) {
+        for (int c = 0; c < reader.n_columns; c++) selected[n_selected++] = c;
+    }
+    for (int s = 0; s < n_selected; s++) {
+        wanted[selected[s]] = 1;
+    }
+    for (int c = 0; c < reader.n_columns; c++) {
+        values[c] = malloc(COLUMN_BLOCK_ROWS * sizeof(ColumnValue));
+        assert(values[c] != NULL);
+    }
+
+    int n_groups = 0, capacity = 16;
+    QueryGroup *groups = malloc(capacity * sizeof(QueryGroup));
+    assert(groups != NULL);
+
+    while (column_next_block(&reader, &n_rows, stats)) {
+        int may_match = 1;
+        blocks++;
+        rows += n_rows;
+        for (int f = 0; f < n_filters && may_match; f++) {
+            may_match = query_may_match(&reader, &filters[f], &stats[filters[f].column]);
+        }
+
+        if (!may_match) {
+            skipped++;
+            if (column_read_block(&reader, n_rows, stats, NULL, values) != 0) break;
+            continue;
+        }
+        if (column_read_block(&reader, n_rows, stats, wanted, values) != 0) {
+            printf("Block %ld is cut short, stopping there\n", blocks);
+            break;
+        }
+
+        for (int i = 0; i < n_rows; i++) {
+            int match = 1;
+            for (int f = 0; f < n_filters && match; f++) {
+                match = query_compare(query_value(&reader, filters[f].column, values[filters[f].column][i]), filters[f].op, filters[f].value);
+            }
+            if (!match) continue;
+
+            double key = group_by >= 0 ? query_value(&reader, group_by, values[group_by][i]) : 0;
+            QueryGroup *group = query_group(&groups, &n_groups, &capacity, key);
+            for (int s = 0; s < n_selected; s++) {
+                double value = query_value(&reader, selected[s], values[selected[s]][i]);
+                group->sum[s] += value;
+                if (group->count == 0 || value < group->min[s]) group->min[s] = value;
+                if (group->count == 0 || value > group->max[s]) group->max[s] = value;
+            }
+            group->count++;
+            matched++;
+        }
+    }
+
+    qsort(groups, n_groups, sizeof(QueryGroup), query_group_compare);
+    for (int g = 0; g < n_groups; g++) {
+        const QueryGroup *group = &groups[g];
+        if (group_by >= 0) {
+            printf("%s = %g: %ld row(s)\n", reader.columns[group_by].name, group->key, group->count);
+        } else {
+            printf("%ld row(s)\n", group->count);
+        }
+        for (int s = 0; s < n_selected; s++) {
+            printf("  %-16s mean %14.4f  min %14.4f  max %14.4f\n", reader.columns[selected[s]].name,
+                group->sum[s] / group->count, group->min[s], group->max[s]);
+        }
+    }
+    printf("%ld of %ld row(s) matched, %ld of %ld block(s) skipped by their ranges\n", matched, rows, skipped, blocks);
+
+    for (int c = 0; c < reader.n_columns; c++) {
+        free(values[c]);
+    }
+    free(groups);
+    column_reader_close(&reader);
+    return 0;
+}
+
+/**
+ * Local helper that finds a column by name.
+ *
+ * @return Index of the column, -1 if the file has no such column.
+ */
+static int query_column(const ColumnReader *reader, const char *name) {
+    for (int c = 0; c < reader->n_columns; c++) {
+        if (strcmp(reader->columns[c].name, name) == 0) return c;
+    }
+    printf("No column named %s\n", name);
+    return -1;
+}
+
+/**
+ * Local helper that reads a value of a column as a double, whatever the column's type.
+ */
+static double query_value(const ColumnReader *reader, int column, ColumnValue value) {
+    return reader->columns[column].type == COLUMN_INT ? (double)value.i : value.d;
+}
+
+/**
+ * Local helper that applies a filter's operator.
+ *
+ * @return 1 if `value` OP `operand` holds, 0 otherwise.
+ */
+static int query_compare(double value, int op, double operand) {
+    switch (op) {
+        case QUERY_EQUAL:         return value == operand;
+        case QUERY_NOT_EQUAL:     return value != operand;
+        case QUERY_LESS:          return value < operand;
+        case QUERY_LESS_EQUAL:    return value <= operand;
+        case QUERY_GREATER:       return value > operand;
+        default:                  return value >= operand;
+    }
+}
+
+/**
+ * Local helper that tells from a block's range of a column whether any of its rows can pass a filter.
+ *
+ * @return 0 if no row of the block can pass, 1 if some might.
+ */
+static int query_may_match(const ColumnReader *reader, const QueryFilter *filter, const ColumnStats *stats) {
+    double min = query_value(reader, filter->column, stats->min);
+    double max = query_value(reader, filter->column, stats->max);
+
+    switch (filter->op) {
+        case QUERY_EQUAL:         return filter->value >= min && filter->value <= max;
+        case QUERY_NOT_EQUAL:     return !(min == max && min == filter->value);
+        case QUERY_LESS:          return min < filter->value;
+        case QUERY_LESS_EQUAL:    return min <= filter->value;
+        case QUERY_GREATER:       return max > filter->value;
+        default:                  return max >= filter->value;
+    }
+}
+
+/**
+ * Local helper that finds the group of a key, adding an empty one if it is new.
+ *
+ * @param[in,out] groups   Pointer to the array of groups, replaced when it grows.
+ * @param[in,out] n_groups Number of groups in the array.
+ * @param[in,out] capacity Capacity of the array.
+ * @param[in]     key      Value of the grouping column.
+ * @return Pointer to the group.
+ */
+static QueryGroup *query_group(QueryGroup **groups, int *n_groups, int *capacity, double key) {
+    for (int g = 0; g < *n_groups; g++) {
+        if ((*groups)[g].key == key) return &(*groups)[g];
+    }
+
+    if (*n_groups == *capacity) {
+        // Can't use realloc, copy over manually like the other arrays
+        QueryGroup *grown = malloc(*capacity * 2 * sizeof(QueryGroup));
+        assert(grown != NULL);
+        memcpy(grown, *groups, *n_groups * sizeof(QueryGroup));
+        free(*groups);
+        *groups = grown;
+        *capacity *= 2;
+    }
+
+    QueryGroup *group = &(*groups)[(*n_groups)++];
+    memset(group, 0, sizeof(QueryGroup));
+    group->key = key;
+    return group;
+}
+
+/**
+ * Local helper that orders groups by key.
+ */
+static int query_group_compare(const void *a, const void *b) {
+    double x = ((const QueryGroup *)a)->key, y = ((const QueryGroup *)b)->key;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Local helper that prints how to run the tool.
+ */
+static void query_usage(const char *program) {
+    printf("Usage: %s FILE [-w COLUMN OP VALUE]... [-g COLUMN] [COLUMN]...\n", program);
+    printf("  OP is one of = != < <= > >=, every filter must hold; -g groups by a column\n");
+}
@@ -0,0 +1,236 @@
+/***************************************************************
+ * quiescence.c
+ * Contains the quiescence detector used by the manager.
+ * Recognizes when every running system is starved of input that nobody can produce,
+ * or when nothing in the simulation has changed for `PARAM_QUIESCENCE_TIMEOUT` simulated
+ * milliseconds, so the manager can end the simulation instead of spinning forever.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+
+#define QUIESCENCE_CHECK_INTERVAL 100  // Simulated milliseconds between two checks
+
+static void quiescence_resize(Quiescence *quiescence, const Manager *manager);
+static int quiescence_all_starved(const Quiescence *quiescence, const Manager *manager);
+
+/**
+ * Initializes a `Quiescence` detector with no systems or resources tracked yet.
+ *
+ * @param[out] quiescence Pointer to the `Quiescence` to initialize.
+ */
+void quiescence_init(Quiescence *quiescence) {
+    assert(quiescence != NULL);
+    quiescence->starved_on = NULL;
+    quiescence->n_systems = 0;
+    quiescence->amounts = NULL;
+    quiescence->n_resources = 0;
+    quiescence->last_change_ms = -1;
+    quiescence->last_check_ms = -1;
+    quiescence->starved_since_ms = -1;
+    quiescence->grace_ms = 0;
+}
+
+/**
+ * Cleans up a `Quiescence` detector.
+ *
+ * @param[in,out] quiescence Pointer to the `Quiescence` to clean.
+ */
+void quiescence_clean(Quiescence *quiescence) {
+    if (quiescence != NULL) {
+        sim_free(quiescence->starved_on);
+        sim_free(quiescence->amounts);
+        quiescence_init(quiescence);
+    }
+}
+
+/**
+ * Returns the current simulated time in milliseconds.
+ *
+ * Wall clock time is scaled by `PARAM_SPEED_MODIFIER`, since every wait in the simulation is shortened by it.
+ *
+ * @return Simulated milliseconds on a monotonic clock.
+ */
+long quiescence_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000L + now.tv_nsec / 1000000L) * PARAM_SPEED_MODIFIER;
+}
+
+/**
+ * Records what an event says about its system.
+ *
+ * An `EVENT_INSUFFICIENT` marks the system as starved on the event's resource, any other event
+ * shows the system made progress and clears it. Must see every event, including ignored ones.
+ *
+ * @param[in,out] quiescence Pointer to the `Quiescence` detector.
+ * @param[in]     event      Pointer to the `Event` popped by the manager.
+ */
+void quiescence_observe(Quiescence *quiescence, const Event *event) {
+    int id = event->system->id;
+    if (id < 0 || id >= quiescence->n_systems) return;
+
+    if (event->status == EVENT_INSUFFICIENT) {
+        quiescence->starved_on[id] = event->resource;
+    } else {
+        quiescence->starved_on[id] = NULL;
+    }
+}
+
+/**
+ * Checks whether the simulation has become quiescent.
+ *
+ * Global starvation is declared once every running system is starved and no resource amount has
+ * changed for a grace period covering the longest cycle, so a system that pulled its input just
+ * before being counted gets the chance to produce.
+ *
+ * @param[in,out] quiescence Pointer to the `Quiescence` detector.
+ * @param[in]     manager    Pointer to the `Manager` being watched.
+ * @param[in]     now_ms     Current simulated time in milliseconds.
+ * @return `QUIESCENCE_NONE`, `QUIESCENCE_STARVED` or `QUIESCENCE_STALLED`.
+ */
+int quiescence_check(Quiescence *quiescence, const Manager *manager, long now_ms) {
+    int changed = 0;
+
+    if (quiescence->last_check_ms >= 0 && now_ms - quiescence->last_check_ms < QUIESCENCE_CHECK_INTERVAL) {
+        return QUIESCENCE_NONE;
+    }
+    quiescence->last_check_ms = now_ms;
+
+    if (quiescence->n_systems != system_array_size(&manager->system_array) || quiescence->n_resources != storage_size(&manager->resources)) {
+        quiescence_resize(quiescence, manager);
+        changed = 1;
+    }
+
+    // Any change in storage counts as progress, resources attached since the resize are picked up next time
+    for (int i = 0; i < quiescence->n_resources; i++) {
+        Resource *resource = storage_get(&manager->resources, i);
+        int amount;
+
+        if (resource == NULL) continue;
+
+        sem_wait(&resource->mutex);
+        amount = resource->amount;
+        sem_post(&resource->mutex);
+
+        if (amount != quiescence->amounts[i]) {
+            quiescence->amounts[i] = amount;
+            changed = 1;
+        }
+    }
+    if (changed || quiescence->last_change_ms < 0) {
+        quiescence->last_change_ms = now_ms;
+        quiescence->starved_since_ms = -1;
+    }
+
+    if (quiescence_all_starved(quiescence, manager)) {
+        if (quiescence->starved_since_ms < 0) quiescence->starved_since_ms = now_ms;
+        if (now_ms - quiescence->starved_since_ms >= quiescence->grace_ms) return QUIESCENCE_STARVED;
+    } else {
+        quiescence->starved_since_ms = -1;
+    }
+
+    if (now_ms - quiescence->last_change_ms >= PARAM_QUIESCENCE_TIMEOUT) {
+        return QUIESCENCE_STALLED;
+    }
+    return QUIESCENCE_NONE;
+}
+
+/**
+ * Prints a diagnostic naming the resources the systems are starved of.
+ *
+ * @param[in] quiescence Pointer to the `Quiescence` detector.
+ * @param[in] manager    Pointer to the `Manager` being watched.
+ * @param[in] result     The result of the last `quiescence_check()`.
+ */
+void quiescence_report(const Quiescence *quiescence, const Manager *manager, int result) {
+    if (result == QUIESCENCE_STARVED) {
+        printf("All systems are starved of input. Terminating all systems.\n");
+    } else {
+        printf("No state change for %d simulated seconds. Terminating all systems.\n", PARAM_QUIESCENCE_TIMEOUT / 1000);
+    }
+
+    for (int r = 0; r < quiescence->n_resources; r++) {
+        const Resource *resource = storage_get(&manager->resources, r);
+        int starved = 0;
+
+        if (resource == NULL) continue;
+
+        for (int i = 0; i < quiescence->n_systems; i++) {
+            if (quiescence->starved_on[i] == resource) starved++;
+        }
+        if (starved == 0) continue;
+
+        printf("  Starved resource [%s] at %d / %d, waited on by %d system(s), producers:",
+            resource->info.name, quiescence->amounts[r], resource->max_capacity, starved);
+        int producers = 0;
+        for (int i = 0; i < quiescence->n_systems; i++) {
+            const System *system = system_array_get(&manager->system_array, i);
+            if (system == NULL || system->recipe->output != resource) continue;
+            printf(" [%s%s]", system->info.name, quiescence->starved_on[i] ? ", starved" : "");
+            producers++;
+        }
+        printf("%s\n", producers ? "" : " none");
+    }
+}
+
+/**
+ * Local helper that sizes the tracking arrays to the manager's systems and resources.
+ *
+ * Existing starvation marks are kept, and the grace period is recomputed from the slowest cycle.
+ *
+ * @param[in,out] quiescence Pointer to the `Quiescence` detector.
+ * @param[in]     manager    Pointer to the `Manager` being watched.
+ */
+static void quiescence_resize(Quiescence *quiescence, const Manager *manager) {
+    int n_systems = system_array_size(&manager->system_array);
+    int n_resources = storage_size(&manager->resources);
+
+    // Manually allocate new memory and copy over (can't use realloc)
+    Resource **starved_on = sim_alloc((n_systems > 0 ? n_systems : 1) * sizeof(Resource *));
+    int *amounts = sim_alloc((n_resources > 0 ? n_resources : 1) * sizeof(int));
+    assert(starved_on != NULL && amounts != NULL);
+    memset(starved_on, 0, (n_systems > 0 ? n_systems : 1) * sizeof(Resource *));
+    memset(amounts, 0, (n_resources > 0 ? n_resources : 1) * sizeof(int));
+    for (int i = 0; i < quiescence->n_systems && i < n_systems; i++) {
+        starved_on[i] = quiescence->starved_on[i];
+    }
+    for (int i = 0; i < quiescence->n_resources && i < n_resources; i++) {
+        amounts[i] = quiescence->amounts[i];
+    }
+
+    sim_free(quiescence->starved_on);
+    sim_free(quiescence->amounts);
+    quiescence->starved_on = starved_on;
+    quiescence->amounts = amounts;
+    quiescence->n_systems = n_systems;
+    quiescence->n_resources = n_resources;
+
+    // A system's longest cycle is its processing time in slow mode plus the pause between loops
+    quiescence->grace_ms = 0;
+    for (int i = 0; i < n_systems; i++) {
+        const System *system = system_array_get(&manager->system_array, i);
+        if (system == NULL) continue;
+        long cycle = system->recipe->processing_time * 4L + PARAM_SYSTEM_WAIT;
+        if (cycle > quiescence->grace_ms) quiescence->grace_ms = cycle;
+    }
+}
+
+/**
+ * Local helper that checks whether every system that is still running is starved.
+ *
+ * @param[in] quiescence Pointer to the `Quiescence` detector.
+ * @param[in] manager    Pointer to the `Manager` being watched.
+ * @return 1 if at least one system runs and all running systems are starved, 0 otherwise.
+ */
+static int quiescence_all_starved(const Quiescence *quiescence, const Manager *manager) {
+    int running = 0;
+
+    for (int i = 0; i < quiescence->n_systems; i++) {
+        const System *system = system_array_get(&manager->system_array, i);
+        if (system == NULL || system_get_mode(system) == MODE_TERMINATE) continue;
+        if (quiescence->starved_on[i] == NULL) return 0;
+        running++;
+    }
+    return running > 0;
+}
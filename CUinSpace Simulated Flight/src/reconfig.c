@@ -0,0 +1,230 @@
+/***************************************************************
+ * reconfig.c
+ * Contains the runtime attaching and detaching of systems and resources.
+ * The manager and the display keep iterating the arrays without locks while this runs. Attached
+ * entries are published with the array's size, detached ones leave an empty slot and are only
+ * freed through `epoch_retire()` once every reader that could still hold them has moved on.
+ * Writers are serialized among themselves by `reconfig_lock()`, which never pauses the simulation.
+ ***************************************************************/
+
+#include "defs.h"
+
+static pthread_mutex_t reconfig_mutex;
+static pthread_once_t reconfig_once = PTHREAD_ONCE_INIT;
+
+static void reconfig_init_mutex(void);
+static void reconfig_destroy_system(void *system);
+static void reconfig_destroy_resource(void *resource);
+static int  reconfig_wait(const Manager *manager, long start_ms, long at_ms);
+
+/**
+ * Locks out every other writer of the system and resource arrays, so the caller can read them without
+ * `epoch_enter()` and make several changes in a row. Calls may nest, the reconfiguration functions lock too.
+ */
+void reconfig_lock(void) {
+    pthread_once(&reconfig_once, reconfig_init_mutex);
+    pthread_mutex_lock(&reconfig_mutex);
+}
+
+/**
+ * Releases the lock taken by `reconfig_lock()`.
+ */
+void reconfig_unlock(void) {
+    pthread_mutex_unlock(&reconfig_mutex);
+}
+
+/**
+ * Attaches a resource to the running simulation.
+ *
+ * @param[in,out] manager  Pointer to the running `Manager`.
+ * @param[in]     resource Pointer to the `Resource` to attach, owned by the manager from now on.
+ */
+void reconfig_attach_resource(Manager *manager, Resource *resource) {
+    reconfig_lock();
+    storage_add(&manager->resources, resource);
+    reconfig_unlock();
+}
+
+/**
+ * Detaches a resource from the running simulation and frees it once no reader can see it.
+ *
+ * A system moved off the resource by `system_set_recipe()` may still be in a cycle that copied its
+ * old recipe. Blocks the caller until every such cycle has finished, like `reconfig_detach_system()`
+ * blocks on the system's current cycle.
+ *
+ * @param[in,out] manager  Pointer to the running `Manager`.
+ * @param[in]     resource Pointer to the attached `Resource` to detach.
+ * @return 0 on success, 1 if an attached system still consumes or produces the resource, or a group holds it.
+ */
+int reconfig_detach_resource(Manager *manager, Resource *resource) {
+    reconfig_lock();
+
+    // A tank stays as long as its group, and a group's total as long as it has tanks
+    if (resource->member_of != NULL || (resource->group != NULL && resource->group->n_members > 0)) {
+        reconfig_unlock();
+        return 1;
+    }
+
+    for (int i = 0; i < system_array_size(&manager->system_array); i++) {
+        const System *system = system_array_get(&manager->system_array, i);
+        if (system != NULL && (system->recipe->input == resource || system->recipe->output == resource)) {
+            reconfig_unlock();
+            return 1;
+        }
+    }
+
+    // Cycles run on a copy of the recipe outside any epoch. Waiting out the epoch makes every cycle that
+    // copied a recipe from before a swap show its resources, then the cycles still using this one are waited for
+    epoch_synchronize();
+    for (int i = 0; i < system_array_size(&manager->system_array); i++) {
+        System *system = system_array_get(&manager->system_array, i);
+        while (system != NULL && (__atomic_load_n(&system->info.cycle_input, __ATOMIC_SEQ_CST) == resource ||
+                                  __atomic_load_n(&system->info.cycle_output, __ATOMIC_SEQ_CST) == resource)) {
+            usleep(PARAM_SYSTEM_WAIT * 1000 / PARAM_SPEED_MODIFIER);
+        }
+    }
+
+    // No system refers to it anymore, so only queued events and readers mid-iteration still can
+    storage_remove(&manager->resources, resource);
+    event_queue_discard(&manager->event_queue, NULL, resource);
+    epoch_retire(resource, reconfig_destroy_resource);
+
+    reconfig_unlock();
+    return 0;
+}
+
+/**
+ * Attaches a system to the running simulation and starts its thread.
+ *
+ * @param[in,out] manager Pointer to the running `Manager`.
+ * @param[in]     system  Pointer to the `System` to attach, its recipe's resources must be attached.
+ * @return 0 on success, 1 if its thread could not be created and the system was not attached.
+ */
+int reconfig_attach_system(Manager *manager, System *system) {
+    reconfig_lock();
+    system_array_add(&manager->system_array, system);
+
+    if (pthread_create(&system->info.thread, NULL, system_thread, system) != 0) {
+        printf("Failed to create system thread %d\n", system->id);
+        system_array_remove(&manager->system_array, system);
+        epoch_synchronize();
+        reconfig_unlock();
+        return 1;
+    }
+
+    // The manager may have terminated every system just before this one became visible
+    if (!manager->simulation_running) {
+        system_set_mode(system, MODE_TERMINATE);
+    }
+
+    reconfig_unlock();
+    return 0;
+}
+
+/**
+ * Detaches a system from the running simulation, stops its thread and frees it once no reader can see it.
+ *
+ * Blocks the caller until the system's thread has finished its current cycle.
+ *
+ * @param[in,out] manager Pointer to the running `Manager`.
+ * @param[in]     system  Pointer to the attached `System` to detach.
+ */
+void reconfig_detach_system(Manager *manager, System *system) {
+    reconfig_lock();
+    system_array_remove(&manager->system_array, system);
+
+    // The manager may still set its mode from an earlier iteration, wait it out so the termination sticks
+    epoch_synchronize();
+    system_set_mode(system, MODE_TERMINATE);
+    pthread_join(system->info.thread, NULL);
+
+    // Events the manager has already popped are covered by its read-side critical section
+    event_queue_discard(&manager->event_queue, system, NULL);
+    epoch_retire(system, reconfig_destroy_system);
+
+    reconfig_unlock();
+}
+
+/**
+ * Thread function that attaches a reserve oxygen tank and the system drawing on it mid-flight,
+ * then detaches both again.
+ *
+ * @param[in] arg Pointer to the Manager structure (cast from void*)
+ * @return NULL (required for pthread function signature)
+ */
+void *reconfig_thread(void *arg) {
+    Manager *manager = (Manager *)arg;
+    long start_ms = quiescence_now_ms();
+    Resource *oxygen = NULL, *tank;
+    System *reserve;
+    Recipe recipe;
+
+    if (!reconfig_wait(manager, start_ms, PARAM_RECONFIG_ATTACH)) return NULL;
+
+    for (int i = 0; i < storage_size(&manager->resources); i++) {
+        Resource *resource = storage_get(&manager->resources, i);
+        if (resource != NULL && strcmp(resource->info.name, "Oxygen") == 0) oxygen = resource;
+    }
+    if (oxygen == NULL) return NULL;
+
+    resource_create(&tank, "Reserve Oxygen", 50, 50);
+    recipe_init(&recipe, tank, oxygen, 5, 5, 300);
+    system_create(&reserve, "Oxygen Reserve", recipe, &manager->event_queue);
+
+    reconfig_attach_resource(manager, tank);
+    if (reconfig_attach_system(manager, reserve) != 0) {
+        system_destroy(reserve);
+        reconfig_detach_resource(manager, tank);
+        return NULL;
+    }
+    printf("Reconfig: attached [%s] drawing on [%s]\n", reserve->info.name, tank->info.name); // Debug output
+
+    // If the flight ends first, both stay attached and are cleaned up with the rest
+    if (!reconfig_wait(manager, start_ms, PARAM_RECONFIG_DETACH)) return NULL;
+
+    reconfig_detach_system(manager, reserve);
+    reconfig_detach_resource(manager, tank);
+    printf("Reconfig: detached the oxygen reserve\n"); // Debug output
+
+    return NULL;
+}
+
+/**
+ * Local helper that creates the writer lock, recursive so a reload can attach and detach while holding it.
+ */
+static void reconfig_init_mutex(void) {
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&reconfig_mutex, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+/**
+ * Local helper that frees a retired system.
+ */
+static void reconfig_destroy_system(void *system) {
+    system_destroy((System *)system);
+}
+
+/**
+ * Local helper that frees a retired resource.
+ */
+static void reconfig_destroy_resource(void *resource) {
+    resource_destroy((Resource *)resource);
+}
+
+/**
+ * Local helper that waits until a point in the flight.
+ *
+ * @param[in] manager  Pointer to the running `Manager`.
+ * @param[in] start_ms Simulated time the flight started.
+ * @param[in] at_ms    Simulated milliseconds into the flight to wait for.
+ * @return 1 once the point is reached, 0 if the simulation ended first.
+ */
+static int reconfig_wait(const Manager *manager, long start_ms, long at_ms) {
+    while (manager->simulation_running && quiescence_now_ms() - start_ms < at_ms) {
+        usleep(PARAM_MANAGER_WAIT * 1000 / PARAM_SPEED_MODIFIER);
+    }
+    return manager->simulation_running;
+}
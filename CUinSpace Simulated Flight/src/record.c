@@ -0,0 +1,432 @@
+/***************************************************************
+ * record.c
+ * Contains the event log recorder and the replay engine.
+ * While recording, every event queue push and pop, resource transfer and mode change is
+ * appended to a per-thread buffer with a sequence number taken inside the operation's critical
+ * section, so the sequence numbers are the order the operations really happened in. The buffers
+ * are merged into one binary log at the end. Replaying re-executes the logged operations in that
+ * order on a freshly loaded manager, single-threaded and without any sleeps.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#include <sys/time.h>
+
+#define RECORD_MAGIC   0x52535543  // "CUSR" in little endian
+#define RECORD_VERSION 1
+
+// One logged operation, packed since logs of long runs get large
+typedef struct __attribute__((packed)) Record {
+    uint64_t seq;       // Global order of the operation
+    uint8_t kind;       // RECORD_PUSH, RECORD_POP, ...
+    uint16_t code;      // Event status (with its priority bits) for pushes and pops, the new mode for mode changes
+    int32_t system;     // System of the event, the changed system, or the system transferring (-1 if unknown)
+    int32_t resource;   // Resource of the event or transfer, -1 for none
+    int32_t amount;     // Amount a transfer asked for
+    int32_t moved;      // Amount a transfer actually moved
+} Record;
+
+// Start of a log file
+typedef struct RecordHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;         // Number of records following the header
+    int32_t n_systems;      // Size of the recorded simulation, checked against the replaying one
+    int32_t n_resources;
+    int64_t duration_ms;    // Simulated milliseconds the recording covered
+} RecordHeader;
+
+// Records of one thread, in sequence order
+typedef struct RecordBuffer {
+    Record *records;
+    int size;
+    int capacity;
+    int actor;                  // System the thread runs, -1 for none
+    struct RecordBuffer *next;  // Next buffer in the list of all buffers
+} RecordBuffer;
+
+static int record_active = 0;                   // Whether operations are being recorded
+static uint64_t record_seq = 0;                 // Next sequence number
+static long record_start_ms = 0;                // Simulated time the recording started
+static RecordBuffer *record_buffers = NULL;     // Buffers of every thread that recorded something
+static sem_t record_lock;                       // Protects the list of buffers
+static __thread RecordBuffer *record_local = NULL;
+static const Record *record_expected = NULL;    // Mode changes the manager benchmark expects, NULL when not benchmarking
+static uint64_t record_n_expected = 0;
+static uint64_t record_next_expected = 0;       // Number of expected mode changes seen so far
+static uint64_t record_mismatches = 0;          // Mode changes that differed from the expected ones
+
+static RecordBuffer *record_buffer(void);
+static void record_add(uint8_t kind, uint16_t code, int system, int resource, int amount, int moved);
+static int record_compare(const void *a, const void *b);
+static int record_replay_one(Manager *manager, const Record *record);
+static Record *record_load(const Manager *manager, const char *path, RecordHeader *header);
+
+/**
+ * Starts recording every operation that changes the simulation.
+ */
+void record_start(void) {
+    int result = sem_init(&record_lock, 0, 1);
+    assert(result == 0); // Check if the semaphore was initialized successfully
+
+    record_seq = 0;
+    record_start_ms = quiescence_now_ms();
+    record_active = 1;
+}
+
+/**
+ * Stops recording and writes the merged log.
+ *
+ * Must be called once every thread that recorded has finished.
+ *
+ * @param[in] manager Pointer to the `Manager` that was recorded.
+ * @param[in] path    Path of the log file to write.
+ * @return 0 on success, 1 if the file could not be written.
+ */
+int record_finish(const Manager *manager, const char *path) {
+    RecordHeader header;
+    uint64_t count = 0;
+    int failed = 0;
+
+    if (!record_active) return 1;
+    record_active = 0;
+
+    // Each buffer is already in order, so sorting the merged records only interleaves them
+    for (RecordBuffer *buffer = record_buffers; buffer != NULL; buffer = buffer->next) {
+        count += buffer->size;
+    }
+    Record *records = malloc((count > 0 ? count : 1) * sizeof(Record));
+    assert(records != NULL);
+    count = 0;
+    while (record_buffers != NULL) {
+        RecordBuffer *buffer = record_buffers;
+        memcpy(&records[count], buffer->records, buffer->size * sizeof(Record));
+        count += buffer->size;
+        record_buffers = buffer->next;
+        free(buffer->records);
+        free(buffer);
+    }
+    qsort(records, count, sizeof(Record), record_compare);
+    sem_destroy(&record_lock);
+
+    header.magic = RECORD_MAGIC;
+    header.version = RECORD_VERSION;
+    header.count = count;
+    header.n_systems = manager->system_array.size;
+    header.n_resources = manager->resources.size;
+    header.duration_ms = quiescence_now_ms() - record_start_ms;
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL || fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(records, sizeof(Record), count, file) != count) {
+        printf("Failed to write the event log to %s\n", path);
+        failed = 1;
+    } else {
+        printf("Recorded %llu operations over %.1f simulated seconds to %s (%zu bytes each)\n",
+            (unsigned long long)count, header.duration_ms / 1000.0, path, sizeof(Record));
+    }
+    if (file != NULL) fclose(file);
+    free(records);
+    return failed;
+}
+
+/**
+ * Tells the recorder which system the calling thread runs, so its transfers can be attributed.
+ *
+ * @param[in] system Id of the system, -1 for none.
+ */
+void record_attach(int system) {
+    if (record_active) {
+        record_buffer()->actor = system;
+    }
+}
+
+/**
+ * Records an event queue push or pop. Must be called while holding the queue's mutex.
+ *
+ * @param[in] kind  `RECORD_PUSH` or `RECORD_POP`.
+ * @param[in] event The event pushed or popped.
+ */
+void record_event(int kind, const Event *event) {
+    if (record_active) {
+        record_add(kind, event->status, event->system ? event->system->id : -1, event->resource ? event->resource->id : -1, 0, 0);
+    }
+}
+
+/**
+ * Records a resource transfer. Must be called while holding the resource's mutex.
+ *
+ * @param[in] kind     `RECORD_TRANSFER_FROM` or `RECORD_TRANSFER_INTO`.
+ * @param[in] resource The resource transferred from or into.
+ * @param[in] amount   Amount the transfer asked for.
+ * @param[in] moved    Amount actually moved.
+ */
+void record_transfer(int kind, const Resource *resource, int amount, int moved) {
+    if (record_active) {
+        record_add(kind, 0, record_buffer()->actor, resource->id, amount, moved);
+    }
+}
+
+/**
+ * Records a change of a system's mode, or checks it while benchmarking the manager.
+ * Must be called while holding the system's `mode_lock`.
+ *
+ * @param[in] system The system.
+ * @param[in] mode   Its new mode.
+ */
+void record_mode(const System *system, int mode) {
+    if (record_active) {
+        record_add(RECORD_SET_MODE, mode, system->id, -1, 0, 0);
+    } else if (record_expected != NULL) {
+        // Benchmarking the manager, compare with the recorded mode changes instead
+        if (record_next_expected >= record_n_expected) {
+            record_mismatches++;
+            return;
+        }
+        const Record *next = &record_expected[record_next_expected++];
+        if (next->system != system->id || next->code != mode) record_mismatches++;
+    }
+}
+
+/**
+ * Replays a recorded log on a freshly loaded manager.
+ *
+ * Every operation is re-executed through the normal queue, transfer and mode functions in the recorded
+ * order. Pops and transfers are checked against the log, so a divergence shows the log does not belong to
+ * this scenario or the code has changed since.
+ *
+ * @param[in,out] manager Pointer to the `Manager`, loaded with the same scenario as the recorded run.
+ * @param[in]     path    Path of the log file.
+ * @return 0 if the replay matched the recording, 1 otherwise.
+ */
+int record_replay(Manager *manager, const char *path) {
+    RecordHeader header;
+    struct timeval start, end;
+    uint64_t divergences = 0;
+
+    Record *records = record_load(manager, path, &header);
+    if (records == NULL) return 1;
+
+    gettimeofday(&start, NULL);
+    for (uint64_t i = 0; i < header.count; i++) {
+        if (record_replay_one(manager, &records[i]) != 0 && divergences++ == 0) {
+            printf("Replay diverged at operation %llu (kind %d, system %d, resource %d)\n",
+                (unsigned long long)records[i].seq, records[i].kind, records[i].system, records[i].resource);
+        }
+    }
+    gettimeofday(&end, NULL);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+    printf("Replayed %llu operations covering %.1f simulated seconds in %.3f s, %llu divergence(s)\n",
+        (unsigned long long)header.count, header.duration_ms / 1000.0, seconds, (unsigned long long)divergences);
+
+    free(records);
+    return divergences > 0;
+}
+
+/**
+ * Feeds the events of a recorded log to `manager_run()` alone and measures its decision throughput.
+ *
+ * No system runs: resource amounts are set from the recorded transfers, and every run of consecutively
+ * popped events is queued just before one quiet `manager_run()` call, so the manager sees the same events
+ * in the same order as in the recording. Only the `manager_run()` calls are timed. The mode changes the
+ * manager makes are checked against the recorded ones.
+ *
+ * @param[in,out] manager Pointer to the `Manager`, loaded with the same scenario as the recorded run.
+ * @param[in]     path    Path of the log file.
+ * @return 0 if the manager made exactly the recorded mode changes, 1 otherwise.
+ */
+int record_benchmark_manager(Manager *manager, const char *path) {
+    RecordHeader header;
+    struct timespec start, end;
+    uint64_t events = 0, calls = 0, expected = 0;
+    double seconds = 0;
+
+    Record *records = record_load(manager, path, &header);
+    if (records == NULL) return 1;
+
+    // The recorded mode changes are what `record_mode()` compares the manager's against
+    Record *modes = malloc((header.count > 0 ? header.count : 1) * sizeof(Record));
+    assert(modes != NULL);
+    for (uint64_t i = 0; i < header.count; i++) {
+        if (records[i].kind == RECORD_SET_MODE) modes[expected++] = records[i];
+    }
+    record_expected = modes;
+    record_n_expected = expected;
+    record_next_expected = 0;
+    record_mismatches = 0;
+
+    manager->quiet = 1;
+    for (uint64_t i = 0; i < header.count && manager->simulation_running; i++) {
+        Resource *resource = records[i].resource >= 0 ? manager->resources.resources[records[i].resource] : NULL;
+
+        // Nothing else runs, the amounts are set directly but still counted
+        if (records[i].kind == RECORD_TRANSFER_FROM) {
+            resource->amount -= records[i].moved;
+            invariant_transfer(resource, INVARIANT_CONSUMED, records[i].moved);
+        } else if (records[i].kind == RECORD_TRANSFER_INTO) {
+            resource->amount += records[i].moved;
+            invariant_transfer(resource, INVARIANT_PRODUCED, records[i].moved);
+        } else if (records[i].kind == RECORD_POP) {
+            Event event;
+            uint64_t j = i;
+            for (; j < header.count && records[j].kind == RECORD_POP; j++) {
+                event_init(&event, manager->system_array.systems[records[j].system], manager->resources.resources[records[j].resource], records[j].code);
+                event_queue_push(&manager->event_queue, &event);
+            }
+            events += j - i;
+            i = j - 1;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            manager_run(manager);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            seconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            calls++;
+        }
+    }
+    manager->quiet = 0;
+
+    int matched = record_mismatches == 0 && record_next_expected == record_n_expected;
+    printf("Manager benchmark: %llu events in %llu manager_run() calls, %.6f s, %.0f events/s, %.1f ns per event\n",
+        (unsigned long long)events, (unsigned long long)calls, seconds,
+        seconds > 0 ? events / seconds : 0.0, events > 0 ? seconds * 1e9 / events : 0.0);
+    printf("Mode changes: %llu of %llu recorded, %llu mismatched, sequence %s the recording\n",
+        (unsigned long long)record_next_expected, (unsigned long long)record_n_expected,
+        (unsigned long long)record_mismatches, matched ? "matches" : "DIFFERS FROM");
+
+    record_expected = NULL;
+    free(modes);
+    free(records);
+    return !matched;
+}
+
+/**
+ * Local helper that reads a log file and checks it belongs to the loaded scenario.
+ *
+ * @param[in]  manager Pointer to the loaded `Manager`.
+ * @param[in]  path    Path of the log file.
+ * @param[out] header  The log's header.
+ * @return The log's records, to be freed by the caller, or NULL if the log could not be used.
+ */
+static Record *record_load(const Manager *manager, const char *path, RecordHeader *header) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL || fread(header, sizeof(RecordHeader), 1, file) != 1 ||
+        header->magic != RECORD_MAGIC || header->version != RECORD_VERSION) {
+        printf("Failed to read an event log from %s\n", path);
+        if (file != NULL) fclose(file);
+        return NULL;
+    }
+    if (header->n_systems != manager->system_array.size || header->n_resources != manager->resources.size) {
+        printf("Event log has %d systems and %d resources, the simulation has %d and %d\n",
+            header->n_systems, header->n_resources, manager->system_array.size, manager->resources.size);
+        fclose(file);
+        return NULL;
+    }
+
+    Record *records = malloc((header->count > 0 ? header->count : 1) * sizeof(Record));
+    assert(records != NULL);
+    if (fread(records, sizeof(Record), header->count, file) != header->count) {
+        printf("Event log %s is truncated\n", path);
+        free(records);
+        records = NULL;
+    }
+    fclose(file);
+    return records;
+}
+
+/**
+ * Local helper that finds the calling thread's buffer, creating and registering it on first use.
+ *
+ * @return The thread's `RecordBuffer`.
+ */
+static RecordBuffer *record_buffer(void) {
+    if (record_local == NULL) {
+        record_local = calloc(1, sizeof(RecordBuffer));
+        assert(record_local != NULL);
+        record_local->actor = -1;
+
+        sem_wait(&record_lock);
+        record_local->next = record_buffers;
+        record_buffers = record_local;
+        sem_post(&record_lock);
+    }
+    return record_local;
+}
+
+/**
+ * Local helper that appends one record to the calling thread's buffer.
+ */
+static void record_add(uint8_t kind, uint16_t code, int system, int resource, int amount, int moved) {
+    RecordBuffer *buffer = record_buffer();
+
+    if (buffer->size == buffer->capacity) {
+        // Manually allocate new memory and copy over (can't use realloc)
+        int capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 1024;
+        Record *records = malloc(capacity * sizeof(Record));
+        assert(records != NULL);
+        if (buffer->records != NULL) {
+            memcpy(records, buffer->records, buffer->size * sizeof(Record));
+            free(buffer->records);
+        }
+        buffer->records = records;
+        buffer->capacity = capacity;
+    }
+
+    Record *record = &buffer->records[buffer->size++];
+    record->seq = __atomic_fetch_add(&record_seq, 1, __ATOMIC_RELAXED);
+    record->kind = kind;
+    record->code = code;
+    record->system = system;
+    record->resource = resource;
+    record->amount = amount;
+    record->moved = moved;
+}
+
+/**
+ * Local helper that orders records by sequence number for `qsort()`.
+ */
+static int record_compare(const void *a, const void *b) {
+    uint64_t x = ((const Record *)a)->seq, y = ((const Record *)b)->seq;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Local helper that re-executes one recorded operation.
+ *
+ * @param[in,out] manager Pointer to the `Manager` being replayed.
+ * @param[in]     record  The operation.
+ * @return 0 if it had the recorded outcome, 1 otherwise.
+ */
+static int record_replay_one(Manager *manager, const Record *record) {
+    System *system = record->system >= 0 && record->system < manager->system_array.size ?
+        manager->system_array.systems[record->system] : NULL;
+    Resource *resource = record->resource >= 0 && record->resource < manager->resources.size ?
+        manager->resources.resources[record->resource] : NULL;
+    Event event;
+    int amount = record->amount;
+
+    invariant_attach(record->system);
+    switch (record->kind) {
+        case RECORD_PUSH:
+            event_init(&event, system, resource, record->code);
+            event_queue_push(&manager->event_queue, &event);
+            return 0;
+        case RECORD_POP:
+            if (!event_queue_pop(&manager->event_queue, &event)) return 1;
+            return event.system != system || event.resource != resource || event.status != record->code;
+        case RECORD_TRANSFER_FROM:
+            if (resource == NULL) return 1;
+            resource_transfer_from(resource, &amount);
+            return record->amount - amount != record->moved;
+        case RECORD_TRANSFER_INTO:
+            if (resource == NULL) return 1;
+            resource_transfer_into(resource, &amount);
+            return record->amount - amount != record->moved;
+        case RECORD_SET_MODE:
+            if (system == NULL) return 1;
+            system_set_mode(system, record->code);
+            return 0;
+        default:
+            return 1;
+    }
+}
@@ -0,0 +1,783 @@
+/***************************************************************
+ * remote.c
+ * Contains the transport for running systems in remote worker processes.
+ * The manager's process owns the resources and the event queue and serves them over a Unix or
+ * TCP socket. Workers only know the recipes of their systems and talk to the manager with framed
+ * binary messages: every round, the due transfers of all of a worker's systems and the events they
+ * produced are batched into one frame, answered by one reply frame carrying the transfer results,
+ * the current modes, and the recipes that changed since the worker last heard of them.
+ *
+ * Batches are pipelined: a worker keeps sending the transfers of systems that become due while up
+ * to REMOTE_PIPELINE_DEPTH earlier batches are still unanswered, and takes replies as they arrive.
+ * A system has at most one transfer in flight, and every result names its system.
+ *
+ * Every field goes over the wire as a 32-bit big-endian integer (modes as single bytes), so the
+ * format does not depend on the layout or byte order of either host.
+ * On one machine the workers are forked processes connecting over localhost.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define REMOTE_MSG_HELLO  1  // Worker -> manager: `count` is the worker index. Reply: `count` system records
+#define REMOTE_MSG_BATCH  2  // Worker -> manager: `count` op records. Reply: `count` results, the worker's modes,
+                             // then the number of changed recipes and their system records
+#define REMOTE_MSG_BYE    3  // Worker -> manager: all of the worker's systems have terminated
+
+#define REMOTE_OP_PULL    1  // Transfer `value` out of `resource`
+#define REMOTE_OP_PUSH    2  // Transfer `value` into `resource`
+#define REMOTE_OP_EVENT   3  // Push an event with status `value` about `resource`
+
+#define REMOTE_PHASE_PULL    0  // Waiting to pull the rest of its input
+#define REMOTE_PHASE_PROCESS 1  // Processing its input until `ready_at`
+#define REMOTE_PHASE_PUSH    2  // Waiting to push the rest of its output
+
+// Encoded sizes, every field is 4 bytes
+#define REMOTE_HEADER_BYTES  8   // type, count
+#define REMOTE_OP_BYTES      16  // kind, system, resource, value
+#define REMOTE_RESULT_BYTES  12  // system, remaining, level
+#define REMOTE_INFO_BYTES    36  // id, input, output, input_amount, output_amount, processing_time, low, high, mode
+
+// One operation in a batch
+typedef struct RemoteOp {
+    int32_t kind;       // One of REMOTE_OP_*
+    int32_t system;     // Id of the system doing the operation
+    int32_t resource;   // Id of the resource it is about
+    int32_t value;      // Amount for transfers, status for events
+} RemoteOp;
+
+// Result of one transfer in a batch
+typedef struct RemoteResult {
+    int32_t system;     // Id of the system that asked for the transfer
+    int32_t remaining;  // Amount that could not be transferred
+    int32_t level;      // Amount in storage after the transfer
+} RemoteResult;
+
+// Everything a worker needs to know about one of its systems
+typedef struct RemoteSystemInfo {
+    int32_t id;
+    int32_t input;      // Resource id, -1 for none
+    int32_t output;     // Resource id, -1 for none
+    int32_t input_amount;
+    int32_t output_amount;
+    int32_t processing_time;
+    int32_t low_threshold;
+    int32_t high_threshold;
+    int32_t mode;
+} RemoteSystemInfo;
+
+// Worker side state of one system
+typedef struct RemoteSystem {
+    RemoteSystemInfo info;
+    RemoteSystemInfo update;  // Recipe to switch to at the start of the next cycle, if `updated`
+    int updated;
+    int phase;          // One of REMOTE_PHASE_*
+    int amount;         // Input still to pull, or output still to push
+    int pending;        // Whether its transfer is in a batch not answered yet
+    long ready_at;      // Time in milliseconds when the system can act again
+} RemoteSystem;
+
+// Manager side state of one worker connection
+typedef struct RemoteConnection {
+    Manager *manager;
+    int fd;
+    int worker;
+} RemoteConnection;
+
+static int remote_listen(void);
+static int remote_connect(void);
+static int remote_write_all(int fd, const void *data, size_t size);
+static int remote_read_all(int fd, void *data, size_t size);
+static uint8_t *remote_put(uint8_t *at, int32_t value);
+static int32_t remote_get(const uint8_t **at);
+static uint8_t *remote_put_info(uint8_t *at, const RemoteSystemInfo *info);
+static void remote_get_info(const uint8_t **at, RemoteSystemInfo *info);
+static int remote_read_header(int fd, uint32_t *type, uint32_t *count);
+static void remote_describe(const System *system, RemoteSystemInfo *info);
+static int remote_same_recipe(const RemoteSystemInfo *a, const RemoteSystemInfo *b);
+static void *remote_serve(void *arg);
+static void remote_worker(int worker);
+static int remote_worker_reply(int fd, uint8_t *buffer, RemoteSystem *systems, int n_local, RemoteOp *events, int *n_events);
+static void remote_start_cycle(RemoteSystem *system);
+static long remote_now_ms(void);
+
+/**
+ * Runs the simulation with the systems in remote workers.
+ *
+ * Opens the listening socket, forks `REMOTE_WORKERS` loopback workers standing in for remote nodes,
+ * then serves each connection from its own thread while the manager runs in this process.
+ *
+ * @param[in,out] manager  Pointer to the loaded `Manager`.
+ * @return 0 if every worker finished normally, 1 otherwise.
+ */
+int remote_run(Manager *manager) {
+    pid_t pids[REMOTE_WORKERS];
+    pthread_t manager_thread_id, servers[REMOTE_WORKERS];
+    RemoteConnection connections[REMOTE_WORKERS];
+    int failed = 0;
+
+    int listen_fd = remote_listen();
+    if (listen_fd < 0) {
+        return 1;
+    }
+
+    // Fork the workers before any thread exists, they only ever talk to us through the socket
+    fflush(stdout);
+    for (int w = 0; w < REMOTE_WORKERS; w++) {
+        pids[w] = fork();
+        if (pids[w] == 0) {
+            close(listen_fd);
+            remote_worker(w);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (pids[w] < 0) {
+            perror("fork");
+            failed = 1;
+        }
+    }
+
+    if (pthread_create(&manager_thread_id, NULL, manager_thread, manager) != 0) {
+        printf("Failed to create manager thread\n");
+        return 1;
+    }
+
+    // The hello message tells us which worker is on which connection
+    for (int c = 0; c < REMOTE_WORKERS; c++) {
+        connections[c].manager = manager;
+        connections[c].worker = -1;
+        connections[c].fd = pids[c] > 0 ? accept(listen_fd, NULL, NULL) : -1;
+        if (connections[c].fd < 0 || pthread_create(&servers[c], NULL, remote_serve, &connections[c]) != 0) {
+            connections[c].fd = -1;
+            failed = 1;
+        }
+    }
+    close(listen_fd);
+    if (!REMOTE_USE_TCP) unlink(REMOTE_SOCKET_PATH);
+
+    for (int c = 0; c < REMOTE_WORKERS; c++) {
+        if (connections[c].fd >= 0) pthread_join(servers[c], NULL);
+    }
+    pthread_join(manager_thread_id, NULL);
+
+    for (int w = 0; w < REMOTE_WORKERS; w++) {
+        int status;
+        if (pids[w] <= 0) continue;
+        waitpid(pids[w], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("Remote worker %d did not exit cleanly\n", w);
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+/**
+ * Local helper that opens the manager's listening socket, Unix or TCP depending on `REMOTE_USE_TCP`.
+ *
+ * @return The listening file descriptor, -1 on failure.
+ */
+static int remote_listen(void) {
+    int fd;
+
+    if (REMOTE_USE_TCP) {
+        struct sockaddr_in address = {0};
+        int yes = 1;
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("socket");
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(REMOTE_TCP_PORT);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            perror("bind");
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_un address = {0};
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("socket");
+            return -1;
+        }
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, REMOTE_SOCKET_PATH, sizeof(address.sun_path) - 1);
+        unlink(REMOTE_SOCKET_PATH);
+        if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            perror("bind");
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, REMOTE_WORKERS) != 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Local helper that connects a worker to the manager.
+ *
+ * @return The connected file descriptor, -1 on failure.
+ */
+static int remote_connect(void) {
+    int fd;
+
+    if (REMOTE_USE_TCP) {
+        struct sockaddr_in address = {0};
+        int yes = 1;
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        // Frames are already batched, so send them right away
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(REMOTE_TCP_PORT);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_un address = {0};
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, REMOTE_SOCKET_PATH, sizeof(address.sun_path) - 1);
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+/**
+ * Local helper that writes a whole buffer to a socket.
+ *
+ * @return 0 on success, -1 if the connection failed.
+ */
+static int remote_write_all(int fd, const void *data, size_t size) {
+    const char *bytes = data;
+    while (size > 0) {
+        ssize_t written = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (written <= 0) return -1;
+        bytes += written;
+        size -= written;
+    }
+    return 0;
+}
+
+/**
+ * Local helper that reads exactly `size` bytes from a socket.
+ *
+ * @return 0 on success, -1 if the connection closed or failed.
+ */
+static int remote_read_all(int fd, void *data, size_t size) {
+    char *bytes = data;
+    while (size > 0) {
+        ssize_t got = read(fd, bytes, size);
+        if (got <= 0) return -1;
+        bytes += got;
+        size -= got;
+    }
+    return 0;
+}
+
+/**
+ * Local helper that appends a 32-bit field in network byte order.
+ *
+ * @return Pointer to the byte after the field.
+ */
+static uint8_t *remote_put(uint8_t *at, int32_t value) {
+    uint32_t bits = htonl((uint32_t)value);
+    memcpy(at, &bits, sizeof(bits));
+    return at + sizeof(bits);
+}
+
+/**
+ * Local helper that reads a 32-bit field in network byte order and moves past it.
+ */
+static int32_t remote_get(const uint8_t **at) {
+    uint32_t bits;
+    memcpy(&bits, *at, sizeof(bits));
+    *at += sizeof(bits);
+    return (int32_t)ntohl(bits);
+}
+
+/**
+ * Local helper that appends a system record, REMOTE_INFO_BYTES long.
+ *
+ * @return Pointer to the byte after the record.
+ */
+static uint8_t *remote_put_info(uint8_t *at, const RemoteSystemInfo *info) {
+    at = remote_put(at, info->id);
+    at = remote_put(at, info->input);
+    at = remote_put(at, info->output);
+    at = remote_put(at, info->input_amount);
+    at = remote_put(at, info->output_amount);
+    at = remote_put(at, info->processing_time);
+    at = remote_put(at, info->low_threshold);
+    at = remote_put(at, info->high_threshold);
+    return remote_put(at, info->mode);
+}
+
+/**
+ * Local helper that reads a system record and moves past it.
+ */
+static void remote_get_info(const uint8_t **at, RemoteSystemInfo *info) {
+    info->id = remote_get(at);
+    info->input = remote_get(at);
+    info->output = remote_get(at);
+    info->input_amount = remote_get(at);
+    info->output_amount = remote_get(at);
+    info->processing_time = remote_get(at);
+    info->low_threshold = remote_get(at);
+    info->high_threshold = remote_get(at);
+    info->mode = remote_get(at);
+}
+
+/**
+ * Local helper that reads a frame header.
+ *
+ * @return 0 on success, -1 if the connection closed or failed.
+ */
+static int remote_read_header(int fd, uint32_t *type, uint32_t *count) {
+    uint8_t header[REMOTE_HEADER_BYTES];
+    const uint8_t *at = header;
+
+    if (remote_read_all(fd, header, sizeof(header)) != 0) return -1;
+    *type = (uint32_t)remote_get(&at);
+    *count = (uint32_t)remote_get(&at);
+    return 0;
+}
+
+/**
+ * Local helper that describes a system's current recipe and mode. Must be called inside
+ * `epoch_enter()`, the recipe may be swapped meanwhile.
+ */
+static void remote_describe(const System *system, RemoteSystemInfo *info) {
+    const Recipe *recipe = __atomic_load_n(&system->recipe, __ATOMIC_ACQUIRE);
+
+    info->id = system->id;
+    info->input = recipe->input ? recipe->input->id : -1;
+    info->output = recipe->output ? recipe->output->id : -1;
+    info->input_amount = recipe->input_amount;
+    info->output_amount = recipe->output_amount;
+    info->processing_time = recipe->processing_time;
+    info->low_threshold = recipe->low_threshold;
+    info->high_threshold = recipe->high_threshold;
+    info->mode = system_get_mode(system);
+}
+
+/**
+ * Local helper that tells whether two system records hold the same recipe, whatever their modes.
+ */
+static int remote_same_recipe(const RemoteSystemInfo *a, const RemoteSystemInfo *b) {
+    return a->input == b->input && a->output == b->output && a->input_amount == b->input_amount &&
+        a->output_amount == b->output_amount && a->processing_time == b->processing_time &&
+        a->low_threshold == b->low_threshold && a->high_threshold == b->high_threshold;
+}
+
+/**
+ * Local helper, thread function serving one worker connection on the manager's side.
+ *
+ * Applies every operation of a batch in order against the real resources and event queue, then
+ * answers with the transfer results, the current modes of the worker's systems and their recipes
+ * that were replaced since the worker was last told. If the worker disappears without saying
+ * goodbye, its systems are marked terminated.
+ *
+ * @param[in] arg Pointer to the `RemoteConnection` to serve.
+ * @return NULL
+ */
+static void *remote_serve(void *arg) {
+    RemoteConnection *connection = arg;
+    Manager *manager = connection->manager;
+    uint32_t type, count;
+    int n = manager->system_array.size, n_local = 0, clean = 0;
+    uint8_t *frame = NULL, *reply = NULL;
+    uint32_t op_capacity = 0;
+
+    // Hello: tell the worker about its systems
+    if (remote_read_header(connection->fd, &type, &count) != 0 || type != REMOTE_MSG_HELLO) {
+        close(connection->fd);
+        return NULL;
+    }
+    connection->worker = count;
+
+    // What the worker was last told about each of its systems
+    RemoteSystemInfo *infos = malloc((n / REMOTE_WORKERS + 1) * sizeof(RemoteSystemInfo));
+    uint8_t *hello = malloc(REMOTE_HEADER_BYTES + (n / REMOTE_WORKERS + 1) * REMOTE_INFO_BYTES);
+    assert(infos != NULL && hello != NULL);
+    uint8_t *out = hello + REMOTE_HEADER_BYTES;
+    epoch_enter();
+    for (int i = connection->worker; i < n; i += REMOTE_WORKERS) {
+        remote_describe(manager->system_array.systems[i], &infos[n_local]);
+        out = remote_put_info(out, &infos[n_local++]);
+    }
+    epoch_exit();
+    remote_put(remote_put(hello, REMOTE_MSG_HELLO), n_local);
+    if (remote_write_all(connection->fd, hello, out - hello) != 0) {
+        n_local = 0;
+    }
+    free(hello);
+
+    while (n_local > 0 && remote_read_header(connection->fd, &type, &count) == 0) {
+        int n_results = 0, n_changed = 0;
+
+        if (type == REMOTE_MSG_BYE) {
+            clean = 1;
+            break;
+        }
+        if (type != REMOTE_MSG_BATCH) break;
+
+        // A reply holds at most a result per op, every mode and every recipe
+        if (count > op_capacity) {
+            free(frame);
+            free(reply);
+            op_capacity = count * 2;
+            frame = malloc(op_capacity * REMOTE_OP_BYTES);
+            reply = malloc(REMOTE_HEADER_BYTES + op_capacity * REMOTE_RESULT_BYTES + n_local + 4 + n_local * REMOTE_INFO_BYTES);
+            assert(frame != NULL && reply != NULL);
+        }
+        if (remote_read_all(connection->fd, frame, count * REMOTE_OP_BYTES) != 0) break;
+
+        const uint8_t *in = frame;
+        out = reply + REMOTE_HEADER_BYTES;
+        for (uint32_t k = 0; k < count; k++) {
+            RemoteOp op;
+            op.kind = remote_get(&in);
+            op.system = remote_get(&in);
+            op.resource = remote_get(&in);
+            op.value = remote_get(&in);
+            if (op.system < 0 || op.system >= n || op.resource < 0 || op.resource >= manager->resources.size) continue;
+            Resource *resource = manager->resources.resources[op.resource];
+            int amount = op.value, level;
+
+            if (op.kind == REMOTE_OP_EVENT) {
+                Event event;
+                event_init(&event, manager->system_array.systems[op.system], resource, op.value);
+                event_queue_push(&manager->event_queue, &event);
+                continue;
+            }
+
+            invariant_attach(op.system);
+            audit_attach(op.system);
+            if (op.kind == REMOTE_OP_PULL) {
+                resource_transfer_from(resource, &amount);
+            } else {
+                resource_transfer_into(resource, &amount);
+            }
+            sem_wait(&resource->mutex);
+            level = resource->amount;
+            sem_post(&resource->mutex);
+
+            out = remote_put(out, op.system);
+            out = remote_put(out, amount);
+            out = remote_put(out, level);
+            n_results++;
+        }
+
+        // Modes, then the recipes swapped since the worker was last told
+        epoch_enter();
+        for (int l = 0; l < n_local; l++) {
+            *out++ = (uint8_t)system_get_mode(manager->system_array.systems[infos[l].id]);
+        }
+        uint8_t *changed_at = out;
+        out += 4;
+        for (int l = 0; l < n_local; l++) {
+            RemoteSystemInfo current;
+            remote_describe(manager->system_array.systems[infos[l].id], &current);
+            if (remote_same_recipe(&current, &infos[l])) continue;
+
+            infos[l] = current;
+            out = remote_put_info(out, &current);
+            n_changed++;
+        }
+        epoch_exit();
+        remote_put(changed_at, n_changed);
+        remote_put(remote_put(reply, REMOTE_MSG_BATCH), n_results);
+
+        if (remote_write_all(connection->fd, reply, out - reply) != 0) break;
+    }
+
+    if (!clean) {
+        printf("Remote worker %d disconnected, terminating its systems\n", connection->worker);
+        for (int l = 0; l < n_local; l++) {
+            system_set_mode(manager->system_array.systems[infos[l].id], MODE_TERMINATE);
+        }
+    }
+
+    close(connection->fd);
+    free(infos);
+    free(frame);
+    free(reply);
+    return NULL;
+}
+
+/**
+ * Local helper that runs a worker, standing in for a remote node.
+ *
+ * Runs the same cycle as `system_run()` for each of its systems, but as a state machine so one
+ * thread can drive all of them: every round the due transfers and pending events of all systems go
+ * out in one batch, without waiting for the batches still in flight, and each reply moves the
+ * systems it answers to their next phase.
+ *
+ * @param[in] worker Index of this worker.
+ */
+static void remote_worker(int worker) {
+    uint32_t type, count;
+    RemoteSystem *systems = NULL;
+    RemoteOp *events = NULL;
+    uint8_t *frame = NULL, *buffer = NULL;
+    int n_local, n_events = 0, in_flight = 0;
+
+    int fd = remote_connect();
+    if (fd < 0) {
+        printf("Remote worker %d could not connect\n", worker);
+        return;
+    }
+
+    uint8_t hello[REMOTE_HEADER_BYTES];
+    remote_put(remote_put(hello, REMOTE_MSG_HELLO), worker);
+    if (remote_write_all(fd, hello, sizeof(hello)) != 0 || remote_read_header(fd, &type, &count) != 0 || type != REMOTE_MSG_HELLO) {
+        close(fd);
+        return;
+    }
+    n_local = count;
+    systems = calloc(n_local + 1, sizeof(RemoteSystem));
+    // Between two batches a system raises at most its PRODUCED event and one event from its result
+    events = malloc((n_local * 2 + 1) * sizeof(RemoteOp));
+    // A batch holds at most one transfer per system plus the events, a reply one result per system
+    frame = malloc(REMOTE_HEADER_BYTES + (n_local * 3 + 1) * REMOTE_OP_BYTES);
+    buffer = malloc(n_local * (REMOTE_RESULT_BYTES + 1 + REMOTE_INFO_BYTES) + 4 + REMOTE_INFO_BYTES);
+    assert(systems != NULL && events != NULL && frame != NULL && buffer != NULL);
+
+    if (remote_read_all(fd, buffer, n_local * REMOTE_INFO_BYTES) != 0) n_local = 0;
+    const uint8_t *in = buffer;
+    for (int l = 0; l < n_local; l++) {
+        remote_get_info(&in, &systems[l].info);
+        systems[l].phase = REMOTE_PHASE_PULL;
+        systems[l].amount = systems[l].info.input_amount;
+    }
+
+    for (;;) {
+        long now = remote_now_ms(), next = now + PARAM_MANAGER_WAIT;
+        int n_ops = 0, running = 0;
+        uint8_t *out = frame + REMOTE_HEADER_BYTES;
+
+        // Finish processing that is done, then collect every transfer that is due
+        for (int l = 0; l < n_local; l++) {
+            RemoteSystem *system = &systems[l];
+            int mode = system->info.mode;
+            if (mode == MODE_TERMINATE) continue;
+            running++;
+            if (system->pending) continue;
+            if (mode == MODE_DISABLED || system->ready_at > now) {
+                if (mode != MODE_DISABLED && system->ready_at < next) next = system->ready_at;
+                continue;
+            }
+            // Due, but goes out with the batch after the next reply
+            if (in_flight == REMOTE_PIPELINE_DEPTH) continue;
+
+            if (system->phase == REMOTE_PHASE_PROCESS) {
+                RemoteOp produced = {REMOTE_OP_EVENT, system->info.id, system->info.input, EVENT_PRODUCED};
+                events[n_events++] = produced;
+                if (system->info.output < 0) {
+                    remote_start_cycle(system);
+                    system->ready_at = now + PARAM_SYSTEM_WAIT / PARAM_SPEED_MODIFIER;
+                    continue;
+                }
+                system->phase = REMOTE_PHASE_PUSH;
+                system->amount = system->info.output_amount;
+            }
+
+            out = remote_put(out, system->phase == REMOTE_PHASE_PULL ? REMOTE_OP_PULL : REMOTE_OP_PUSH);
+            out = remote_put(out, system->info.id);
+            out = remote_put(out, system->phase == REMOTE_PHASE_PULL ? system->info.input : system->info.output);
+            out = remote_put(out, system->amount);
+            system->pending = 1;
+            n_ops++;
+        }
+
+        if (running == 0 && in_flight == 0) break;
+
+        // Events produced since the last batch go out with this one. With nothing in flight a batch
+        // goes out even if empty, its reply brings the mode changes that wake disabled systems.
+        if (in_flight < REMOTE_PIPELINE_DEPTH && (n_ops > 0 || n_events > 0 || (in_flight == 0 && running > 0))) {
+            for (int e = 0; e < n_events; e++) {
+                out = remote_put(out, events[e].kind);
+                out = remote_put(out, events[e].system);
+                out = remote_put(out, events[e].resource);
+                out = remote_put(out, events[e].value);
+            }
+            remote_put(remote_put(frame, REMOTE_MSG_BATCH), n_ops + n_events);
+            n_events = 0;
+            if (remote_write_all(fd, frame, out - frame) != 0) break;
+            in_flight++;
+        }
+
+        // Take the replies that have arrived, waiting while the pipeline is full or until the next system is due
+        long wait = next - remote_now_ms();
+        int timeout = in_flight == REMOTE_PIPELINE_DEPTH ? -1 : (wait > 0 ? (int)wait : 0);
+        if (in_flight > 0) {
+            struct pollfd readable = {fd, POLLIN, 0};
+            int failed = 0;
+            while (in_flight > 0 && poll(&readable, 1, timeout) > 0) {
+                if (remote_worker_reply(fd, buffer, systems, n_local, events, &n_events) != 0) {
+                    failed = 1;
+                    break;
+                }
+                in_flight--;
+                timeout = 0;
+            }
+            if (failed) break;
+        } else if (timeout > 0) {
+            usleep(timeout * 1000);
+        }
+    }
+
+    uint8_t bye[REMOTE_HEADER_BYTES];
+    remote_put(remote_put(bye, REMOTE_MSG_BYE), 0);
+    remote_write_all(fd, bye, sizeof(bye));
+    close(fd);
+    free(systems);
+    free(events);
+    free(frame);
+    free(buffer);
+}
+
+/**
+ * Local helper that reads one reply of the manager and moves the systems it answers to their next phase.
+ *
+ * @param[in]     fd       The worker's connection.
+ * @param[out]    buffer   Room for the largest reply, without its header.
+ * @param[in,out] systems  The worker's systems.
+ * @param[in]     n_local  Number of systems.
+ * @param[out]    events   Events raised by the results, sent with the next batch.
+ * @param[in,out] n_events Number of events in `events`.
+ * @return 0 on success, -1 if the connection failed or the reply is malformed.
+ */
+static int remote_worker_reply(int fd, uint8_t *buffer, RemoteSystem *systems, int n_local, RemoteOp *events, int *n_events) {
+    uint32_t type, count;
+    const uint8_t *in;
+
+    if (remote_read_header(fd, &type, &count) != 0 || type != REMOTE_MSG_BATCH || count > (uint32_t)n_local) return -1;
+    size_t size = count * REMOTE_RESULT_BYTES + n_local + 4;
+    if (remote_read_all(fd, buffer, size) != 0) return -1;
+
+    // Modes first, the processing time of a pull depends on them
+    in = buffer + count * REMOTE_RESULT_BYTES;
+    for (int l = 0; l < n_local; l++) {
+        systems[l].info.mode = *in++;
+    }
+    int n_changed = remote_get(&in);
+    if (n_changed < 0 || n_changed > n_local || remote_read_all(fd, buffer + size, n_changed * REMOTE_INFO_BYTES) != 0) return -1;
+
+    long now = remote_now_ms();
+    in = buffer;
+    for (uint32_t r = 0; r < count; r++) {
+        RemoteResult result;
+        RemoteSystem *system = NULL;
+        result.system = remote_get(&in);
+        result.remaining = remote_get(&in);
+        result.level = remote_get(&in);
+        for (int l = 0; l < n_local && system == NULL; l++) {
+            if (systems[l].info.id == result.system && systems[l].pending) system = &systems[l];
+        }
+        if (system == NULL) continue;
+
+        system->pending = 0;
+        system->amount = result.remaining;
+
+        if (system->phase == REMOTE_PHASE_PULL && system->amount > 0) {
+            RemoteOp starved = {REMOTE_OP_EVENT, system->info.id, system->info.input, EVENT_INSUFFICIENT};
+            events[(*n_events)++] = starved;
+            system->ready_at = now + PARAM_SYSTEM_WAIT / PARAM_SPEED_MODIFIER;
+        }
+        else if (system->phase == REMOTE_PHASE_PULL) {
+            int time = system->info.processing_time;
+            if (system->info.mode == MODE_SLOW) time *= 4;
+            if (system->info.mode == MODE_FAST) time /= 4;
+
+            // Same thresholds as report_recipe_thresholds(), using the level right after the pull
+            if (result.level <= system->info.low_threshold) {
+                RemoteOp low = {REMOTE_OP_EVENT, system->info.id, system->info.input, EVENT_LOW};
+                events[(*n_events)++] = low;
+            } else if (result.level > system->info.high_threshold) {
+                RemoteOp high = {REMOTE_OP_EVENT, system->info.id, system->info.input, EVENT_HIGH};
+                events[(*n_events)++] = high;
+            }
+            system->phase = REMOTE_PHASE_PROCESS;
+            system->ready_at = now + time / PARAM_SPEED_MODIFIER;
+        }
+        else if (system->amount > 0) {
+            RemoteOp full = {REMOTE_OP_EVENT, system->info.id, system->info.output, EVENT_CAPACITY};
+            events[(*n_events)++] = full;
+            system->ready_at = now + PARAM_SYSTEM_WAIT / PARAM_SPEED_MODIFIER;
+        }
+        else {
+            remote_start_cycle(system);
+            system->ready_at = now + PARAM_SYSTEM_WAIT / PARAM_SPEED_MODIFIER;
+        }
+    }
+    assert(*n_events <= n_local * 2);
+
+    // Replaced recipes take effect at the start of the system's next cycle, right away if it has not pulled yet
+    in = buffer + size;
+    for (int c = 0; c < n_changed; c++) {
+        RemoteSystemInfo update;
+        remote_get_info(&in, &update);
+        for (int l = 0; l < n_local; l++) {
+            RemoteSystem *system = &systems[l];
+            if (system->info.id != update.id) continue;
+
+            system->update = update;
+            system->updated = 1;
+            if (system->phase == REMOTE_PHASE_PULL && !system->pending && system->amount == system->info.input_amount) {
+                remote_start_cycle(system);
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Local helper that starts a system's next cycle, switching to its replaced recipe if there is one.
+ */
+static void remote_start_cycle(RemoteSystem *system) {
+    if (system->updated) {
+        int mode = system->info.mode;
+        system->info = system->update;
+        system->info.mode = mode;
+        system->updated = 0;
+    }
+    system->phase = REMOTE_PHASE_PULL;
+    system->amount = system->info.input_amount;
+}
+
+/**
+ * Local helper that returns the current time in milliseconds on a monotonic clock.
+ */
+static long remote_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
@@ -6,6 +6,10 @@
 
 #include "defs.h"
 #include <assert.h>
+#include <stddef.h>
+
+// Transfers only touch the first cache line of a resource, unless forecasts or sketches are turned on
+_Static_assert(offsetof(Resource, info) == CACHE_LINE_SIZE, "the fields of a transfer must fill exactly one cache line");
 
 /**
  * Creates and initializes a `Resource` structure.
@@ -18,20 +22,39 @@
  */
 void resource_create(Resource **resource, const char *name, int amount, int max_capacity) {
     // Dynamically allocate memory for the Resource structure
-    *resource = (Resource *)malloc(sizeof(Resource));
+    *resource = (Resource *)sim_alloc(sizeof(Resource));
     assert(*resource != NULL);
     
     // Dynamically allocate and copy the name
-    (*resource)->name = (char *)malloc(strlen(name) + 1);
-    assert((*resource)->name != NULL);
-    strcpy((*resource)->name, name);
+    (*resource)->info.name = (char *)sim_alloc(strlen(name) + 1);
+    assert((*resource)->info.name != NULL);
+    strcpy((*resource)->info.name, name);
     
     // Initialize the resource values
+    (*resource)->id = -1;
     (*resource)->amount = amount;
+    (*resource)->info.initial_amount = amount;
+    (*resource)->last_system = -1;
     (*resource)->max_capacity = max_capacity;
+    (*resource)->info.forecast = NULL;
+    if (FORECAST_LEVELS) {
+        (*resource)->info.forecast = (Forecast *)sim_alloc(sizeof(Forecast));
+        assert((*resource)->info.forecast != NULL);
+        forecast_init((*resource)->info.forecast, quiescence_now_ms(), amount);
+    }
+    (*resource)->group = NULL;
+    (*resource)->member_of = NULL;
+    (*resource)->info.member = -1;
+    (*resource)->info.sketch = NULL;
+    if (SKETCH_LEVELS) {
+        (*resource)->info.sketch = (QuantileSketch *)sim_alloc(sizeof(QuantileSketch));
+        assert((*resource)->info.sketch != NULL);
+        sketch_init((*resource)->info.sketch);
+        sketch_add((*resource)->info.sketch, amount);
+    }
 
     // Initialize the semaphore
-    int result = sem_init(&(*resource)->mutex, 0, 1);
+    int result = sem_init(&(*resource)->mutex, sim_pshared(), 1);
     assert(result == 0); // Check if the semaphore was initialized successfully
 }
 
@@ -47,12 +70,15 @@ void resource_destroy(Resource *resource) {
         sem_destroy(&resource->mutex);
 
         // Free the dynamically allocated name
-        if (resource->name != NULL) {
-            free(resource->name);
+        if (resource->info.name != NULL) {
+            sim_free(resource->info.name);
         }
+        sim_free(resource->info.forecast);
+        sim_free(resource->info.sketch);
+        group_destroy(resource->group);
         
         // Free the Resource structure itself
-        free(resource);
+        sim_free(resource);
     }
 }
 
@@ -63,6 +89,12 @@ void resource_destroy(Resource *resource) {
  * @param[in,out] amount   Pointer to the amount of resource to add, will be decreased by the amount that was added.
  */
 void resource_transfer_into(Resource *resource, int *amount) {
+    // The total of a group has nothing of its own, its tanks do
+    if (resource->group != NULL) {
+        group_transfer_into(resource->group, amount);
+        return;
+    }
+
     // Acquire the semaphore
     sem_wait(&resource->mutex);
 
@@ -70,6 +102,12 @@ void resource_transfer_into(Resource *resource, int *amount) {
     int amount_to_transfer = (remaining_capacity >= *amount)? *amount : remaining_capacity;
     
     resource->amount += amount_to_transfer;
+    record_transfer(RECORD_TRANSFER_INTO, resource, *amount, amount_to_transfer);
+    invariant_transfer(resource, INVARIANT_PRODUCED, amount_to_transfer);
+    audit_transfer(resource, amount_to_transfer);
+    if (resource->member_of != NULL) group_update(resource->member_of, resource->info.member, resource->amount, resource->max_capacity);
+    if (FORECAST_LEVELS && resource->info.forecast != NULL) forecast_add(resource->info.forecast, quiescence_now_ms(), resource->amount);
+    if (SKETCH_LEVELS && resource->info.sketch != NULL) sketch_add(resource->info.sketch, resource->amount);
     *amount -= amount_to_transfer; // Decrease the amount by what was added
 
     // Release the semaphore
@@ -83,21 +121,59 @@ void resource_transfer_into(Resource *resource, int *amount) {
  * @param[in,out] amount   Pointer to the amount of resource to remove, will be decreased by the amount that was removed.
  */
 void resource_transfer_from(Resource *resource, int *amount) {
+    // The total of a group has nothing of its own, its tanks do
+    if (resource->group != NULL) {
+        group_transfer_from(resource->group, amount);
+        return;
+    }
+
     // Acquire the semaphore
     sem_wait(&resource->mutex);
 
     int amount_to_transfer = (resource->amount < *amount) ? resource->amount : *amount; // Remove all that's available
     
     resource->amount -= amount_to_transfer;
+    record_transfer(RECORD_TRANSFER_FROM, resource, *amount, amount_to_transfer);
+    invariant_transfer(resource, INVARIANT_CONSUMED, amount_to_transfer);
+    audit_transfer(resource, -amount_to_transfer);
+    if (resource->member_of != NULL) group_update(resource->member_of, resource->info.member, resource->amount, resource->max_capacity);
+    if (FORECAST_LEVELS && resource->info.forecast != NULL) forecast_add(resource->info.forecast, quiescence_now_ms(), resource->amount);
+    if (SKETCH_LEVELS && resource->info.sketch != NULL) sketch_add(resource->info.sketch, resource->amount);
     *amount -= amount_to_transfer;
 
     // Release the semaphore
     sem_post(&resource->mutex);
 }
 
+/**
+ * Thread safe function to change the capacity of a resource, anything above the new capacity is discarded.
+ * The capacity of a group's total is the sum of its tanks' and cannot be set.
+ *
+ * @param[in,out] resource     Pointer to the `Resource` to change.
+ * @param[in]     max_capacity New maximum capacity of the resource.
+ */
+void resource_set_capacity(Resource *resource, int max_capacity) {
+    if (resource->group != NULL) {
+        return;
+    }
+
+    // Acquire the semaphore
+    sem_wait(&resource->mutex);
+
+    resource->max_capacity = max_capacity;
+    if (resource->amount > max_capacity) {
+        invariant_transfer(resource, INVARIANT_DISCARDED, resource->amount - max_capacity);
+        resource->amount = max_capacity;
+    }
+    if (resource->member_of != NULL) group_update(resource->member_of, resource->info.member, resource->amount, resource->max_capacity);
+
+    // Release the semaphore
+    sem_post(&resource->mutex);
+}
+
 /**
  * Initializes a `Recipe` structure.
- * Sets the input and output resources, their amounts, and the processing time.
+ * Sets the input and output resources, their amounts, and the processing time, with the default thresholds.
  * 
  * @param[out] recipe          Pointer to the `Recipe` to initialize.
  * @param[in]  input           Pointer to the input `Resource` for the recipe.
@@ -112,6 +188,8 @@ void recipe_init(Recipe *recipe, Resource *input, Resource *output, int input_am
     recipe->input_amount = input_amount;
     recipe->output_amount = output_amount;
     recipe->processing_time = processing_time;
+    recipe->low_threshold = input_amount * PARAM_RESOURCE_LOW;
+    recipe->high_threshold = input_amount * PARAM_RESOURCE_HIGH;
 }
 
 /**
@@ -127,7 +205,7 @@ void storage_init(SharedResourceArray *array) {
     array->size = 0;
     
     // Dynamically allocate memory for the resources array
-    array->resources = (Resource **)malloc(array->capacity * sizeof(Resource *));
+    array->resources = (Resource **)sim_alloc(array->capacity * sizeof(Resource *));
     assert(array->resources != NULL);
 }
 
@@ -147,7 +225,7 @@ void storage_clean(SharedResourceArray *array) {
         
         // Free the resources array itself
         if (array->resources != NULL) {
-            free(array->resources);
+            sim_free(array->resources);
         }
         
         // Reset array fields
@@ -173,21 +251,64 @@ void storage_add(SharedResourceArray *storage, Resource *resource) {
         int new_capacity = storage->capacity * 2;
         
         // Manually allocate new memory (can't use realloc)
-        Resource **new_resources = (Resource **)malloc(new_capacity * sizeof(Resource *));
+        Resource **new_resources = (Resource **)sim_alloc(new_capacity * sizeof(Resource *));
         assert(new_resources != NULL);
         
         // Copy existing resources to new array
+        Resource **old_resources = storage->resources;
         for (int i = 0; i < storage->size; i++) {
             new_resources[i] = storage->resources[i];
         }
         
-        // Free old array and update to new one
-        free(storage->resources);
-        storage->resources = new_resources;
+        // Publish the new array, readers still iterating the old one keep it until they are done
+        __atomic_store_n(&storage->resources, new_resources, __ATOMIC_RELEASE);
+        epoch_retire(old_resources, sim_free);
         storage->capacity = new_capacity;
     }
     
-    // Add the new resource
-    storage->resources[storage->size] = resource;
-    storage->size++;
+    // Add the new resource, it becomes visible to readers with the new size
+    resource->id = storage->size;
+    __atomic_store_n(&storage->resources[storage->size], resource, __ATOMIC_RELEASE);
+    __atomic_store_n(&storage->size, storage->size + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Removes a `Resource` from a `SharedResourceArray` while it may be read, leaving its slot empty.
+ *
+ * The resource is not freed, readers may still hold it until the next `epoch_synchronize()`.
+ *
+ * @param[in,out] storage Pointer to the `SharedResourceArray` to remove the resource from.
+ * @param[in]     resource Pointer to the `Resource` to remove.
+ */
+void storage_remove(SharedResourceArray *storage, const Resource *resource) {
+    assert(storage != NULL);
+    assert(resource != NULL && resource->id >= 0 && resource->id < storage->size);
+    assert(storage->resources[resource->id] == resource);
+
+    __atomic_store_n(&storage->resources[resource->id], NULL, __ATOMIC_RELEASE);
+}
+
+/**
+ * Gets the number of slots in a `SharedResourceArray`, safe to call while resources are attached.
+ *
+ * @param[in] storage Pointer to the `SharedResourceArray`.
+ * @return The number of slots, including empty ones left by removed resources.
+ */
+int storage_size(const SharedResourceArray *storage) {
+    return __atomic_load_n(&storage->size, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Gets the `Resource` in a slot of a `SharedResourceArray`, safe to call while resources are attached or removed.
+ *
+ * Callers must be inside `epoch_enter()` if resources can be removed, and `i` must be below a
+ * size read earlier with `storage_size()`.
+ *
+ * @param[in] storage Pointer to the `SharedResourceArray`.
+ * @param[in] i     Index of the slot.
+ * @return The resource in the slot, NULL if it was removed.
+ */
+Resource *storage_get(const SharedResourceArray *storage, int i) {
+    Resource **resources = __atomic_load_n(&storage->resources, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&resources[i], __ATOMIC_ACQUIRE);
 }
@@ -0,0 +1,396 @@
+/***************************************************************
+ * ring.c
+ * Contains the event ring, a broadcast ring buffer that every pushed event is published to once.
+ * Consumers read it straight from its slots at their own pace, each with a cursor of its own: no copy per
+ * consumer, no queue per consumer and nothing popped. Producers claim a sequence with a single
+ * atomic add, write the slot and publish it; a consumer's sequence barrier is the run of published
+ * slots from its cursor on.
+ *
+ * A RING_LAG consumer sees every event, producers wait for it rather than overwrite a slot it has
+ * not read. A RING_SKIP consumer never holds producers up: when it falls a whole ring behind it
+ * jumps ahead and counts the events it missed, and a slot overwritten while it reads is caught by
+ * the slot's sequence lock. Consumers copy an event out of its slot and check the lock before
+ * following any of its pointers, since a torn event may point anywhere.
+ *
+ * Events point to systems and resources. Readers read inside an epoch read-side critical section
+ * and a detach waits for the ring with `event_ring_synchronize()` before retiring anything, so an
+ * event is never read after what it points to was freed.
+ *
+ * The manager keeps popping its own queue in priority order. The ring feeds the observers: the
+ * event log on the display, and the telemetry recorder writing every event to TELEMETRY_PATH.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#include <sched.h>
+
+static int ring_display = -1;        // Consumer of the display's event log
+static int ring_telemetry = -1;      // Consumer of the telemetry recorder
+static int ring_stopping = 0;        // Set when the telemetry recorder should read what is left and exit
+static uint64_t ring_recorded = 0;   // Events written by the telemetry recorder
+static pthread_t ring_recorder;
+static FILE *ring_file = NULL;
+
+static uint64_t event_ring_gate(EventRing *ring, uint64_t limit);
+static void event_ring_advance(RingConsumer *consumer, uint64_t next, int count_skipped);
+static void *event_ring_telemetry_thread(void *arg);
+static int  event_ring_record(EventRing *ring);
+
+/**
+ * Initializes an empty `EventRing` with no consumers.
+ *
+ * @param[out] ring Pointer to the `EventRing` to initialize.
+ */
+void event_ring_init(EventRing *ring) {
+    assert(ring != NULL);
+    assert((RING_SIZE & (RING_SIZE - 1)) == 0);
+    memset(ring, 0, sizeof(EventRing));
+    ring->gate = UINT64_MAX;
+    for (int i = 0; i < RING_MAX_CONSUMERS; i++) {
+        ring->consumers[i].policy = -1;
+    }
+}
+
+/**
+ * Adds a consumer, it reads the events published from now on. A RING_LAG consumer should subscribe
+ * before the producers start, a publish racing with its subscription may not wait for it.
+ *
+ * @param[in,out] ring   Pointer to the `EventRing`.
+ * @param[in]     policy RING_LAG to see every event, RING_SKIP to never hold the producers up.
+ * @return Id of the consumer, -1 if the ring has RING_MAX_CONSUMERS already.
+ */
+int event_ring_subscribe(EventRing *ring, int policy) {
+    for (int i = 0; i < RING_MAX_CONSUMERS; i++) {
+        RingConsumer *consumer = &ring->consumers[i];
+        int unused = -1;
+        if (!__atomic_compare_exchange_n(&consumer->policy, &unused, RING_SKIP, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) continue;
+
+        // Joins as a skipping consumer first, producers must not wait for a cursor that is not set yet
+        consumer->skipped = 0;
+        __atomic_store_n(&consumer->cursor, __atomic_load_n(&ring->claimed, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+        __atomic_store_n(&consumer->policy, policy, __ATOMIC_SEQ_CST);
+        if (policy == RING_LAG) {
+            __atomic_store_n(&ring->gate, 0, __ATOMIC_SEQ_CST);
+        }
+        return i;
+    }
+    return -1;
+}
+
+/**
+ * Removes a consumer, producers no longer wait for it.
+ *
+ * @param[in,out] ring     Pointer to the `EventRing`.
+ * @param[in]     consumer Id of the consumer, from `event_ring_subscribe()`.
+ */
+void event_ring_unsubscribe(EventRing *ring, int consumer) {
+    if (consumer < 0 || consumer >= RING_MAX_CONSUMERS) return;
+    __atomic_store_n(&ring->consumers[consumer].policy, -1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Publishes an event to every consumer. Safe to call from any number of threads at once.
+ *
+ * Waits only while a RING_LAG consumer has not read the event the slot holds from the last lap.
+ *
+ * @param[in,out] ring  Pointer to the `EventRing`.
+ * @param[in]     event Pointer to the `Event` to publish, copied into the slot.
+ */
+void event_ring_publish(EventRing *ring, const Event *event) {
+    uint64_t sequence = __atomic_fetch_add(&ring->claimed, 1, __ATOMIC_SEQ_CST);
+    RingSlot *slot = &ring->slots[sequence & (RING_SIZE - 1)];
+
+    if (sequence >= RING_SIZE) {
+        uint64_t wrap = sequence - RING_SIZE;  // Sequence the slot held on the last lap
+
+        // The gate only moves forward, it is read again only when it looks too low
+        if (__atomic_load_n(&ring->gate, __ATOMIC_ACQUIRE) <= wrap) {
+            uint64_t gate = event_ring_gate(ring, sequence);
+            if (gate <= wrap) {
+                __atomic_fetch_add(&ring->stalls, 1, __ATOMIC_RELAXED);
+                while ((gate = event_ring_gate(ring, sequence)) <= wrap) {
+                    sched_yield();
+                }
+            }
+            __atomic_store_n(&ring->gate, gate, __ATOMIC_RELEASE);
+        }
+
+        // The producer of the last lap may not be done with the slot yet
+        while (__atomic_load_n(&slot->published, __ATOMIC_ACQUIRE) != wrap + 1) {
+            sched_yield();
+        }
+    }
+
+    __atomic_store_n(&slot->published, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->event = *event;
+    __atomic_store_n(&slot->published, sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Sequence barrier of a consumer: finds the events published from its cursor on that it can read.
+ * A RING_SKIP consumer a whole ring behind is moved ahead first, the events it missed are counted.
+ *
+ * @param[in,out] ring     Pointer to the `EventRing`.
+ * @param[in]     consumer Id of the consumer.
+ * @param[out]    first    Sequence of the first event to read.
+ * @return Sequence after the last event to read, `*first` if there is none yet.
+ */
+uint64_t event_ring_available(EventRing *ring, int consumer, uint64_t *first) {
+    RingConsumer *reader = &ring->consumers[consumer];
+    uint64_t cursor = __atomic_load_n(&reader->cursor, __ATOMIC_ACQUIRE);
+
+    if (reader->policy == RING_SKIP) {
+        uint64_t claimed = __atomic_load_n(&ring->claimed, __ATOMIC_ACQUIRE);
+        if (claimed - cursor > RING_SIZE) {
+            event_ring_advance(reader, claimed - RING_SIZE, 1);
+            cursor = __atomic_load_n(&reader->cursor, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    uint64_t end = cursor;
+    while (end - cursor < RING_SIZE && __atomic_load_n(&ring->slots[end & (RING_SIZE - 1)].published, __ATOMIC_ACQUIRE) == end + 1) {
+        end++;
+    }
+    *first = cursor;
+    return end;
+}
+
+/**
+ * Gets a published event in place, between `event_ring_available()` and `event_ring_release()`.
+ * A RING_SKIP consumer copies it and checks the copy with `event_ring_valid()` before using it.
+ *
+ * @param[in] ring     Pointer to the `EventRing`.
+ * @param[in] sequence Sequence of the event.
+ * @return Pointer to the event in its slot.
+ */
+const Event *event_ring_get(const EventRing *ring, uint64_t sequence) {
+    return &ring->slots[sequence & (RING_SIZE - 1)].event;
+}
+
+/**
+ * Tells a RING_SKIP consumer whether the event it just copied was still the one published at
+ * `sequence`, or was overwritten meanwhile. A RING_LAG consumer's events are never overwritten.
+ *
+ * @param[in] ring     Pointer to the `EventRing`.
+ * @param[in] sequence Sequence of the event read.
+ * @return 1 if what was read is the event, 0 if it must be dropped.
+ */
+int event_ring_valid(const EventRing *ring, uint64_t sequence) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&ring->slots[sequence & (RING_SIZE - 1)].published, __ATOMIC_RELAXED) == sequence + 1;
+}
+
+/**
+ * Moves a consumer's cursor past the events it has read, producers may then reuse their slots.
+ *
+ * @param[in,out] ring     Pointer to the `EventRing`.
+ * @param[in]     consumer Id of the consumer.
+ * @param[in]     next     Sequence of the next event the consumer will read.
+ */
+void event_ring_release(EventRing *ring, int consumer, uint64_t next) {
+    event_ring_advance(&ring->consumers[consumer], next, 0);
+}
+
+/**
+ * Waits until no consumer can read any event published so far, so the systems and resources they
+ * point to can be retired. RING_LAG consumers are waited for, RING_SKIP consumers are moved past them.
+ *
+ * Must not be called by a consumer, or by a thread a RING_LAG consumer waits for.
+ *
+ * @param[in,out] ring Pointer to the `EventRing`.
+ */
+void event_ring_synchronize(EventRing *ring) {
+    uint64_t claimed = __atomic_load_n(&ring->claimed, __ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < RING_MAX_CONSUMERS; i++) {
+        RingConsumer *consumer = &ring->consumers[i];
+        int policy = __atomic_load_n(&consumer->policy, __ATOMIC_SEQ_CST);
+        if (policy == RING_SKIP) {
+            event_ring_advance(consumer, claimed, 1);
+        }
+        while (policy == RING_LAG && __atomic_load_n(&consumer->cursor, __ATOMIC_ACQUIRE) < claimed) {
+            sched_yield();
+            policy = __atomic_load_n(&consumer->policy, __ATOMIC_SEQ_CST);
+        }
+    }
+
+    // A skipping consumer that read its cursor before it moved is in a critical section the retire waits out
+}
+
+/**
+ * Creates the ring for the manager's event queue and subscribes the display's event log and the
+ * telemetry recorder, whose thread writes every event to `path`, truncating it.
+ *
+ * @param[in,out] manager Pointer to the loaded `Manager`, its queue publishes to the ring from now on.
+ * @param[in]     path    Path of the telemetry file.
+ * @return 0 on success, 1 if the ring, the file or the recorder could not be created.
+ */
+int event_ring_start(Manager *manager, const char *path) {
+    EventRing *ring = aligned_alloc(CACHE_LINE_SIZE, sizeof(EventRing));
+    if (ring == NULL) {
+        printf("Failed to allocate the event ring\n");
+        return 1;
+    }
+    event_ring_init(ring);
+
+    ring_file = fopen(path, "w");
+    if (ring_file == NULL) {
+        perror("open telemetry");
+        free(ring);
+        return 1;
+    }
+    fprintf(ring_file, "sequence,system,resource,status\n");
+
+    ring_display = event_ring_subscribe(ring, PARAM_RING_DISPLAY);
+    ring_telemetry = event_ring_subscribe(ring, PARAM_RING_TELEMETRY);
+    ring_stopping = 0;
+    ring_recorded = 0;
+
+    if (pthread_create(&ring_recorder, NULL, event_ring_telemetry_thread, ring) != 0) {
+        printf("Failed to create telemetry thread\n");
+        fclose(ring_file);
+        free(ring);
+        return 1;
+    }
+    manager->event_queue.ring = ring;
+    return 0;
+}
+
+/**
+ * Stops the telemetry recorder once it has written every event, reports what each consumer
+ * missed and frees the ring.
+ *
+ * Must be called once every thread that pushes events has finished.
+ *
+ * @param[in,out] manager Pointer to the `Manager` that ran.
+ */
+void event_ring_finish(Manager *manager) {
+    EventRing *ring = manager->event_queue.ring;
+    if (ring == NULL) return;
+
+    __atomic_store_n(&ring_stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(ring_recorder, NULL);
+    fclose(ring_file);
+    ring_file = NULL;
+
+    printf("Event ring: %llu event(s) published, %llu publish(es) waited for a lagging consumer\n",
+        (unsigned long long)ring->claimed, (unsigned long long)ring->stalls);
+    printf("  Display    (%s) skipped %llu\n", PARAM_RING_DISPLAY == RING_LAG ? "lag" : "skip",
+        (unsigned long long)ring->consumers[ring_display].skipped);
+    printf("  Telemetry  (%s) skipped %llu, wrote %llu to %s\n", PARAM_RING_TELEMETRY == RING_LAG ? "lag" : "skip",
+        (unsigned long long)ring->consumers[ring_telemetry].skipped, (unsigned long long)ring_recorded, TELEMETRY_PATH);
+
+    manager->event_queue.ring = NULL;
+    free(ring);
+}
+
+/**
+ * Shows the events published since the display last read the ring, except the ignored ones.
+ * Called by the manager thread.
+ *
+ * @param[in,out] manager Pointer to the running `Manager`.
+ */
+void event_ring_display(Manager *manager) {
+    EventRing *ring = manager->event_queue.ring;
+    uint64_t first;
+    if (ring == NULL) return;
+
+    epoch_enter();
+    uint64_t end = event_ring_available(ring, ring_display, &first);
+    for (uint64_t sequence = first; sequence < end; sequence++) {
+        Event event = *event_ring_get(ring, sequence);
+
+        // Overwritten while copied, the copy may mix two events
+        if (PARAM_RING_DISPLAY == RING_SKIP && !event_ring_valid(ring, sequence)) {
+            __atomic_fetch_add(&ring->consumers[ring_display].skipped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (event.priority != PRIORITY_IGN) display_event(&event);
+    }
+    event_ring_release(ring, ring_display, end);
+    epoch_exit();
+}
+
+/**
+ * Local helper that finds the lowest cursor of the RING_LAG consumers.
+ *
+ * @param[in] limit Returned if no consumer is lower.
+ */
+static uint64_t event_ring_gate(EventRing *ring, uint64_t limit) {
+    uint64_t gate = limit;
+    for (int i = 0; i < RING_MAX_CONSUMERS; i++) {
+        const RingConsumer *consumer = &ring->consumers[i];
+        if (__atomic_load_n(&consumer->policy, __ATOMIC_SEQ_CST) != RING_LAG) continue;
+
+        uint64_t cursor = __atomic_load_n(&consumer->cursor, __ATOMIC_ACQUIRE);
+        if (cursor < gate) gate = cursor;
+    }
+    return gate;
+}
+
+/**
+ * Local helper that moves a cursor forward to `next`, never back: a skipping consumer's cursor is
+ * also moved by `event_ring_synchronize()`.
+ *
+ * @param[in,out] consumer      The consumer.
+ * @param[in]     next          Sequence of the next event it reads.
+ * @param[in]     count_skipped Whether the events passed over were never read.
+ */
+static void event_ring_advance(RingConsumer *consumer, uint64_t next, int count_skipped) {
+    uint64_t cursor = __atomic_load_n(&consumer->cursor, __ATOMIC_ACQUIRE);
+    while (cursor < next) {
+        if (__atomic_compare_exchange_n(&consumer->cursor, &cursor, next, 0, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)) {
+            if (count_skipped) __atomic_fetch_add(&consumer->skipped, next - cursor, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+/**
+ * Local helper run by the telemetry thread, records every `PARAM_TELEMETRY_WAIT` milliseconds
+ * until stopped, then records what is left.
+ *
+ * @param[in] arg Pointer to the `EventRing` to record.
+ */
+static void *event_ring_telemetry_thread(void *arg) {
+    EventRing *ring = (EventRing *)arg;
+
+    while (!__atomic_load_n(&ring_stopping, __ATOMIC_ACQUIRE)) {
+        if (event_ring_record(ring) == 0) {
+            usleep(PARAM_TELEMETRY_WAIT * 1000);
+        }
+    }
+
+    // Every producer has finished, whatever is published can be written
+    while (event_ring_record(ring) > 0) {
+    }
+    fflush(ring_file);
+    return NULL;
+}
+
+/**
+ * Local helper that writes the events published since the recorder last read the ring.
+ *
+ * @return The number of events read.
+ */
+static int event_ring_record(EventRing *ring) {
+    uint64_t first;
+
+    epoch_enter();
+    uint64_t end = event_ring_available(ring, ring_telemetry, &first);
+    for (uint64_t sequence = first; sequence < end; sequence++) {
+        Event event = *event_ring_get(ring, sequence);
+
+        if (PARAM_RING_TELEMETRY == RING_SKIP && !event_ring_valid(ring, sequence)) {
+            __atomic_fetch_add(&ring->consumers[ring_telemetry].skipped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        fprintf(ring_file, "%llu,%s,%s,0x%04x\n", (unsigned long long)sequence,
+            event.system->info.name, event.resource->info.name, event.status);
+        ring_recorded++;
+    }
+    event_ring_release(ring, ring_telemetry, end);
+    epoch_exit();
+    return (int)(end - first);
+}
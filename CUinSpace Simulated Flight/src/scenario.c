@@ -0,0 +1,333 @@
+/***************************************************************
+ * scenario.c
+ * Contains the hot reload of the scenario into a running simulation.
+ * A scenario file lists the resources, the systems with their recipes, and the thresholds as
+ * multiples of each recipe's input amount. A reload diffs it against the running simulation by
+ * name: capacities are changed in place, recipes are replaced as whole blocks that each system
+ * picks up at its next cycle, new resources and systems are attached and systems missing from the
+ * file are detached. Nothing is stopped while this happens. Resources missing from the file are
+ * kept, a system still running an earlier cycle may use them.
+ *
+ *     # Resources: name, starting amount, capacity
+ *     resource "Fuel" 1000 1000
+ *     # Systems: name, input, output ("-" for none), input amount, output amount, processing time in ms
+ *     system "Propulsion" "Fuel" "Distance" 5 25 500
+ *     # Thresholds: low and high, as multiples of a recipe's input amount
+ *     thresholds 2 5
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#include <signal.h>
+
+#define SCENARIO_NAME    64   // Longest name in a scenario file
+#define SCENARIO_ENTRIES 64   // Most resources or systems in a scenario file
+#define SCENARIO_WORDS   8    // Most words on a line of a scenario file
+
+// A resource as listed in a scenario file
+typedef struct ScenarioResource {
+    char name[SCENARIO_NAME];
+    int amount;
+    int capacity;
+} ScenarioResource;
+
+// A system as listed in a scenario file
+typedef struct ScenarioSystem {
+    char name[SCENARIO_NAME];
+    char input[SCENARIO_NAME];
+    char output[SCENARIO_NAME];     // Empty for none
+    int input_amount;
+    int output_amount;
+    int processing_time;
+} ScenarioSystem;
+
+// Everything a scenario file lists
+typedef struct Scenario {
+    ScenarioResource resources[SCENARIO_ENTRIES];
+    int n_resources;
+    ScenarioSystem systems[SCENARIO_ENTRIES];
+    int n_systems;
+    int low;                        // Low threshold multiplier, PARAM_RESOURCE_LOW unless listed
+    int high;                       // High threshold multiplier, PARAM_RESOURCE_HIGH unless listed
+} Scenario;
+
+static int  scenario_parse(Scenario *scenario, const char *path);
+static int  scenario_split(char *line, char **words);
+static int  scenario_apply(Manager *manager, const Scenario *scenario);
+static Resource *scenario_find_resource(const Manager *manager, const char *name);
+static System *scenario_find_system(const Manager *manager, const char *name);
+static int  scenario_lists_system(const Scenario *scenario, const char *name);
+static int  scenario_recipe_equal(const Recipe *a, const Recipe *b);
+
+/**
+ * Reloads a scenario file into the running simulation.
+ *
+ * The whole file is read and checked before anything is changed, a file with an error changes nothing.
+ *
+ * @param[in,out] manager Pointer to the running `Manager`.
+ * @param[in]     path    Path of the scenario file.
+ * @return The number of changes applied, -1 if the file could not be read or has an error.
+ */
+int scenario_reload(Manager *manager, const char *path) {
+    Scenario *scenario = malloc(sizeof(Scenario));
+    int changes = -1;
+    assert(scenario != NULL);
+
+    if (scenario_parse(scenario, path) == 0) {
+        reconfig_lock();
+        changes = scenario_apply(manager, scenario);
+        reconfig_unlock();
+        printf("Reload: applied %d change(s) from %s\n", changes, path);
+    }
+
+    free(scenario);
+    return changes;
+}
+
+/**
+ * Thread function that reloads `SCENARIO_PATH` whenever the process receives SIGHUP.
+ *
+ * SIGHUP must be blocked in every thread, so it is only ever taken here.
+ *
+ * @param[in] arg Pointer to the Manager structure (cast from void*)
+ * @return NULL (required for pthread function signature)
+ */
+void *scenario_thread(void *arg) {
+    Manager *manager = (Manager *)arg;
+    struct timespec timeout = {0, PARAM_MANAGER_WAIT * 1000000L};
+    sigset_t hangup;
+
+    sigemptyset(&hangup);
+    sigaddset(&hangup, SIGHUP);
+
+    while (manager->simulation_running) {
+        if (sigtimedwait(&hangup, NULL, &timeout) == SIGHUP) {
+            scenario_reload(manager, SCENARIO_PATH);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Local helper that reads and checks a scenario file.
+ *
+ * @param[out] scenario Pointer to the `Scenario` to fill in.
+ * @param[in]  path     Path of the scenario file.
+ * @return 0 on success, 1 if the file could not be read or has an error, which is printed.
+ */
+static int scenario_parse(Scenario *scenario, const char *path) {
+    char line[256];
+    char *words[SCENARIO_WORDS];
+    int number = 0, error = 0;
+
+    memset(scenario, 0, sizeof(Scenario));
+    scenario->low = PARAM_RESOURCE_LOW;
+    scenario->high = PARAM_RESOURCE_HIGH;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Reload: cannot open %s\n", path);
+        return 1;
+    }
+
+    while (!error && fgets(line, sizeof(line), file) != NULL) {
+        int n = scenario_split(line, words);
+        number++;
+
+        if (n == 0 || words[0][0] == '#') continue;
+
+        if (strcmp(words[0], "resource") == 0 && n == 4 && scenario->n_resources < SCENARIO_ENTRIES) {
+            ScenarioResource *resource = &scenario->resources[scenario->n_resources++];
+            snprintf(resource->name, SCENARIO_NAME, "%s", words[1]);
+            resource->amount = atoi(words[2]);
+            resource->capacity = atoi(words[3]);
+            error = resource->capacity <= 0 || resource->amount < 0 || resource->amount > resource->capacity;
+        }
+        else if (strcmp(words[0], "system") == 0 && n == 7 && scenario->n_systems < SCENARIO_ENTRIES) {
+            ScenarioSystem *system = &scenario->systems[scenario->n_systems++];
+            snprintf(system->name, SCENARIO_NAME, "%s", words[1]);
+            snprintf(system->input, SCENARIO_NAME, "%s", words[2]);
+            snprintf(system->output, SCENARIO_NAME, "%s", strcmp(words[3], "-") == 0 ? "" : words[3]);
+            system->input_amount = atoi(words[4]);
+            system->output_amount = atoi(words[5]);
+            system->processing_time = atoi(words[6]);
+            error = system->input_amount <= 0 || system->output_amount < 0 || system->processing_time <= 0;
+        }
+        else if (strcmp(words[0], "thresholds") == 0 && n == 3) {
+            scenario->low = atoi(words[1]);
+            scenario->high = atoi(words[2]);
+            error = scenario->low < 0 || scenario->high < scenario->low;
+        }
+        else {
+            error = 1;
+        }
+    }
+    fclose(file);
+
+    // Every resource a recipe names must be listed
+    for (int i = 0; i < scenario->n_systems && !error; i++) {
+        const ScenarioSystem *system = &scenario->systems[i];
+        int input = 0, output = system->output[0] == '\0';
+        for (int r = 0; r < scenario->n_resources; r++) {
+            if (strcmp(scenario->resources[r].name, system->input) == 0) input = 1;
+            if (strcmp(scenario->resources[r].name, system->output) == 0) output = 1;
+        }
+        if (!input || !output) {
+            printf("Reload: %s: system [%s] uses a resource that is not listed\n", path, system->name);
+            return 1;
+        }
+    }
+
+    if (error) {
+        printf("Reload: %s:%d: invalid line, nothing was changed\n", path, number);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Local helper that splits a line into words in place, a word in double quotes may contain spaces.
+ *
+ * @param[in,out] line  The line, its separators are overwritten.
+ * @param[out]    words At least `SCENARIO_WORDS` pointers, set to the start of each word.
+ * @return The number of words, more than `SCENARIO_WORDS` are dropped.
+ */
+static int scenario_split(char *line, char **words) {
+    int n = 0;
+    char *c = line;
+
+    while (*c != '\0') {
+        while (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n') c++;
+        if (*c == '\0') break;
+
+        char end = ' ';
+        if (*c == '"') {
+            end = '"';
+            c++;
+        }
+        if (n < SCENARIO_WORDS) words[n] = c;
+        n++;
+
+        while (*c != '\0' && *c != end && (end == '"' || (*c != '\t' && *c != '\r' && *c != '\n'))) c++;
+        if (*c != '\0') *c++ = '\0';
+    }
+    return n < SCENARIO_WORDS ? n : SCENARIO_WORDS;
+}
+
+/**
+ * Local helper that applies a checked scenario to the running simulation. Must hold `reconfig_lock()`.
+ *
+ * @param[in,out] manager  Pointer to the running `Manager`.
+ * @param[in]     scenario Pointer to the `Scenario` to apply.
+ * @return The number of changes applied.
+ */
+static int scenario_apply(Manager *manager, const Scenario *scenario) {
+    int changes = 0;
+
+    // Resources first, the recipes below refer to them
+    for (int i = 0; i < scenario->n_resources; i++) {
+        const ScenarioResource *spec = &scenario->resources[i];
+        Resource *resource = scenario_find_resource(manager, spec->name);
+
+        if (resource == NULL) {
+            resource_create(&resource, spec->name, spec->amount, spec->capacity);
+            reconfig_attach_resource(manager, resource);
+            printf("Reload: attached resource [%s]\n", spec->name);
+            changes++;
+        } else if (resource->max_capacity != spec->capacity) {
+            printf("Reload: [%s] capacity %d -> %d\n", spec->name, resource->max_capacity, spec->capacity);
+            resource_set_capacity(resource, spec->capacity);
+            changes++;
+        }
+    }
+
+    for (int i = 0; i < scenario->n_systems; i++) {
+        const ScenarioSystem *spec = &scenario->systems[i];
+        System *system = scenario_find_system(manager, spec->name);
+        Recipe recipe;
+
+        recipe_init(&recipe, scenario_find_resource(manager, spec->input),
+            spec->output[0] != '\0' ? scenario_find_resource(manager, spec->output) : NULL,
+            spec->input_amount, spec->output_amount, spec->processing_time);
+        recipe.low_threshold = spec->input_amount * scenario->low;
+        recipe.high_threshold = spec->input_amount * scenario->high;
+
+        if (system == NULL) {
+            system_create(&system, spec->name, recipe, &manager->event_queue);
+            if (reconfig_attach_system(manager, system) != 0) {
+                system_destroy(system);
+                continue;
+            }
+            printf("Reload: attached system [%s]\n", spec->name);
+            changes++;
+        } else if (!scenario_recipe_equal(system->recipe, &recipe)) {
+            // Only this thread replaces recipes, so the current one cannot be freed while it is compared
+            system_set_recipe(system, recipe);
+            printf("Reload: [%s] takes %d, makes %d every %d ms, thresholds %d / %d\n", spec->name,
+                recipe.input_amount, recipe.output_amount, recipe.processing_time, recipe.low_threshold, recipe.high_threshold);
+            changes++;
+        }
+    }
+
+    // Systems dropped from the scenario are detached, which waits for their current cycle
+    for (int i = 0; i < system_array_size(&manager->system_array); i++) {
+        System *system = system_array_get(&manager->system_array, i);
+        if (system == NULL || scenario_lists_system(scenario, system->info.name)) continue;
+
+        printf("Reload: detaching system [%s]\n", system->info.name);
+        reconfig_detach_system(manager, system);
+        changes++;
+    }
+
+    return changes;
+}
+
+/**
+ * Local helper that finds an attached resource by name.
+ *
+ * @return The resource, NULL if none is attached with that name.
+ */
+static Resource *scenario_find_resource(const Manager *manager, const char *name) {
+    for (int i = 0; i < storage_size(&manager->resources); i++) {
+        Resource *resource = storage_get(&manager->resources, i);
+        if (resource != NULL && strcmp(resource->info.name, name) == 0) return resource;
+    }
+    return NULL;
+}
+
+/**
+ * Local helper that finds an attached system by name.
+ *
+ * @return The system, NULL if none is attached with that name.
+ */
+static System *scenario_find_system(const Manager *manager, const char *name) {
+    for (int i = 0; i < system_array_size(&manager->system_array); i++) {
+        System *system = system_array_get(&manager->system_array, i);
+        if (system != NULL && strcmp(system->info.name, name) == 0) return system;
+    }
+    return NULL;
+}
+
+/**
+ * Local helper that checks whether a scenario lists a system.
+ *
+ * @return 1 if it does, 0 otherwise.
+ */
+static int scenario_lists_system(const Scenario *scenario, const char *name) {
+    for (int i = 0; i < scenario->n_systems; i++) {
+        if (strcmp(scenario->systems[i].name, name) == 0) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Local helper that compares two recipes field by field.
+ *
+ * @return 1 if they are the same, 0 otherwise.
+ */
+static int scenario_recipe_equal(const Recipe *a, const Recipe *b) {
+    return a->input == b->input && a->output == b->output && a->input_amount == b->input_amount &&
+        a->output_amount == b->output_amount && a->processing_time == b->processing_time &&
+        a->low_threshold == b->low_threshold && a->high_threshold == b->high_threshold;
+}
@@ -0,0 +1,402 @@
+/***************************************************************
+ * sensitivity.c
+ * Contains the sensitivity analysis of the flight's outcome.
+ * Every recipe field of every system and the starting amount of every resource in `load_data()` is
+ * a parameter. Each one is nudged down and up by `SENSITIVITY_STEP` percent and the flight is run on
+ * the sequential discrete-event engine, giving a central finite difference of the distance, the
+ * duration and how often the destination is reached.
+ *
+ * The differences are taken over an ensemble of `SENSITIVITY_ENSEMBLE` jittered runs. The baseline and
+ * every nudged vehicle are run with the same seeds, common random numbers, so each difference compares
+ * two runs that saw the same noise and the ensemble only has to average out what the change itself did.
+ * Every run is an independent job on a pool of worker threads writing to a slot of its own, so the
+ * table is the same whatever the number of threads. With `RESULT_CACHE` a repeated analysis is
+ * answered from disk, and with `RESULTS_STORE` every run is appended to a columnar file by the
+ * worker that ran it.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+
+#define SENSITIVITY_INPUT_AMOUNT    0  // Field of a parameter, see `fields`
+#define SENSITIVITY_OUTPUT_AMOUNT   1
+#define SENSITIVITY_PROCESSING_TIME 2
+#define SENSITIVITY_LOW_THRESHOLD   3
+#define SENSITIVITY_HIGH_THRESHOLD  4
+#define SENSITIVITY_RESOURCE_AMOUNT 5
+
+// A recipe field or starting amount the analysis nudges
+typedef struct SensitivityParameter {
+    char name[64];
+    int target;         // Id of the system, or of the resource for SENSITIVITY_RESOURCE_AMOUNT
+    int field;          // SENSITIVITY_INPUT_AMOUNT, ...
+    int base;           // Value in `load_data()`
+    int low, high;      // Values it is nudged to, one of them may be `base` at the edge of its range
+} SensitivityParameter;
+
+// What one parameter does to the outcome, per unit of the parameter
+typedef struct SensitivityRow {
+    int parameter;
+    double distance, distance_error;    // Mean difference of the distance and its standard error
+    double duration, duration_error;    // Same for the duration in simulated seconds
+    double destination;                 // Difference of the fraction of runs reaching the destination
+    double score;                       // Largest relative effect, the table is ranked by it
+} SensitivityRow;
+
+// Every run of the analysis, shared with the worker threads
+typedef struct SensitivityBatch {
+    const SensitivityParameter *parameters;
+    DesResult *results;  // Indexed by variant * SENSITIVITY_ENSEMBLE + member
+    WorkPool pool;       // One job per run
+    ColumnFile *store;   // File every run is appended to, NULL for none
+    long started;        // Wall clock second the analysis started, tells analyses in the file apart
+} SensitivityBatch;
+
+static const char *fields[] = {"input amount", "output amount", "processing time", "low threshold", "high threshold", "starting amount"};
+
+// Row of the results file, `field` and `target` are -1 for the baseline
+static const ColumnSpec columns[] = {
+    {"started", COLUMN_INT}, {"job", COLUMN_INT}, {"seed", COLUMN_INT}, {"member", COLUMN_INT},
+    {"field", COLUMN_INT}, {"target", COLUMN_INT}, {"value", COLUMN_INT},
+    {"distance", COLUMN_INT}, {"duration_s", COLUMN_DOUBLE}, {"cause", COLUMN_INT},
+    {"steps", COLUMN_INT}, {"events", COLUMN_INT}, {"wall_s", COLUMN_DOUBLE},
+};
+
+static int  sensitivity_parameters(SensitivityParameter **parameters);
+static void sensitivity_add(SensitivityParameter **parameters, int *n, int *capacity, const char *owner, int target, int field, int base, int min, int max);
+static void sensitivity_evaluate(const SensitivityBatch *batch, int job, DesResult *result);
+static void *sensitivity_worker(void *arg);
+static void sensitivity_record(const SensitivityBatch *batch, int job, ColumnBuffer *buffer);
+static uint64_t sensitivity_seed(int member);
+static void sensitivity_row(const SensitivityBatch *batch, int p, const double *means, SensitivityRow *row);
+static int  sensitivity_compare(const void *a, const void *b);
+
+/**
+ * Runs the sensitivity analysis and prints the parameters ranked by how much they change the outcome.
+ *
+ * @return The mean distance reached by the baseline ensemble.
+ */
+int sensitivity_run(void) {
+    SensitivityParameter *parameters;
+    SensitivityBatch batch;
+    ColumnFile store;
+    int n_threads = pool_threads();
+    double means[3] = {0, 0, 0};    // Baseline distance, duration in seconds and destination fraction
+    int reached = 0, depleted = 0;
+    struct timespec start, end;
+
+    int n_parameters = sensitivity_parameters(&parameters);
+    int n_variants = 1 + 2 * n_parameters;  // The baseline, then each parameter low and high
+    SensitivityRow *rows = malloc(n_parameters * sizeof(SensitivityRow));
+
+    batch.parameters = parameters;
+    batch.pool.size = n_variants * SENSITIVITY_ENSEMBLE;
+    batch.results = malloc(batch.pool.size * sizeof(DesResult));
+    batch.store = NULL;
+    batch.started = time(NULL);
+    if (RESULTS_STORE && column_open(&store, RESULTS_PATH, columns, sizeof(columns) / sizeof(columns[0])) == 0) {
+        batch.store = &store;
+    }
+    assert(rows && batch.results);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pool_run(&batch.pool, sensitivity_worker, &batch, n_threads);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (batch.store != NULL) {
+        printf("Results store: %d run(s) appended to %s in %ld block(s)\n", batch.pool.size, RESULTS_PATH, store.blocks);
+        column_close(&store);
+    }
+
+    for (int m = 0; m < SENSITIVITY_ENSEMBLE; m++) {
+        const DesResult *result = &batch.results[m];
+        means[0] += result->distance;
+        means[1] += result->duration_ms / 1000.0;
+        if (result->cause == DES_CAUSE_DESTINATION) reached++;
+        if (result->cause == DES_CAUSE_OXYGEN) depleted++;
+    }
+    means[0] /= SENSITIVITY_ENSEMBLE;
+    means[1] /= SENSITIVITY_ENSEMBLE;
+    means[2] = (double)reached / SENSITIVITY_ENSEMBLE;
+
+    for (int p = 0; p < n_parameters; p++) {
+        sensitivity_row(&batch, p, means, &rows[p]);
+    }
+    qsort(rows, n_parameters, sizeof(SensitivityRow), sensitivity_compare);
+
+    printf("Sensitivity: %d parameter(s), %d run(s) on %d thread(s) in %.2f s, %d seed(s) from %d, jitter %d%%, step %d%%\n",
+        n_parameters, batch.pool.size, n_threads, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+        SENSITIVITY_ENSEMBLE, SENSITIVITY_SEED, PARAM_DES_JITTER, SENSITIVITY_STEP);
+    if (RESULT_CACHE) {
+        long hits, misses;
+        cache_stats(&hits, &misses);
+        printf("Result cache: %ld run(s) answered from %s, %ld simulated\n", hits, CACHE_PATH, misses);
+        cache_close();
+    }
+    printf("Baseline: %.1f furlongs in %.1f s on average, destination reached %d/%d, oxygen depleted %d/%d\n",
+        means[0], means[1], reached, SENSITIVITY_ENSEMBLE, depleted, SENSITIVITY_ENSEMBLE);
+    printf("Changes per unit of the parameter, +- one standard error over the ensemble; score is the largest relative effect\n");
+    printf("%4s  %-34s %6s %9s  %-20s  %-20s %10s %7s\n",
+        "Rank", "Parameter", "Value", "Range", "Distance", "Duration (s)", "P(dest.)", "Score");
+    for (int i = 0; i < n_parameters; i++) {
+        const SensitivityRow *row = &rows[i];
+        const SensitivityParameter *parameter = &parameters[row->parameter];
+        char range[24], distance[32], duration[32];
+
+        snprintf(range, sizeof(range), "%d..%d", parameter->low, parameter->high);
+        snprintf(distance, sizeof(distance), "%+.3f +- %.3f", row->distance, row->distance_error);
+        snprintf(duration, sizeof(duration), "%+.3f +- %.3f", row->duration, row->duration_error);
+        printf("%4d  %-34s %6d %9s  %-20s  %-20s %+10.4f %7.3f\n",
+            i + 1, parameter->name, parameter->base, range, distance, duration, row->destination, row->score);
+    }
+
+    free(parameters);
+    free(rows);
+    free(batch.results);
+    return (int)(means[0] + 0.5);
+}
+
+/**
+ * Local helper that lists the parameters of the vehicle in `load_data()`.
+ *
+ * @param[out] parameters Set to a new array of the parameters, freed by the caller.
+ * @return The number of parameters.
+ */
+static int sensitivity_parameters(SensitivityParameter **parameters) {
+    Manager manager;
+    int n = 0, capacity = 16;
+
+    *parameters = malloc(capacity * sizeof(SensitivityParameter));
+    assert(*parameters != NULL);
+    manager_init(&manager);
+    load_data(&manager);
+
+    for (int i = 0; i < manager.system_array.size; i++) {
+        const System *system = manager.system_array.systems[i];
+        const Recipe *recipe = system->recipe;
+
+        sensitivity_add(parameters, &n, &capacity, system->info.name, i, SENSITIVITY_INPUT_AMOUNT, recipe->input_amount, 1, INT_MAX);
+        if (recipe->output != NULL) {
+            sensitivity_add(parameters, &n, &capacity, system->info.name, i, SENSITIVITY_OUTPUT_AMOUNT, recipe->output_amount, 0, INT_MAX);
+        }
+        sensitivity_add(parameters, &n, &capacity, system->info.name, i, SENSITIVITY_PROCESSING_TIME, recipe->processing_time, 1, INT_MAX);
+        if (recipe->input != NULL) {
+            sensitivity_add(parameters, &n, &capacity, system->info.name, i, SENSITIVITY_LOW_THRESHOLD, recipe->low_threshold, 0, INT_MAX);
+            sensitivity_add(parameters, &n, &capacity, system->info.name, i, SENSITIVITY_HIGH_THRESHOLD, recipe->high_threshold, 0, INT_MAX);
+        }
+    }
+    for (int r = 0; r < manager.resources.size; r++) {
+        const Resource *resource = manager.resources.resources[r];
+        sensitivity_add(parameters, &n, &capacity, resource->info.name, r, SENSITIVITY_RESOURCE_AMOUNT, resource->amount, 0, resource->max_capacity);
+    }
+
+    manager_clean(&manager);
+    return n;
+}
+
+/**
+ * Local helper that appends a parameter and works out the values it is nudged to.
+ *
+ * @param[in,out] parameters Pointer to the array of parameters, replaced when it grows.
+ * @param[in,out] n          Number of parameters in the array.
+ * @param[in,out] capacity   Capacity of the array.
+ * @param[in]     owner      Name of the system or resource the parameter belongs to.
+ * @param[in]     target     Id of the system or resource.
+ * @param[in]     field      SENSITIVITY_INPUT_AMOUNT, ...
+ * @param[in]     base       Value of the parameter in `load_data()`.
+ * @param[in]     min        Smallest value the parameter may take.
+ * @param[in]     max        Largest value the parameter may take.
+ */
+static void sensitivity_add(SensitivityParameter **parameters, int *n, int *capacity, const char *owner, int target, int field, int base, int min, int max) {
+    if (*n == *capacity) {
+        // Can't use realloc, copy over manually like the other arrays
+        SensitivityParameter *grown = malloc(*capacity * 2 * sizeof(SensitivityParameter));
+        assert(grown != NULL);
+        memcpy(grown, *parameters, *n * sizeof(SensitivityParameter));
+        free(*parameters);
+        *parameters = grown;
+        *capacity *= 2;
+    }
+
+    SensitivityParameter *parameter = &(*parameters)[(*n)++];
+    int step = base * SENSITIVITY_STEP / 100;
+    if (step < 1) step = 1;
+
+    snprintf(parameter->name, sizeof(parameter->name), "%s %s", owner, fields[field]);
+    parameter->target = target;
+    parameter->field = field;
+    parameter->base = base;
+    parameter->low = base - step < min ? min : base - step;
+    parameter->high = base > max - step ? max : base + step;
+}
+
+/**
+ * Local helper that runs one job: a member of the ensemble on the baseline or a nudged vehicle.
+ *
+ * @param[in]  batch  Pointer to the `SensitivityBatch` the job belongs to.
+ * @param[in]  job    Index of the job.
+ * @param[out] result Pointer to the `DesResult` to fill.
+ */
+static void sensitivity_evaluate(const SensitivityBatch *batch, int job, DesResult *result) {
+    int variant = job / SENSITIVITY_ENSEMBLE;
+    int member = job % SENSITIVITY_ENSEMBLE;
+    Manager manager;
+
+    manager_init(&manager);
+    load_data(&manager);
+
+    if (variant > 0) {
+        const SensitivityParameter *parameter = &batch->parameters[(variant - 1) / 2];
+        int value = (variant - 1) % 2 == 0 ? parameter->low : parameter->high;
+
+        if (parameter->field == SENSITIVITY_RESOURCE_AMOUNT) {
+            manager.resources.resources[parameter->target]->amount = value;
+        } else {
+            System *system = manager.system_array.systems[parameter->target];
+            Recipe recipe = *system->recipe;
+            if (parameter->field == SENSITIVITY_INPUT_AMOUNT) recipe.input_amount = value;
+            if (parameter->field == SENSITIVITY_OUTPUT_AMOUNT) recipe.output_amount = value;
+            if (parameter->field == SENSITIVITY_PROCESSING_TIME) recipe.processing_time = value;
+            if (parameter->field == SENSITIVITY_LOW_THRESHOLD) recipe.low_threshold = value;
+            if (parameter->field == SENSITIVITY_HIGH_THRESHOLD) recipe.high_threshold = value;
+            system_set_recipe(system, recipe);
+        }
+    }
+
+    cache_run_until(&manager, DES_ENGINE_SEQUENTIAL, 1, PARAM_DES_HORIZON, sensitivity_seed(member), result);
+    manager_clean(&manager);
+}
+
+/**
+ * Thread function that runs jobs of the analysis until none are left.
+ *
+ * @param[in] arg Pointer to the SensitivityBatch structure (cast from void*)
+ * @return NULL (required for pthread function signature)
+ */
+static void *sensitivity_worker(void *arg) {
+    SensitivityBatch *batch = (SensitivityBatch *)arg;
+    ColumnBuffer buffer;
+    int job;
+
+    // Each worker buffers its own rows, the file is only shared a block at a time
+    if (batch->store != NULL) column_buffer_init(&buffer, batch->store);
+    while ((job = pool_take(&batch->pool)) >= 0) {
+        sensitivity_evaluate(batch, job, &batch->results[job]);
+        if (batch->store != NULL) sensitivity_record(batch, job, &buffer);
+    }
+    if (batch->store != NULL) column_buffer_free(&buffer);
+    return NULL;
+}
+
+/**
+ * Local helper that adds a finished job to a worker's rows of the results file.
+ *
+ * @param[in]     batch  Pointer to the `SensitivityBatch` the job belongs to.
+ * @param[in]     job    Index of the finished job.
+ * @param[in,out] buffer Pointer to the worker's `ColumnBuffer`.
+ */
+static void sensitivity_record(const SensitivityBatch *batch, int job, ColumnBuffer *buffer) {
+    const DesResult *result = &batch->results[job];
+    int variant = job / SENSITIVITY_ENSEMBLE;
+    ColumnValue row[sizeof(columns) / sizeof(columns[0])];
+    int field = -1, target = -1, value = 0;
+
+    if (variant > 0) {
+        const SensitivityParameter *parameter = &batch->parameters[(variant - 1) / 2];
+        field = parameter->field;
+        target = parameter->target;
+        value = (variant - 1) % 2 == 0 ? parameter->low : parameter->high;
+    }
+
+    row[0].i = batch->started;
+    row[1].i = job;
+    row[2].i = SENSITIVITY_SEED;
+    row[3].i = job % SENSITIVITY_ENSEMBLE;
+    row[4].i = field;
+    row[5].i = target;
+    row[6].i = value;
+    row[7].i = result->distance;
+    row[8].d = result->duration_ms / 1000.0;
+    row[9].i = result->cause;
+    row[10].i = result->steps;
+    row[11].i = result->events;
+    row[12].d = result->wall_s;
+    column_append(buffer, row);
+}
+
+/**
+ * Local helper that derives the jitter seed of an ensemble member, the same for every vehicle.
+ *
+ * @param[in] member Index of the member in the ensemble.
+ * @return A seed other than 0, which would turn the jitter off.
+ */
+static uint64_t sensitivity_seed(int member) {
+    uint64_t seed = (uint64_t)SENSITIVITY_SEED * 0x9E3779B97F4A7C15ULL + (uint64_t)member + 1;
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+    seed ^= seed >> 31;
+    return seed != 0 ? seed : 1;
+}
+
+/**
+ * Local helper that takes the finite differences of one parameter, member by member.
+ *
+ * @param[in]  batch Pointer to the finished `SensitivityBatch`.
+ * @param[in]  p     Index of the parameter.
+ * @param[in]  means Mean distance, duration in seconds and destination fraction of the baseline.
+ * @param[out] row   Pointer to the `SensitivityRow` to fill.
+ */
+static void sensitivity_row(const SensitivityBatch *batch, int p, const double *means, SensitivityRow *row) {
+    const SensitivityParameter *parameter = &batch->parameters[p];
+    const DesResult *low = &batch->results[(1 + 2 * p) * SENSITIVITY_ENSEMBLE];
+    const DesResult *high = &batch->results[(2 + 2 * p) * SENSITIVITY_ENSEMBLE];
+    double width = parameter->high - parameter->low;
+    double sum[2] = {0, 0}, squares[2] = {0, 0};
+    int reached = 0;
+
+    memset(row, 0, sizeof(SensitivityRow));
+    row->parameter = p;
+    if (width == 0) return;
+
+    // Both runs of a member share their seed, so their difference is the parameter's effect plus little noise
+    for (int m = 0; m < SENSITIVITY_ENSEMBLE; m++) {
+        double distance = (high[m].distance - low[m].distance) / width;
+        double duration = (high[m].duration_ms - low[m].duration_ms) / 1000.0 / width;
+        sum[0] += distance;
+        sum[1] += duration;
+        squares[0] += distance * distance;
+        squares[1] += duration * duration;
+        reached += (high[m].cause == DES_CAUSE_DESTINATION) - (low[m].cause == DES_CAUSE_DESTINATION);
+    }
+
+    row->distance = sum[0] / SENSITIVITY_ENSEMBLE;
+    row->duration = sum[1] / SENSITIVITY_ENSEMBLE;
+    row->destination = reached / (double)SENSITIVITY_ENSEMBLE / width;
+    if (SENSITIVITY_ENSEMBLE > 1) {
+        double n = SENSITIVITY_ENSEMBLE;
+        row->distance_error = sqrt(fmax(0, squares[0] / n - row->distance * row->distance) / (n - 1));
+        row->duration_error = sqrt(fmax(0, squares[1] / n - row->duration * row->duration) / (n - 1));
+    }
+
+    // Relative effects: percent of outcome per percent of parameter, a starting amount of 0 counts its step instead
+    double scale = parameter->base != 0 ? parameter->base : width;
+    double effects[3] = {
+        means[0] != 0 ? fabs(row->distance * scale / means[0]) : 0,
+        means[1] != 0 ? fabs(row->duration * scale / means[1]) : 0,
+        fabs(row->destination * scale),
+    };
+    for (int k = 0; k < 3; k++) {
+        if (effects[k] > row->score) row->score = effects[k];
+    }
+}
+
+/**
+ * Local helper that orders rows by descending score, then by parameter so the order is always the same.
+ */
+static int sensitivity_compare(const void *a, const void *b) {
+    const SensitivityRow *x = (const SensitivityRow *)a;
+    const SensitivityRow *y = (const SensitivityRow *)b;
+    if (x->score != y->score) return x->score < y->score ? 1 : -1;
+    return x->parameter - y->parameter;
+}
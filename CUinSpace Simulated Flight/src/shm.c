@@ -0,0 +1,289 @@
+/***************************************************************
+ * shm.c
+ * Contains the multi-process shared-memory simulation mode.
+ * The manager and everything reachable from it (resources, systems, the event queue) are
+ * allocated from a POSIX shared-memory segment mapped before forking, so the manager and
+ * several worker processes running the systems share the same state without copies.
+ * Semaphores in the segment are process-shared. A process that dies may have held any of them,
+ * and nobody could ever post it again, so the first abnormal exit aborts the whole run rather than
+ * leaving the other processes to block on it forever.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SHM_ALIGN        16  // Alignment of every block handed out by the segment
+#define SHM_SIZE_CLASSES 64  // Freed blocks up to SHM_ALIGN * SHM_SIZE_CLASSES bytes are reused
+
+// Every block in the segment is preceded by its size class
+typedef struct ShmBlock {
+    uint32_t size_class;        // Index into the free lists, SHM_SIZE_CLASSES for large blocks
+    uint32_t line_aligned;      // Whether the block starts on a cache line, see `sim_alloc()`
+    struct ShmBlock *next_free; // Next block in the free list while the block is free
+} ShmBlock;
+
+// Lives at the very start of the segment
+typedef struct ShmHeader {
+    size_t size;        // Size of the whole segment in bytes
+    size_t used;        // Bytes handed out so far, blocks are bump allocated from the end of this header
+    sem_t mutex;        // Process-shared semaphore protecting the allocator
+    ShmBlock *free_lists[SHM_SIZE_CLASSES];
+    ShmBlock *line_free_lists[SHM_SIZE_CLASSES];  // Freed blocks that start on a cache line
+    Manager manager;    // The shared manager
+} ShmHeader;
+
+// The segment mapped into this process, inherited at the same address by every forked child
+static ShmHeader *shm_segment = NULL;
+
+static void shm_run_systems(Manager *manager, int worker);
+
+/**
+ * Creates the shared-memory segment and maps it into this process.
+ *
+ * From now on `sim_alloc()` hands out memory from the segment and semaphores are created process-shared.
+ *
+ * @return Pointer to the uninitialized `Manager` stored in the segment, NULL if the segment could not be created.
+ */
+Manager *shm_create(void) {
+    int fd = shm_open(SHM_SEGMENT_NAME, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+    if (ftruncate(fd, SHM_SEGMENT_SIZE) != 0) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(SHM_SEGMENT_NAME);
+        return NULL;
+    }
+
+    void *address = mmap(NULL, SHM_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(SHM_SEGMENT_NAME);
+        return NULL;
+    }
+
+    shm_segment = (ShmHeader *)address;
+    memset(shm_segment, 0, sizeof(ShmHeader));
+    shm_segment->size = SHM_SEGMENT_SIZE;
+    shm_segment->used = (sizeof(ShmHeader) + SHM_ALIGN - 1) / SHM_ALIGN * SHM_ALIGN;
+
+    int result = sem_init(&shm_segment->mutex, 1, 1);
+    assert(result == 0); // Check if the semaphore was initialized successfully
+
+    return &shm_segment->manager;
+}
+
+/**
+ * Unmaps and removes the shared-memory segment.
+ *
+ * Must only be called once no process uses the segment anymore.
+ */
+void shm_destroy(void) {
+    if (shm_segment != NULL) {
+        sem_destroy(&shm_segment->mutex);
+        munmap(shm_segment, shm_segment->size);
+        shm_unlink(SHM_SEGMENT_NAME);
+        shm_segment = NULL;
+    }
+}
+
+/**
+ * Runs the loaded simulation in separate processes.
+ *
+ * Forks one process for the manager and `SHM_WORKER_PROCESSES` workers, each running the threads of
+ * every `SHM_WORKER_PROCESSES`th system, and reaps them in whatever order they exit. If one crashes or
+ * exits with an error, the others are killed: it may have died holding a semaphore of the segment.
+ *
+ * @param[in,out] manager  Pointer to the `Manager` in the segment, already loaded.
+ * @return 0 if every process exited normally, 1 otherwise. After 1 the semaphores of the segment
+ *         may be held by a dead process and must not be waited on.
+ */
+int shm_run(Manager *manager) {
+    pid_t pids[SHM_WORKER_PROCESSES + 1];
+    int reaped[SHM_WORKER_PROCESSES + 1] = {0};
+    int killed[SHM_WORKER_PROCESSES + 1] = {0};
+    int forked = 0, failed = 0, aborted = 0;
+
+    assert(shm_segment != NULL && manager == &shm_segment->manager);
+    fflush(stdout);
+
+    for (int p = 0; p <= SHM_WORKER_PROCESSES; p++) {
+        pids[p] = fork();
+        if (pids[p] < 0) {
+            perror("fork");
+            manager->simulation_running = 0;
+            for (int i = 0; i < manager->system_array.size; i++) {
+                system_set_mode(manager->system_array.systems[i], MODE_TERMINATE);
+            }
+            failed = 1;
+            break;
+        }
+        if (pids[p] == 0) {
+            // Process 0 is the manager, the others are workers
+            if (p == 0) {
+                manager_thread(manager);
+            } else {
+                shm_run_systems(manager, p - 1);
+            }
+            fflush(stdout);
+            _exit(0);
+        }
+        forked++;
+    }
+
+    for (int remaining = forked; remaining > 0; ) {
+        int status, p;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            perror("waitpid");
+            break;
+        }
+        for (p = 0; p < forked && pids[p] != pid; p++) {
+        }
+        if (p == forked) continue;
+        reaped[p] = 1;
+        remaining--;
+        if (killed[p] || (WIFEXITED(status) && WEXITSTATUS(status) == 0)) continue;
+
+        if (WIFSIGNALED(status)) {
+            printf("Process %d (%s) killed by signal %d\n", (int)pid, p == 0 ? "manager" : "worker", WTERMSIG(status));
+        } else {
+            printf("Process %d (%s) exited with status %d\n", (int)pid, p == 0 ? "manager" : "worker", WEXITSTATUS(status));
+        }
+        failed = 1;
+        if (aborted) continue;
+        aborted = 1;
+
+        // A semaphore it held stays taken forever, the others would block on it sooner or later
+        printf("Aborting the run, the other processes are stopped\n");
+        for (int q = 0; q < forked; q++) {
+            if (!reaped[q] && kill(pids[q], SIGKILL) == 0) killed[q] = 1;
+        }
+        manager->simulation_running = 0;
+    }
+
+    return failed;
+}
+
+/**
+ * Allocates memory for simulation state.
+ *
+ * Comes from the shared-memory segment while one is mapped, and from the heap otherwise.
+ * Blocks from the segment are zeroed. Blocks of a whole number of cache lines, the size of structures
+ * aligned to one like `Resource` and `System`, start on a cache line in the segment and on the heap;
+ * every other block only gets `SHM_ALIGN`, so small allocations like names do not waste a line each.
+ *
+ * @param[in] size Number of bytes to allocate.
+ * @return Pointer to the allocated memory, NULL if the segment is full.
+ */
+void *sim_alloc(size_t size) {
+    if (shm_segment == NULL) {
+        return size % CACHE_LINE_SIZE == 0 ? aligned_alloc(CACHE_LINE_SIZE, size) : malloc(size);
+    }
+
+    size_t rounded = (size + SHM_ALIGN - 1) / SHM_ALIGN * SHM_ALIGN;
+    size_t size_class = rounded / SHM_ALIGN < SHM_SIZE_CLASSES ? rounded / SHM_ALIGN : SHM_SIZE_CLASSES;
+    int line_aligned = size % CACHE_LINE_SIZE == 0;
+    ShmBlock *block = NULL;
+
+    sem_wait(&shm_segment->mutex);
+    ShmBlock **free_list = line_aligned ? shm_segment->line_free_lists : shm_segment->free_lists;
+    if (size_class < SHM_SIZE_CLASSES && free_list[size_class] != NULL) {
+        // Reuse a freed block of the same size class and alignment
+        block = free_list[size_class];
+        free_list[size_class] = block->next_free;
+    } else {
+        // The segment is mapped on a page boundary, so offsets from it are aligned like addresses
+        size_t start = shm_segment->used;
+        if (line_aligned) {
+            start = (start + sizeof(ShmBlock) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE - sizeof(ShmBlock);
+        }
+        if (start + sizeof(ShmBlock) + rounded <= shm_segment->size) {
+            block = (ShmBlock *)((char *)shm_segment + start);
+            shm_segment->used = start + sizeof(ShmBlock) + rounded;
+        }
+    }
+    sem_post(&shm_segment->mutex);
+
+    if (block == NULL) {
+        return NULL;
+    }
+    block->size_class = size_class;
+    block->line_aligned = line_aligned;
+    memset(block + 1, 0, rounded);
+    return block + 1;
+}
+
+/**
+ * Frees memory allocated with `sim_alloc()`.
+ *
+ * Small blocks from the segment go back to their size class for reuse, large ones stay in the segment
+ * until it is destroyed.
+ *
+ * @param[in] ptr Pointer to the memory to free, may be NULL.
+ */
+void sim_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (shm_segment == NULL || (char *)ptr < (char *)shm_segment || (char *)ptr >= (char *)shm_segment + shm_segment->size) {
+        free(ptr);
+        return;
+    }
+
+    ShmBlock *block = (ShmBlock *)ptr - 1;
+    if (block->size_class >= SHM_SIZE_CLASSES) {
+        return;
+    }
+
+    sem_wait(&shm_segment->mutex);
+    ShmBlock **free_list = block->line_aligned ? shm_segment->line_free_lists : shm_segment->free_lists;
+    block->next_free = free_list[block->size_class];
+    free_list[block->size_class] = block;
+    sem_post(&shm_segment->mutex);
+}
+
+/**
+ * Tells whether new semaphores must be shared between processes.
+ *
+ * @return 1 while a shared-memory segment is mapped, 0 otherwise. Suitable as the `pshared` argument of `sem_init()`.
+ */
+int sim_pshared(void) {
+    return shm_segment != NULL;
+}
+
+/**
+ * Local helper that runs one worker's share of the systems, one thread per system.
+ *
+ * @param[in,out] manager Pointer to the shared `Manager`.
+ * @param[in]     worker  Index of this worker, it runs the systems whose index matches modulo the worker count.
+ */
+static void shm_run_systems(Manager *manager, int worker) {
+    int n = manager->system_array.size;
+    pthread_t *threads = malloc(n * sizeof(pthread_t));
+    int *started = calloc(n, sizeof(int));
+    assert(threads != NULL && started != NULL);
+
+    for (int i = worker; i < n; i += SHM_WORKER_PROCESSES) {
+        if (pthread_create(&threads[i], NULL, system_thread, manager->system_array.systems[i]) != 0) {
+            printf("Worker %d failed to create system thread %d\n", worker, i);
+            continue;
+        }
+        started[i] = 1;
+    }
+    for (int i = worker; i < n; i += SHM_WORKER_PROCESSES) {
+        if (started[i]) pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    free(started);
+}
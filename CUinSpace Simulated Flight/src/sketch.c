@@ -0,0 +1,195 @@
+/***************************************************************
+ * sketch.c
+ * Contains the streaming quantile sketches of resource levels.
+ * Each sketch is a histogram over logarithmically sized buckets, so any quantile it reports is
+ * within `SKETCH_ACCURACY` relative error of the true one. The buckets are fixed, which keeps the
+ * memory constant however long the flight, lets every update be a single atomic increment without
+ * locks, and makes merging two sketches (other runs, other copies of a resource) adding their counts.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#include <math.h>
+
+#define SKETCH_MAGIC   0x4B535543  // "CUSK" in little endian
+#define SKETCH_NAME    32          // Longest resource name kept in the sketch file
+
+// A named sketch as stored in the sketch file
+typedef struct SketchEntry {
+    char name[SKETCH_NAME];
+    QuantileSketch sketch;
+} SketchEntry;
+
+// Start of a sketch file
+typedef struct SketchHeader {
+    uint32_t magic;
+    uint32_t buckets;       // SKETCH_BUCKETS of the writer, files with other layouts are not merged
+    double accuracy;        // SKETCH_ACCURACY of the writer
+    uint32_t runs;          // Number of runs merged into the file
+    uint32_t count;         // Number of entries following the header
+} SketchHeader;
+
+static double sketch_gamma(void);
+static int sketch_find(SketchEntry *entries, int count, const char *name);
+
+/**
+ * Initializes an empty `QuantileSketch`.
+ *
+ * @param[out] sketch Pointer to the `QuantileSketch` to initialize.
+ */
+void sketch_init(QuantileSketch *sketch) {
+    memset(sketch, 0, sizeof(QuantileSketch));
+}
+
+/**
+ * Adds one sample to a sketch. Safe to call from any thread without a lock.
+ *
+ * @param[in,out] sketch Pointer to the `QuantileSketch`.
+ * @param[in]     value  The sample, negative values count as zero.
+ */
+void sketch_add(QuantileSketch *sketch, int value) {
+    if (value <= 0) {
+        __atomic_fetch_add(&sketch->zero, 1, __ATOMIC_RELAXED);
+    } else {
+        // Bucket i holds the values in (gamma^(i-1), gamma^i]
+        int bucket = (int)ceil(log(value) / log(sketch_gamma()));
+        if (bucket >= SKETCH_BUCKETS) bucket = SKETCH_BUCKETS - 1;
+        __atomic_fetch_add(&sketch->buckets[bucket], 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&sketch->count, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Adds every sample of one sketch to another.
+ *
+ * @param[in,out] into Pointer to the `QuantileSketch` to merge into.
+ * @param[in]     from Pointer to the `QuantileSketch` to merge.
+ */
+void sketch_merge(QuantileSketch *into, const QuantileSketch *from) {
+    into->zero += from->zero;
+    into->count += from->count;
+    for (int i = 0; i < SKETCH_BUCKETS; i++) {
+        into->buckets[i] += from->buckets[i];
+    }
+}
+
+/**
+ * Estimates a quantile of the samples in a sketch.
+ *
+ * @param[in] sketch Pointer to the `QuantileSketch`.
+ * @param[in] q      The quantile, between 0 and 1.
+ * @return The estimate, within `SKETCH_ACCURACY` relative error, or 0 for an empty sketch.
+ */
+double sketch_quantile(const QuantileSketch *sketch, double q) {
+    double gamma = sketch_gamma();
+    uint64_t rank = (uint64_t)(q * (sketch->count > 0 ? sketch->count - 1 : 0));
+    uint64_t seen = sketch->zero;
+
+    if (sketch->count == 0 || rank < seen) return 0;
+    for (int i = 0; i < SKETCH_BUCKETS; i++) {
+        seen += sketch->buckets[i];
+        if (rank < seen) {
+            // The point of the bucket with the same relative error to both of its ends
+            return 2 * pow(gamma, i) / (gamma + 1);
+        }
+    }
+    return pow(gamma, SKETCH_BUCKETS - 1);
+}
+
+/**
+ * Merges the level sketches of every resource by name, adds them to the sketch file and prints both.
+ *
+ * Copies of a resource in a fleet share a name and are merged into one distribution. The file keeps
+ * the merged sketches of every run so far and is rewritten with this run added.
+ *
+ * @param[in] manager Pointer to the `Manager` whose resources were sketched.
+ * @param[in] path    Path of the sketch file, created if it does not exist.
+ */
+void sketch_report(const Manager *manager, const char *path) {
+    SketchEntry *run = calloc(manager->resources.size + 1, sizeof(SketchEntry));
+    int n_run = 0;
+    assert(run != NULL);
+
+    for (int r = 0; r < manager->resources.size; r++) {
+        const Resource *resource = manager->resources.resources[r];
+        if (resource == NULL || resource->info.sketch == NULL) continue;
+
+        int e = sketch_find(run, n_run, resource->info.name);
+        if (e < 0) {
+            e = n_run++;
+            snprintf(run[e].name, SKETCH_NAME, "%s", resource->info.name);
+        }
+        sketch_merge(&run[e].sketch, resource->info.sketch);
+    }
+
+    // Read the runs so far, ignoring a file written with another bucket layout
+    SketchHeader header = {SKETCH_MAGIC, SKETCH_BUCKETS, SKETCH_ACCURACY, 0, 0};
+    SketchEntry *all = NULL;
+    FILE *file = fopen(path, "rb");
+    if (file != NULL) {
+        SketchHeader read;
+        if (fread(&read, sizeof(read), 1, file) == 1 && read.magic == SKETCH_MAGIC &&
+            read.buckets == SKETCH_BUCKETS && read.accuracy == SKETCH_ACCURACY) {
+            all = calloc(read.count + n_run + 1, sizeof(SketchEntry));
+            assert(all != NULL);
+            if (fread(all, sizeof(SketchEntry), read.count, file) == read.count) {
+                header = read;
+            }
+        }
+        fclose(file);
+    }
+    if (all == NULL) {
+        all = calloc(n_run + 1, sizeof(SketchEntry));
+        assert(all != NULL);
+    }
+    for (int e = 0; e < n_run; e++) {
+        int a = sketch_find(all, header.count, run[e].name);
+        if (a < 0) {
+            a = header.count++;
+            memcpy(all[a].name, run[e].name, SKETCH_NAME);
+        }
+        sketch_merge(&all[a].sketch, &run[e].sketch);
+    }
+    header.runs++;
+
+    file = fopen(path, "wb");
+    if (file == NULL || fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(all, sizeof(SketchEntry), header.count, file) != header.count) {
+        printf("Failed to write the level sketches to %s\n", path);
+    }
+    if (file != NULL) fclose(file);
+
+    printf("Resource levels (within %.0f%%)   this run: p1 / p50 / p99    all %u runs: p1 / p50 / p99\n",
+        SKETCH_ACCURACY * 100, header.runs);
+    for (int e = 0; e < n_run; e++) {
+        const QuantileSketch *mine = &run[e].sketch;
+        const QuantileSketch *merged = &all[sketch_find(all, header.count, run[e].name)].sketch;
+        printf("  %-20s %10.1f / %6.1f / %6.1f    %10.1f / %6.1f / %6.1f\n", run[e].name,
+            sketch_quantile(mine, 0.01), sketch_quantile(mine, 0.5), sketch_quantile(mine, 0.99),
+            sketch_quantile(merged, 0.01), sketch_quantile(merged, 0.5), sketch_quantile(merged, 0.99));
+    }
+
+    free(run);
+    free(all);
+}
+
+/**
+ * Local helper that returns the ratio between the ends of a bucket.
+ *
+ * @return (1 + SKETCH_ACCURACY) / (1 - SKETCH_ACCURACY)
+ */
+static double sketch_gamma(void) {
+    return (1 + SKETCH_ACCURACY) / (1 - SKETCH_ACCURACY);
+}
+
+/**
+ * Local helper that finds a named entry.
+ *
+ * @return Index of the entry, -1 if there is none with that name.
+ */
+static int sketch_find(SketchEntry *entries, int count, const char *name) {
+    for (int e = 0; e < count; e++) {
+        if (strncmp(entries[e].name, name, SKETCH_NAME - 1) == 0) return e;
+    }
+    return -1;
+}
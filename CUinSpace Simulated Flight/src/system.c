@@ -6,12 +6,18 @@
  ***************************************************************/
 
 #include "defs.h"
+#include <stddef.h>
 #include <assert.h>
 
+// A cycle and the manager's loop only touch the first cache line of a system
+_Static_assert(offsetof(System, info) == CACHE_LINE_SIZE, "the fields of a cycle must fit one cache line");
+
 // Helper functions just used by this C file to clean up our code
 // Using static means they can't get linked into other files
-static void system_simulate_process_time(System *);
-static void report_recipe_thresholds(System *system);
+static void system_run_cycle(System *system, const Recipe *recipe);
+static void system_simulate_process_time(System *system, const Recipe *recipe);
+static void report_recipe_thresholds(System *system, const Recipe *recipe);
+static void system_park(System *system);
 
 /**
  * Creates and initializes a `System` structure.
@@ -26,22 +32,37 @@ static void report_recipe_thresholds(System *system);
  */
 void system_create(System **system, const char *name, Recipe recipe, EventQueue *event_queue) {
     // Dynamically allocate memory for the System structure
-    *system = (System *)malloc(sizeof(System));
+    *system = (System *)sim_alloc(sizeof(System));
     assert(*system != NULL);
     
     // Dynamically allocate and copy the name
-    (*system)->name = (char *)malloc(strlen(name) + 1);
-    assert((*system)->name != NULL);
-    strcpy((*system)->name, name);
+    (*system)->info.name = (char *)sim_alloc(strlen(name) + 1);
+    assert((*system)->info.name != NULL);
+    strcpy((*system)->info.name, name);
     
-    // Initialize the recipe (copy by value)
-    (*system)->recipe = recipe;
+    (*system)->id = -1;
+    (*system)->info.cycle_input = NULL;
+    (*system)->info.cycle_output = NULL;
+
+    // Copy the recipe into its own block, which is never changed but replaced as a whole
+    Recipe *block = (Recipe *)sim_alloc(sizeof(Recipe));
+    assert(block != NULL);
+    *block = recipe;
+    (*system)->recipe = block;
     
     // Set the global event queue
     (*system)->global_queue = event_queue;
     
     // Initialize mode to STANDARD as default
     (*system)->mode = MODE_STANDARD;
+
+    // Initialize the semaphore used to wake the system up when it is enabled again
+    int result = sem_init(&(*system)->info.wake, sim_pshared(), 0);
+    assert(result == 0); // Check if the semaphore was initialized successfully
+
+    // Initialize the semaphore serializing mode changes
+    result = sem_init(&(*system)->info.mode_lock, sim_pshared(), 1);
+    assert(result == 0);
 }
 
 /**
@@ -53,13 +74,18 @@ void system_create(System **system, const char *name, Recipe recipe, EventQueue
  */
 void system_destroy(System *system) {
     if (system != NULL) {
-        // Free the dynamically allocated name
-        if (system->name != NULL) {
-            free(system->name);
+        // Destroy the semaphore
+        sem_destroy(&system->info.wake);
+        sem_destroy(&system->info.mode_lock);
+
+        // Free the dynamically allocated name and recipe
+        if (system->info.name != NULL) {
+            sim_free(system->info.name);
         }
+        sim_free((Recipe *)system->recipe);
         
         // Free the System structure itself
-        free(system);
+        sim_free(system);
     }
 }
 
@@ -73,14 +99,63 @@ int system_get_mode(const System *system) {
     return system->mode;
 }
 
+/**
+ * Tells whether a mode the manager decided replaces a system's current one.
+ *
+ * A parked producer (`MODE_DISABLED`) only leaves it to run faster for a consumer that needs more,
+ * or to terminate: `MODE_SLOW` or `MODE_STANDARD` would only run it until its output is full again.
+ *
+ * @param[in] current The system's current mode.
+ * @param[in] mode    The decided mode.
+ * @return 1 if the system should switch to `mode`, 0 if it keeps `current`.
+ */
+int system_mode_applies(int current, int mode) {
+    return current != MODE_DISABLED || (mode != MODE_SLOW && mode != MODE_STANDARD);
+}
+
 /**
  * Sets the mode of the system.
  *
+ * Leaving `MODE_DISABLED` wakes up the system's thread if it is parked. A parked system ignores
+ * `MODE_SLOW` and `MODE_STANDARD`, see `system_mode_applies()`.
+ *
  * @param[in,out] system Pointer to the `System` to set the mode for.
  * @param[in]     mode   The new mode to set for the system.
  */
 void system_set_mode(System *system, int mode) {
+    // The manager, the reconfiguration and the transports can all set a mode, so the change and the
+    // sequence number it is recorded with are taken under the same lock, like transfers and queue operations
+    sem_wait(&system->info.mode_lock);
+    int previous = system->mode;
+    if (!system_mode_applies(previous, mode)) {
+        sem_post(&system->info.mode_lock);
+        return;
+    }
     system->mode = mode;
+    record_mode(system, mode);
+    sem_post(&system->info.mode_lock);
+
+    if (previous == MODE_DISABLED && mode != MODE_DISABLED) {
+        sem_post(&system->info.wake);
+    }
+}
+
+/**
+ * Replaces the recipe of a system, which picks it up at the start of its next cycle.
+ *
+ * The new recipe is copied into a fresh block that is swapped in atomically, the old block is freed
+ * once no cycle or reader uses it anymore. Calls replacing the recipe of the same system must not overlap.
+ *
+ * @param[in,out] system Pointer to the `System` to change.
+ * @param[in]     recipe The new recipe.
+ */
+void system_set_recipe(System *system, Recipe recipe) {
+    Recipe *block = (Recipe *)sim_alloc(sizeof(Recipe));
+    assert(block != NULL);
+    *block = recipe;
+
+    Recipe *old = (Recipe *)__atomic_exchange_n(&system->recipe, block, __ATOMIC_ACQ_REL);
+    epoch_retire(old, sim_free);
 }
 
 /**
@@ -88,20 +163,49 @@ void system_set_mode(System *system, int mode) {
  *
  * Attempts to run the system's recipe, pulling input resources, processing them, and pushing output resources.
  * If SINGLE_THREAD_MODE is defined as a non-zero value, it will not wait for resources to accumulate before continuing.
+ * The whole cycle runs with the recipe it started with, even if it is replaced meanwhile.
  *
  * @param[in,out] system Pointer to the `System` to run.
  */
 void system_run(System *system) {
+    Recipe recipe;
+
+    // Copy the recipe at the cycle boundary, a cycle may park for long and must not hold up reclamation.
+    // Its resources are published before leaving the epoch, so a detach that waited out the epoch sees them
+    epoch_enter();
+    recipe = *__atomic_load_n(&system->recipe, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&system->info.cycle_input, recipe.input, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&system->info.cycle_output, recipe.output, __ATOMIC_SEQ_CST);
+    epoch_exit();
+
+    system_run_cycle(system, &recipe);
+    __atomic_store_n(&system->info.cycle_input, NULL, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&system->info.cycle_output, NULL, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Local helper that runs one cycle of a system with the given recipe.
+ *
+ * @param[in,out] system Pointer to the `System` to run.
+ * @param[in]     recipe Pointer to the `Recipe` the cycle uses.
+ */
+static void system_run_cycle(System *system, const Recipe *recipe) {
     int local_output_amount = 0;
 
+    // Disabled systems do no work at all, in multi-threaded mode their thread is parked instead
+    if (system_get_mode(system) == MODE_DISABLED) {
+        return;
+    }
+
     // Pull input resources until we have enough to convert
-    int amount_to_pull = system->recipe.input_amount;
+    int amount_to_pull = recipe->input_amount;
     while (amount_to_pull > 0 && system_get_mode(system) != MODE_TERMINATE) {
-        resource_transfer_from(system->recipe.input, &amount_to_pull);
+        system_park(system);
+        resource_transfer_from(recipe->input, &amount_to_pull);
         if (amount_to_pull > 0) {
             // If we don't have enough input resources, report the low status
             Event *event = malloc(sizeof(Event));  // Allocate new event
-            event_init(event, system, system->recipe.input, EVENT_INSUFFICIENT);
+            event_init(event, system, recipe->input, EVENT_INSUFFICIENT);
             event_queue_push(system->global_queue, event);
             free(event);
             usleep(PARAM_SYSTEM_WAIT * 1000 / PARAM_SPEED_MODIFIER);
@@ -112,21 +216,22 @@ void system_run(System *system) {
 
     // If we have enough input resources, process them
     if (amount_to_pull == 0) {
-        system_simulate_process_time(system);
-        local_output_amount = system->recipe.output_amount;
+        system_simulate_process_time(system, recipe);
+        local_output_amount = recipe->output_amount;
         Event *event = malloc(sizeof(Event));  // Allocate new event
-        event_init(event, system, system->recipe.input, EVENT_PRODUCED);
+        event_init(event, system, recipe->input, EVENT_PRODUCED);
         event_queue_push(system->global_queue, event);
         free(event);
     }
 
     // Push the resource to the centralized storage, IF there is even an output in the recipe
-    while (system->recipe.output && local_output_amount > 0 && system_get_mode(system) != MODE_TERMINATE) {
-        resource_transfer_into(system->recipe.output, &local_output_amount);
+    while (recipe->output && local_output_amount > 0 && system_get_mode(system) != MODE_TERMINATE) {
+        system_park(system);
+        resource_transfer_into(recipe->output, &local_output_amount);
         if (local_output_amount > 0) {
             // If we didn't load everything in, report that we're still at capacity
             Event *event = malloc(sizeof(Event));  // Allocate new event
-            event_init(event, system, system->recipe.output, EVENT_CAPACITY);
+            event_init(event, system, recipe->output, EVENT_CAPACITY);
             event_queue_push(system->global_queue, event);
             free(event);
             usleep(PARAM_SYSTEM_WAIT * 1000 / PARAM_SPEED_MODIFIER);
@@ -135,58 +240,76 @@ void system_run(System *system) {
         }
     }
 
-    report_recipe_thresholds(system);
+    report_recipe_thresholds(system, recipe);
 }
 
 /**
  * Thread safe local helper function that reports the current thresholds for a system's recipe.
  *
  * @param[in] system Pointer to the `System` to report thresholds for.
+ * @param[in] recipe Pointer to the `Recipe` of the cycle that just finished.
  */
-static void report_recipe_thresholds(System *system) {
+static void report_recipe_thresholds(System *system, const Recipe *recipe) {
     // Check if input resource exists
-    if (system->recipe.input == NULL) {
+    if (recipe->input == NULL) {
         return;  // Skip if no input resource
     }
     
-    int low_threshold = system->recipe.input_amount * PARAM_RESOURCE_LOW;
-    int high_threshold = system->recipe.input_amount * PARAM_RESOURCE_HIGH;
     int current_amount;
 
     // Acquire the semaphore
-    sem_wait(&system->recipe.input->mutex);
-    current_amount = system->recipe.input->amount;
-    sem_post(&system->recipe.input->mutex);
+    sem_wait(&recipe->input->mutex);
+    current_amount = recipe->input->amount;
+    sem_post(&recipe->input->mutex);
 
-    if (current_amount <= low_threshold) {
+    if (current_amount <= recipe->low_threshold) {
         Event *event = malloc(sizeof(Event));  // Allocate new event
-        event_init(event, system, system->recipe.input, EVENT_LOW);
+        event_init(event, system, recipe->input, EVENT_LOW);
         event_queue_push(system->global_queue, event);
         free(event);
-    } else if (current_amount > high_threshold) {
+    } else if (current_amount > recipe->high_threshold) {
         Event *event = malloc(sizeof(Event));  // Allocate new event
-        event_init(event, system, system->recipe.input, EVENT_HIGH);
+        event_init(event, system, recipe->input, EVENT_HIGH);
         event_queue_push(system->global_queue, event);
         free(event);
     }
 }
 
+/**
+ * Local helper function that parks the calling thread while its system is disabled.
+ *
+ * The thread blocks on the system's `wake` semaphore, so a disabled system costs no CPU, timers,
+ * events or lock traffic until the manager enables or terminates it. Does nothing in single-threaded mode,
+ * where nobody else could enable the system.
+ *
+ * @param[in,out] system Pointer to the `System` to park.
+ */
+static void system_park(System *system) {
+    if (SINGLE_THREAD_MODE) return;
+
+    // Loop since a wake up may be left over from an earlier time the system was enabled
+    while (system_get_mode(system) == MODE_DISABLED) {
+        sem_wait(&system->info.wake);
+    }
+}
+
 /**
  * Local helper function that simulates the processing time of a system.
  * 
  * @param[in] system Pointer to the `System` to simulate processing time for.
+ * @param[in] recipe Pointer to the `Recipe` of the current cycle.
  */
-static void system_simulate_process_time(System *system) {
+static void system_simulate_process_time(System *system, const Recipe *recipe) {
     int adjusted_processing_time;
     switch (system->mode) {
         case MODE_SLOW:
-            adjusted_processing_time = system->recipe.processing_time * 4;
+            adjusted_processing_time = recipe->processing_time * 4;
             break;
         case MODE_FAST:
-            adjusted_processing_time = system->recipe.processing_time / 4;
+            adjusted_processing_time = recipe->processing_time / 4;
             break;
         default:
-            adjusted_processing_time = system->recipe.processing_time;
+            adjusted_processing_time = recipe->processing_time;
     }
     usleep(adjusted_processing_time * 1000 / PARAM_SPEED_MODIFIER);
 }
@@ -206,7 +329,7 @@ void system_array_init(SystemArray *array) {
     array->size = 0;
     
     // Dynamically allocate memory for the systems array
-    array->systems = (System **)malloc(array->capacity * sizeof(System *));
+    array->systems = (System **)sim_alloc(array->capacity * sizeof(System *));
     assert(array->systems != NULL);
 }
 
@@ -228,7 +351,7 @@ void system_array_clean(SystemArray *array) {
         
         // Free the systems array itself
         if (array->systems != NULL) {
-            free(array->systems);
+            sim_free(array->systems);
         }
         
         // Reset array fields
@@ -256,23 +379,66 @@ void system_array_add(SystemArray *array, System *system) {
         int new_capacity = array->capacity * 2;
         
         // Manually allocate new memory (can't use realloc)
-        System **new_systems = (System **)malloc(new_capacity * sizeof(System *));
+        System **new_systems = (System **)sim_alloc(new_capacity * sizeof(System *));
         assert(new_systems != NULL);
         
         // Copy existing systems to new array
+        System **old_systems = array->systems;
         for (int i = 0; i < array->size; i++) {
             new_systems[i] = array->systems[i];
         }
         
-        // Free old array and update to new one
-        free(array->systems);
-        array->systems = new_systems;
+        // Publish the new array, readers still iterating the old one keep it until they are done
+        __atomic_store_n(&array->systems, new_systems, __ATOMIC_RELEASE);
+        epoch_retire(old_systems, sim_free);
         array->capacity = new_capacity;
     }
     
-    // Add the new system
-    array->systems[array->size] = system;
-    array->size++;
+    // Add the new system, it becomes visible to readers with the new size
+    system->id = array->size;
+    __atomic_store_n(&array->systems[array->size], system, __ATOMIC_RELEASE);
+    __atomic_store_n(&array->size, array->size + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Removes a `System` from a `SystemArray` while it may be read, leaving its slot empty.
+ *
+ * The system is not freed, readers may still hold it until the next `epoch_synchronize()`.
+ *
+ * @param[in,out] array Pointer to the `SystemArray` to remove the system from.
+ * @param[in]     system Pointer to the `System` to remove.
+ */
+void system_array_remove(SystemArray *array, const System *system) {
+    assert(array != NULL);
+    assert(system != NULL && system->id >= 0 && system->id < array->size);
+    assert(array->systems[system->id] == system);
+
+    __atomic_store_n(&array->systems[system->id], NULL, __ATOMIC_RELEASE);
+}
+
+/**
+ * Gets the number of slots in a `SystemArray`, safe to call while systems are attached.
+ *
+ * @param[in] array Pointer to the `SystemArray`.
+ * @return The number of slots, including empty ones left by removed systems.
+ */
+int system_array_size(const SystemArray *array) {
+    return __atomic_load_n(&array->size, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Gets the `System` in a slot of a `SystemArray`, safe to call while systems are attached or removed.
+ *
+ * Callers must be inside `epoch_enter()` if systems can be removed, and `i` must be below a
+ * size read earlier with `system_array_size()`.
+ *
+ * @param[in] array Pointer to the `SystemArray`.
+ * @param[in] i     Index of the slot.
+ * @return The system in the slot, NULL if it was removed.
+ */
+System *system_array_get(const SystemArray *array, int i) {
+    System **systems = __atomic_load_n(&array->systems, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&systems[i], __ATOMIC_ACQUIRE);
 }
 
 /**
@@ -291,9 +457,16 @@ void* system_thread(void *arg) {
         printf("Error: NULL system passed to system_thread\n");
         return NULL;
     }
+    record_attach(system->id);
+    invariant_attach(system->id);
+    audit_attach(system->id);
     
     // Run the system in a loop until the system is terminated
     while (system_get_mode(system) != MODE_TERMINATE) {
+        // Sleep here without any cost while the system is disabled
+        system_park(system);
+        if (system_get_mode(system) == MODE_TERMINATE) break;
+
         system_run(system);
 
         // Small delay to prevent spamming the event queue
@@ -0,0 +1,220 @@
+/***************************************************************
+ * threshold.c
+ * Contains the batched evaluator for recipe thresholds.
+ * Does the same classification as `report_recipe_thresholds()` for many systems at once,
+ * comparing gathered resource amounts against precomputed thresholds with SIMD compares.
+ * Uses AVX2 when the CPU supports it, SSE2 on other x86-64 CPUs, and plain C elsewhere.
+ ***************************************************************/
+
+#include "defs.h"
+#include <assert.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define THRESHOLD_LANES 8                                // Widest vector we evaluate at once
+#define THRESHOLD_ALIGN (THRESHOLD_LANES * sizeof(float)) // Alignment of all batch arrays
+
+static void *threshold_alloc(int count, size_t size);
+static void threshold_classify_scalar(ThresholdBatch *batch);
+#if defined(__x86_64__)
+static void threshold_classify_sse2(ThresholdBatch *batch);
+static void threshold_classify_avx2(ThresholdBatch *batch) __attribute__((target("avx2")));
+#endif
+
+/**
+ * Initializes a `ThresholdBatch` for a fixed number of systems.
+ *
+ * Every entry starts with thresholds that always classify as `THRESHOLD_OK`, so unused entries
+ * never report a change.
+ *
+ * @param[out] batch Pointer to the `ThresholdBatch` to initialize.
+ * @param[in]  size  Number of systems in the batch.
+ */
+void threshold_batch_init(ThresholdBatch *batch, int size) {
+    assert(batch != NULL);
+
+    batch->size = size;
+    batch->padded = (size + THRESHOLD_LANES - 1) / THRESHOLD_LANES * THRESHOLD_LANES;
+    batch->words = (batch->padded + 63) / 64;
+
+    batch->amount  = threshold_alloc(batch->padded, sizeof(float));
+    batch->need    = threshold_alloc(batch->padded, sizeof(float));
+    batch->low     = threshold_alloc(batch->padded, sizeof(float));
+    batch->high    = threshold_alloc(batch->padded, sizeof(float));
+    batch->status  = threshold_alloc(batch->padded, sizeof(int));
+    batch->changed = threshold_alloc(batch->words, sizeof(uint64_t));
+
+    for (int i = 0; i < batch->padded; i++) {
+        threshold_batch_set(batch, i, -1);
+    }
+}
+
+/**
+ * Cleans up a `ThresholdBatch` by freeing all of its arrays.
+ *
+ * @param[in,out] batch Pointer to the `ThresholdBatch` to clean.
+ */
+void threshold_batch_clean(ThresholdBatch *batch) {
+    if (batch != NULL) {
+        free(batch->amount);
+        free(batch->need);
+        free(batch->low);
+        free(batch->high);
+        free(batch->status);
+        free(batch->changed);
+        batch->size = 0;
+    }
+}
+
+/**
+ * Precomputes the thresholds of one system from its recipe's input amount.
+ *
+ * A negative input amount gives thresholds that always classify as `THRESHOLD_OK`,
+ * which is used for systems without an input resource.
+ *
+ * @param[in,out] batch        Pointer to the `ThresholdBatch`.
+ * @param[in]     i            Index of the system in the batch.
+ * @param[in]     input_amount Amount of input consumed by one cycle of the system's recipe.
+ */
+void threshold_batch_set(ThresholdBatch *batch, int i, int input_amount) {
+    if (input_amount < 0) {
+        batch->need[i] = -1.0f;
+        batch->low[i]  = -1.0f;
+        batch->high[i] = 3.0e38f;
+    } else {
+        batch->need[i] = input_amount;
+        batch->low[i]  = input_amount * PARAM_RESOURCE_LOW;
+        batch->high[i] = input_amount * PARAM_RESOURCE_HIGH;
+    }
+}
+
+/**
+ * Classifies every system of the batch from the amounts gathered into `batch->amount`.
+ *
+ * Each entry of `batch->status` becomes `THRESHOLD_INSUFFICIENT`, `THRESHOLD_LOW`, `THRESHOLD_OK` or
+ * `THRESHOLD_HIGH`, and `batch->changed` gets a set bit for every system whose classification differs
+ * from the previous call.
+ *
+ * @param[in,out] batch Pointer to the `ThresholdBatch` to classify.
+ * @return The number of systems whose classification changed.
+ */
+int threshold_batch_classify(ThresholdBatch *batch) {
+    int count = 0;
+
+#if defined(__x86_64__)
+    static int use_avx2 = -1;
+    if (use_avx2 < 0) {
+        use_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    if (use_avx2) {
+        threshold_classify_avx2(batch);
+    } else {
+        threshold_classify_sse2(batch);
+    }
+#else
+    threshold_classify_scalar(batch);
+#endif
+
+    for (int w = 0; w < batch->words; w++) {
+        count += __builtin_popcountll(batch->changed[w]);
+    }
+    return count;
+}
+
+/**
+ * Local helper that allocates a zeroed, vector aligned array padded to a whole number of vectors.
+ *
+ * @param[in] count Number of elements.
+ * @param[in] size  Size of one element in bytes.
+ * @return Pointer to the new array.
+ */
+static void *threshold_alloc(int count, size_t size) {
+    size_t bytes = ((count * size + THRESHOLD_ALIGN - 1) / THRESHOLD_ALIGN + 1) * THRESHOLD_ALIGN;
+    void *array = aligned_alloc(THRESHOLD_ALIGN, bytes);
+    assert(array != NULL);
+    memset(array, 0, bytes);
+    return array;
+}
+
+/**
+ * Local helper that classifies the batch one system at a time, for targets without SIMD support.
+ *
+ * @param[in,out] batch Pointer to the `ThresholdBatch` to classify.
+ */
+__attribute__((unused))
+static void threshold_classify_scalar(ThresholdBatch *batch) {
+    memset(batch->changed, 0, batch->words * sizeof(uint64_t));
+
+    for (int i = 0; i < batch->padded; i++) {
+        float amount = batch->amount[i];
+        int status = (amount <= batch->low[i]  ? THRESHOLD_LOW : 0)
+                   | (amount <  batch->need[i] ? THRESHOLD_INSUFFICIENT : 0)
+                   | (amount >  batch->high[i] ? THRESHOLD_HIGH : 0);
+
+        if (status != batch->status[i]) {
+            batch->status[i] = status;
+            batch->changed[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+}
+
+#if defined(__x86_64__)
+/**
+ * Local helper that classifies the batch four systems at a time with SSE2 compares.
+ *
+ * @param[in,out] batch Pointer to the `ThresholdBatch` to classify.
+ */
+static void threshold_classify_sse2(ThresholdBatch *batch) {
+    const __m128i low_bit  = _mm_set1_epi32(THRESHOLD_LOW);
+    const __m128i need_bit = _mm_set1_epi32(THRESHOLD_INSUFFICIENT);
+    const __m128i high_bit = _mm_set1_epi32(THRESHOLD_HIGH);
+
+    memset(batch->changed, 0, batch->words * sizeof(uint64_t));
+
+    for (int i = 0; i < batch->padded; i += 4) {
+        __m128 amount = _mm_load_ps(&batch->amount[i]);
+        __m128i is_low  = _mm_castps_si128(_mm_cmple_ps(amount, _mm_load_ps(&batch->low[i])));
+        __m128i is_need = _mm_castps_si128(_mm_cmplt_ps(amount, _mm_load_ps(&batch->need[i])));
+        __m128i is_high = _mm_castps_si128(_mm_cmpgt_ps(amount, _mm_load_ps(&batch->high[i])));
+        __m128i status = _mm_or_si128(_mm_or_si128(_mm_and_si128(is_low, low_bit),
+                                                   _mm_and_si128(is_need, need_bit)),
+                                      _mm_and_si128(is_high, high_bit));
+
+        __m128i *previous = (__m128i *)&batch->status[i];
+        uint64_t same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(status, _mm_load_si128(previous))));
+
+        _mm_store_si128(previous, status);
+        batch->changed[i / 64] |= (~same & 0xF) << (i % 64);
+    }
+}
+
+/**
+ * Local helper that classifies the batch eight systems at a time with AVX2 compares.
+ *
+ * @param[in,out] batch Pointer to the `ThresholdBatch` to classify.
+ */
+static void threshold_classify_avx2(ThresholdBatch *batch) {
+    const __m256i low_bit  = _mm256_set1_epi32(THRESHOLD_LOW);
+    const __m256i need_bit = _mm256_set1_epi32(THRESHOLD_INSUFFICIENT);
+    const __m256i high_bit = _mm256_set1_epi32(THRESHOLD_HIGH);
+
+    memset(batch->changed, 0, batch->words * sizeof(uint64_t));
+
+    for (int i = 0; i < batch->padded; i += 8) {
+        __m256 amount = _mm256_load_ps(&batch->amount[i]);
+        __m256i is_low  = _mm256_castps_si256(_mm256_cmp_ps(amount, _mm256_load_ps(&batch->low[i]),  _CMP_LE_OQ));
+        __m256i is_need = _mm256_castps_si256(_mm256_cmp_ps(amount, _mm256_load_ps(&batch->need[i]), _CMP_LT_OQ));
+        __m256i is_high = _mm256_castps_si256(_mm256_cmp_ps(amount, _mm256_load_ps(&batch->high[i]), _CMP_GT_OQ));
+        __m256i status = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(is_low, low_bit),
+                                                         _mm256_and_si256(is_need, need_bit)),
+                                         _mm256_and_si256(is_high, high_bit));
+
+        __m256i *previous = (__m256i *)&batch->status[i];
+        uint64_t same = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(status, _mm256_load_si256(previous))));
+
+        _mm256_store_si256(previous, status);
+        batch->changed[i / 64] |= (~same & 0xFF) << (i % 64);
+    }
+}
+#endif